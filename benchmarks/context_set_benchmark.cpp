@@ -0,0 +1,139 @@
+/// Benchmark for the memory of the MergedIndex context sets against the Roaring
+/// bitmap per occurrence and relation they replaced.
+///
+/// Usage:
+///   context_set_benchmark [OPTIONS]
+///
+/// Without options, synthetic shards indexed in a few contexts are measured.
+/// With --index-dir, every shard of a real project index is loaded into memory
+/// and measured instead.
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/context_set_benchmark \
+///       --index-dir /home/ykiko/C++/clice/.clice/index
+
+#include <cstdint>
+#include <format>
+#include <print>
+#include <sstream>
+#include <string>
+
+#include "index/merged_index.h"
+#include "support/filesystem.h"
+
+#include "kota/deco/deco.h"
+#include "llvm/Support/FileSystem.h"
+
+using namespace clice;
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--index-dir"}; help = "Measure the shards of this project index";
+           required = false;)
+    <std::string> index_dir;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+};
+
+/// A file index with `count` occurrences, each with one relation. `variant`
+/// adds one occurrence of its own, so every variant is a distinct context.
+index::FileIndex make_file_index(std::uint32_t count, std::uint32_t variant) {
+    index::FileIndex file_index;
+    for(std::uint32_t i = 0; i < count; i++) {
+        auto symbol = static_cast<index::SymbolHash>(i / 4 + 1) * 0x9E3779B97F4A7C15ULL;
+        file_index.occurrences.push_back({
+            .range = {i * 16, i * 16 + 8},
+            .target = symbol,
+        });
+        file_index.relations[symbol].push_back({
+            .kind = RelationKind::Reference,
+            .range = {i * 16, i * 16 + 8},
+            .target_symbol = 0,
+        });
+    }
+    file_index.occurrences.push_back({
+        .range = {count * 16 + variant, count * 16 + variant + 1},
+        .target = 1,
+    });
+    return file_index;
+}
+
+void report(llvm::StringRef label, std::size_t shards, const index::MergedIndex::ContextStats& s) {
+    auto saved = s.bitmap_bytes > 0 ? 100.0 * (1.0 - static_cast<double>(s.bytes) /
+                                                         static_cast<double>(s.bitmap_bytes))
+                                    : 0.0;
+    std::println("  {:<24} {:>6} shards {:>10} entries {:>8} promoted | sets {:>12} bytes | "
+                 "bitmaps {:>12} bytes | -{:.1f}%",
+                 label,
+                 shards,
+                 s.entries,
+                 s.promoted,
+                 s.bytes,
+                 s.bitmap_bytes,
+                 saved);
+}
+
+void add(index::MergedIndex::ContextStats& total, const index::MergedIndex::ContextStats& s) {
+    total.entries += s.entries;
+    total.promoted += s.promoted;
+    total.bytes += s.bytes;
+    total.bitmap_bytes += s.bitmap_bytes;
+}
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false)) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss, "context_set_benchmark [OPTIONS]");
+        std::print("{}", oss.str());
+        return 0;
+    }
+
+    if(opts.index_dir.has_value()) {
+        auto shards_dir = path::join(*opts.index_dir, "shards");
+        index::MergedIndex::ContextStats total;
+        std::size_t shards = 0;
+        std::error_code ec;
+        for(auto it = llvm::sys::fs::directory_iterator(shards_dir, ec);
+            !ec && it != llvm::sys::fs::directory_iterator();
+            it.increment(ec)) {
+            if(!llvm::StringRef(it->path()).ends_with(".idx"))
+                continue;
+            auto shard = index::MergedIndex::load(it->path());
+            add(total, shard.context_stats());
+            shards += 1;
+        }
+
+        if(shards == 0) {
+            std::println(stderr, "Error: no shards in {}", shards_dir);
+            return 1;
+        }
+        report("project", shards, total);
+        return 0;
+    }
+
+    // Most headers are indexed in one context, a few common ones in many.
+    for(std::uint32_t contexts: {1u, 2u, 4u, 16u}) {
+        index::MergedIndex::ContextStats total;
+        for(int shard = 0; shard < 16; shard++) {
+            index::MergedIndex merged;
+            for(std::uint32_t variant = 0; variant < contexts; variant++) {
+                auto file_index = make_file_index(4096, variant);
+                merged.merge(variant, 0, file_index, {});
+            }
+            add(total, merged.context_stats());
+        }
+        report(std::format("{} context(s)", contexts), 16, total);
+    }
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+/// Benchmark for FileIndex::hash (xxh3-128) against the SHA-256 it replaced.
+///
+/// Usage:
+///   index_hash_benchmark [OPTIONS]
+///
+/// Without options, synthetic file indices of typical sizes are hashed. With
+/// --index-dir, the file indices of the TUIndex records in the index journal
+/// of a real project are hashed instead.
+///
+/// Example:
+///   ./build/RelWithDebInfo/bin/index_hash_benchmark \
+///       --index-dir /home/ykiko/C++/clice/.clice/index
+
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "index/tu_index.h"
+#include "server/workspace/index_journal.h"
+
+#include "kota/deco/deco.h"
+
+using namespace clice;
+
+struct BenchmarkOptions {
+    DecoKV(names = {"--index-dir"}; help = "Hash the file indices in this index journal";
+           required = false;)
+    <std::string> index_dir;
+
+    DecoKV(names = {"--runs"}; help = "Number of times every file index is hashed";
+           required = false;)
+    <int> runs = 20;
+
+    DecoFlag(names = {"-h", "--help"}; help = "Show help message"; required = false;)
+    help;
+};
+
+/// A file index with `count` occurrences and a quarter as many symbols with
+/// four relations each, roughly the shape of a real header.
+index::FileIndex make_file_index(std::uint32_t count) {
+    index::FileIndex file_index;
+    for(std::uint32_t i = 0; i < count; i++) {
+        auto symbol = static_cast<index::SymbolHash>(i / 4) * 0x9E3779B97F4A7C15ULL;
+        file_index.occurrences.push_back({
+            .range = {i * 16, i * 16 + 8},
+            .target = symbol,
+        });
+        file_index.relations[symbol].push_back({
+            .kind = RelationKind::Reference,
+            .range = {i * 16, i * 16 + 8},
+            .target_symbol = symbol + 1,
+        });
+    }
+    return file_index;
+}
+
+template <typename Fn>
+double measure_ms(int runs, std::vector<index::FileIndex>& indices, Fn&& fn) {
+    std::uint64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int run = 0; run < runs; run++) {
+        for(auto& file_index: indices) {
+            sink += fn(file_index)[0];
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    // Keep the hashes observable so the loop is not optimized away.
+    if(sink == 0x5EED) {
+        std::println("");
+    }
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void run(llvm::StringRef label, std::vector<index::FileIndex>& indices, int runs) {
+    std::size_t bytes = 0;
+    for(auto& file_index: indices) {
+        bytes += file_index.occurrences.size() * sizeof(index::Occurrence);
+        for(auto& [_, relations]: file_index.relations) {
+            bytes += sizeof(index::SymbolHash) + relations.size() * sizeof(index::Relation);
+        }
+    }
+
+    auto xxh3 = measure_ms(runs, indices, [](index::FileIndex& i) { return i.hash(); });
+    auto sha256 = measure_ms(runs, indices, [](index::FileIndex& i) { return i.legacy_hash(); });
+    auto mb = static_cast<double>(bytes) * runs / (1024.0 * 1024.0);
+
+    std::println("  {:<28} {:>6} indices {:>10} bytes | xxh3 {:>9.2f}ms ({:>8.1f} MB/s) | "
+                 "sha256 {:>9.2f}ms ({:>8.1f} MB/s) | x{:.1f}",
+                 label,
+                 indices.size(),
+                 bytes,
+                 xxh3,
+                 mb / (xxh3 / 1000.0),
+                 sha256,
+                 mb / (sha256 / 1000.0),
+                 sha256 / xxh3);
+}
+
+int main(int argc, const char** argv) {
+    auto args = kota::deco::util::argvify(argc, argv);
+    auto result = kota::deco::cli::parse<BenchmarkOptions>(args);
+
+    if(!result.has_value()) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return 1;
+    }
+
+    auto& opts = result->options;
+
+    if(opts.help.value_or(false)) {
+        std::ostringstream oss;
+        kota::deco::cli::write_usage_for<BenchmarkOptions>(oss, "index_hash_benchmark [OPTIONS]");
+        std::print("{}", oss.str());
+        return 0;
+    }
+
+    auto runs = *opts.runs;
+    if(runs <= 0) {
+        std::println(stderr, "Error: --runs must be positive (got {})", runs);
+        return 1;
+    }
+
+    std::println("Hashing every file index {} time(s)\n", runs);
+
+    if(opts.index_dir.has_value()) {
+        std::vector<index::FileIndex> indices;
+        IndexJournal journal;
+        journal.open(*opts.index_dir);
+        journal.replay([&](const void* data, std::size_t) {
+            auto tu_index = index::TUIndex::from(data);
+            for(auto& [_, file_index]: tu_index.path_file_indices) {
+                indices.push_back(std::move(file_index));
+            }
+            indices.push_back(std::move(tu_index.main_file_index));
+        });
+
+        if(indices.empty()) {
+            std::println(stderr, "Error: no journal records in {}", *opts.index_dir);
+            return 1;
+        }
+        run("journal", indices, runs);
+        return 0;
+    }
+
+    for(std::uint32_t count: {64u, 1024u, 16384u, 131072u}) {
+        std::vector<index::FileIndex> indices;
+        for(int i = 0; i < 16; i++) {
+            indices.push_back(make_file_index(count));
+        }
+        run(std::format("{} occurrences", count), indices, runs);
+    }
+
+    return 0;
+}
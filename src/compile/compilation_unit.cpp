@@ -2,6 +2,9 @@
 #include "index/usr.h"
 #include "semantic/ast_utility.h"
 
+#include "clang/Lex/HeaderSearch.h"
+#include "clang/Lex/PreprocessingRecord.h"
+
 namespace clice {
 
 CompilationKind CompilationUnitRef::kind() {
@@ -233,6 +236,42 @@ std::chrono::milliseconds CompilationUnitRef::build_duration() {
     return self->build_duration;
 }
 
+std::size_t CompilationUnitRef::memory_usage() {
+    if(!self || !self->instance)
+        return 0;
+
+    auto& instance = *self->instance;
+    std::size_t total = self->path_storage.getTotalMemory();
+    for(auto& entry: self->remapped_buffers) {
+        total += entry.second->getBufferSize();
+    }
+
+    if(instance.hasASTContext()) {
+        auto& context = instance.getASTContext();
+        total += context.getASTAllocatedMemory() + context.getSideTableAllocatedMemory();
+    }
+
+    if(instance.hasSourceManager()) {
+        auto& sm = instance.getSourceManager();
+        total += sm.getContentCacheSize() + sm.getDataStructureSizes();
+        // Mapped files are backed by the page cache, only count heap buffers.
+        total += sm.getMemoryBufferSizes().malloc_bytes;
+    }
+
+    if(instance.hasPreprocessor()) {
+        auto& pp = instance.getPreprocessor();
+        total += pp.getTotalMemory() + pp.getHeaderSearchInfo().getTotalMemory();
+        if(auto* record = pp.getPreprocessingRecord()) {
+            total += record->getTotalMemory();
+        }
+    }
+
+    if(self->buffer) {
+        total += self->buffer->expandedTokens().size() * sizeof(clang::syntax::Token);
+    }
+    return total;
+}
+
 clang::LangOptions& CompilationUnitRef::lang_options() {
     return self->instance->getLangOpts();
 }
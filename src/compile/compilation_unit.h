@@ -217,6 +217,10 @@ public:
 
     std::chrono::milliseconds build_duration();
 
+    /// Approximate bytes held by the unit: the AST, the source manager and its
+    /// buffers, the preprocessor and the token buffer.
+    std::size_t memory_usage();
+
     clang::LangOptions& lang_options();
 
     clang::ASTContext& context();
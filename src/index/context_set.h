@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+#include "support/bitmap.h"
+
+#include "llvm/ADT/ArrayRef.h"
+
+namespace clice::index {
+
+/// The set of canonical contexts an occurrence or relation appears in.
+///
+/// Almost every file is indexed in exactly one context, so a few ids are kept
+/// inline and a Roaring bitmap is only allocated once the set outgrows them.
+/// A set is promoted to a bitmap exactly when it holds more than
+/// `inline_capacity` ids, so two equal sets always have the same form.
+class ContextSet {
+public:
+    constexpr static std::uint32_t inline_capacity = 3;
+
+    ContextSet() = default;
+
+    ContextSet(const ContextSet& other) : count(other.count) {
+        std::ranges::copy(other.ids, ids);
+        if(other.bitmap) {
+            bitmap = std::make_unique<Bitmap>(*other.bitmap);
+        }
+    }
+
+    ContextSet(ContextSet&& other) = default;
+
+    ContextSet& operator=(const ContextSet& other) {
+        if(this != &other) {
+            *this = ContextSet(other);
+        }
+        return *this;
+    }
+
+    ContextSet& operator=(ContextSet&& other) = default;
+
+    /// Build a set from ids sorted in ascending order without duplicates.
+    static ContextSet from(llvm::ArrayRef<std::uint32_t> sorted) {
+        ContextSet set;
+        if(sorted.size() <= inline_capacity) {
+            set.count = sorted.size();
+            std::ranges::copy(sorted, set.ids);
+        } else {
+            set.bitmap = std::make_unique<Bitmap>(sorted.size(), sorted.data());
+        }
+        return set;
+    }
+
+    static ContextSet from(const Bitmap& bitmap) {
+        if(bitmap.cardinality() > inline_capacity) {
+            ContextSet set;
+            set.bitmap = std::make_unique<Bitmap>(bitmap);
+            return set;
+        }
+
+        ContextSet set;
+        for(auto id: bitmap) {
+            set.ids[set.count++] = id;
+        }
+        return set;
+    }
+
+    void add(std::uint32_t id) {
+        if(bitmap) {
+            bitmap->add(id);
+            return;
+        }
+
+        auto end = ids + count;
+        auto it = std::lower_bound(ids, end, id);
+        if(it != end && *it == id) {
+            return;
+        }
+
+        if(count < inline_capacity) {
+            std::copy_backward(it, end, end + 1);
+            *it = id;
+            count += 1;
+            return;
+        }
+
+        bitmap = std::make_unique<Bitmap>(count, ids);
+        bitmap->add(id);
+        count = 0;
+    }
+
+    bool contains(std::uint32_t id) const {
+        if(bitmap) {
+            return bitmap->contains(id);
+        }
+        return std::find(ids, ids + count, id) != ids + count;
+    }
+
+    bool empty() const {
+        return bitmap ? bitmap->isEmpty() : count == 0;
+    }
+
+    std::uint64_t size() const {
+        return bitmap ? bitmap->cardinality() : count;
+    }
+
+    /// Whether every id of the set is in `ids`, i.e. all its contexts are removed.
+    bool subset_of(const Bitmap& other) const {
+        if(bitmap) {
+            return bitmap->isSubset(other);
+        }
+        return std::all_of(ids, ids + count, [&](std::uint32_t id) { return other.contains(id); });
+    }
+
+    /// Call `fn` with every id in ascending order.
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        if(bitmap) {
+            for(auto id: *bitmap) {
+                fn(id);
+            }
+        } else {
+            std::for_each(ids, ids + count, fn);
+        }
+    }
+
+    Bitmap to_bitmap() const {
+        return bitmap ? *bitmap : Bitmap(count, ids);
+    }
+
+    /// Heap bytes held besides the set itself, only promoted sets have any.
+    std::size_t heap_bytes() const {
+        return bitmap ? sizeof(Bitmap) + bitmap->getSizeInBytes(false) : 0;
+    }
+
+    friend bool operator==(const ContextSet& lhs, const ContextSet& rhs) {
+        if(lhs.bitmap || rhs.bitmap) {
+            return lhs.bitmap && rhs.bitmap && *lhs.bitmap == *rhs.bitmap;
+        }
+        return std::equal(lhs.ids, lhs.ids + lhs.count, rhs.ids, rhs.ids + rhs.count);
+    }
+
+private:
+    /// The number of inline ids, zero once promoted.
+    std::uint32_t count = 0;
+
+    std::uint32_t ids[inline_capacity] = {};
+
+    std::unique_ptr<Bitmap> bitmap;
+};
+
+}  // namespace clice::index
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace clice::index {
+
+/// An implicit interval tree over closed intervals [begin, end] sorted by begin,
+/// in the layout of cgranges (https://github.com/lh3/cgranges).
+///
+/// The sorted array itself is a complete binary tree in in-order: the node at
+/// index i is on level k when the lowest k bits of i are set and bit k is clear,
+/// and the root is 2^K - 1 for the largest 2^K <= size. The only extra data is
+/// the max end of each subtree, so a point query visits O(log n) nodes plus the
+/// intervals containing the point, without moving the intervals.
+///
+/// The intervals are read through accessors taking the index in the sorted
+/// array, so the same tree works over in-memory vectors and serialized columns.
+
+/// Compute the max end of the subtree rooted at every node. `end_of(i)` is the
+/// end of the i-th interval.
+template <typename End>
+std::vector<std::uint32_t> build_interval_tree(std::uint32_t size, End&& end_of) {
+    std::vector<std::uint32_t> max_ends(size);
+    if(size == 0) {
+        return max_ends;
+    }
+
+    // `last` is the max end of the last subtree on the current level, it stands
+    // in for right children past the end of the array.
+    std::uint64_t last_i = 0;
+    std::uint32_t last = 0;
+    for(std::uint64_t i = 0; i < size; i += 2) {
+        last_i = i;
+        last = max_ends[i] = end_of(i);
+    }
+
+    for(unsigned k = 1; (std::uint64_t(1) << k) <= size; k++) {
+        std::uint64_t x = std::uint64_t(1) << (k - 1);
+        for(std::uint64_t i = (x << 1) - 1; i < size; i += x << 2) {
+            auto left = max_ends[i - x];
+            auto right = i + x < size ? max_ends[i + x] : last;
+            max_ends[i] = std::max({static_cast<std::uint32_t>(end_of(i)), left, right});
+        }
+        last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+        if(last_i < size && max_ends[last_i] > last) {
+            last = max_ends[last_i];
+        }
+    }
+    return max_ends;
+}
+
+/// Call `callback(i)` with the index of every interval containing `offset`, in
+/// sorted order, until it returns false. Returns false if it was stopped.
+/// `begin_of`, `end_of` and `max_end_of` read the begin, the end and the
+/// subtree max end (from build_interval_tree) of the i-th interval.
+template <typename Begin, typename End, typename MaxEnd, typename Callback>
+bool query_interval_tree(std::uint32_t size,
+                         std::uint32_t offset,
+                         Begin&& begin_of,
+                         End&& end_of,
+                         MaxEnd&& max_end_of,
+                         Callback&& callback) {
+    if(size == 0) {
+        return true;
+    }
+
+    struct Frame {
+        std::uint64_t node;
+        unsigned level;
+        bool left_done;
+    };
+
+    // Levels never exceed 32, and every level pushes at most two frames.
+    Frame stack[64];
+    unsigned top = 0;
+    unsigned root_level = std::bit_width(size) - 1;
+    stack[top++] = {(std::uint64_t(1) << root_level) - 1, root_level, false};
+
+    while(top > 0) {
+        auto frame = stack[--top];
+        if(frame.level <= 3) {
+            // Small subtrees are cheaper to scan linearly.
+            auto first = frame.node >> frame.level << frame.level;
+            auto last = std::min<std::uint64_t>(first + (std::uint64_t(2) << frame.level) - 1,
+                                                size);
+            for(auto i = first; i < last && begin_of(i) <= offset; i++) {
+                if(end_of(i) >= offset && !callback(static_cast<std::uint32_t>(i))) {
+                    return false;
+                }
+            }
+        } else if(!frame.left_done) {
+            // Revisit this node after its left subtree. The left child may lie
+            // past the end of the array while some of its descendants do not.
+            auto left = frame.node - (std::uint64_t(1) << (frame.level - 1));
+            stack[top++] = {frame.node, frame.level, true};
+            if(left >= size || max_end_of(left) >= offset) {
+                stack[top++] = {left, frame.level - 1, false};
+            }
+        } else if(frame.node < size && begin_of(frame.node) <= offset) {
+            if(end_of(frame.node) >= offset &&
+               !callback(static_cast<std::uint32_t>(frame.node))) {
+                return false;
+            }
+            stack[top++] = {frame.node + (std::uint64_t(1) << (frame.level - 1)),
+                            frame.level - 1,
+                            false};
+        }
+    }
+    return true;
+}
+
+}  // namespace clice::index
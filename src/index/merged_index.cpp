@@ -1,12 +1,17 @@
 #include "index/merged_index.h"
 
+#include <algorithm>
+#include <optional>
 #include <ranges>
 #include <tuple>
 
+#include "index/context_set.h"
+#include "index/interval_tree.h"
 #include "index/serialization.h"
 #include "support/filesystem.h"
 
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/raw_os_ostream.h"
 
 namespace llvm {
@@ -104,8 +109,172 @@ struct CompilationContext {
     friend bool operator==(const CompilationContext&, const CompilationContext&) = default;
 };
 
+namespace {
+
+/// Occurrences per block of the columnar encoding. Small enough that a point
+/// lookup decodes little, large enough that the skip index stays tiny.
+constexpr std::uint32_t occurrence_block_size = 64;
+
+/// Size of the SHA-256 canonical_cache keys of indices written before xxh3.
+constexpr std::size_t legacy_key_size = 32;
+
+/// Decode the occurrences of one block, calling `callback` with every
+/// occurrence and its context index until it returns false.
+bool decode_block(const binary::MergedIndex* root,
+                  std::uint32_t block,
+                  llvm::function_ref<bool(const Occurrence&, std::uint32_t)> callback) {
+    auto columns = root->occurrence_columns();
+    auto symbols = root->symbols();
+    auto block_size = columns->block_size();
+    auto count = std::min(block_size, columns->count() - block * block_size);
+
+    auto data = columns->data()->data() + columns->block_offsets()->Get(block);
+    std::uint32_t begin = columns->block_begins()->Get(block);
+    for(std::uint32_t i = 0; i < count; i++) {
+        begin += static_cast<std::uint32_t>(read_varint(data));
+        std::uint32_t end = begin + static_cast<std::uint32_t>(read_varint(data));
+        auto target = symbols->Get(read_varint(data));
+        auto context = static_cast<std::uint32_t>(read_varint(data));
+        if(!callback(Occurrence{{begin, end}, target}, context)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Decode the rest of a relation after its kind, advancing `data` past it and
+/// `begin` to its begin offset. Returns the context index of the relation.
+std::uint32_t read_relation(const binary::MergedIndex* root,
+                            const std::uint8_t*& data,
+                            std::uint32_t& begin,
+                            Relation& relation) {
+    begin += static_cast<std::uint32_t>(read_varint(data));
+    relation.range = {begin, begin + static_cast<std::uint32_t>(read_varint(data))};
+
+    relation.target_symbol = 0;
+    auto tag = read_varint(data);
+    if(tag == 1) {
+        relation.target_symbol = read_varint(data);
+    } else if(tag > 1) {
+        relation.target_symbol = root->symbols()->Get(tag - 2);
+    }
+    return static_cast<std::uint32_t>(read_varint(data));
+}
+
+/// Decode the relations of the symbol at `symbol` in the dictionary, calling
+/// `callback` with every relation and its context index until it returns false.
+/// Only the relations of `kind` are decoded, or all of them if it is Invalid.
+void decode_relations(const binary::MergedIndex* root,
+                      std::uint32_t symbol,
+                      RelationKind kind,
+                      llvm::function_ref<bool(const Relation&, std::uint32_t)> callback) {
+    auto columns = root->relation_columns();
+    auto offsets = columns->offsets();
+
+    auto data = columns->data()->data() + offsets->Get(symbol);
+    auto end = columns->data()->data() + offsets->Get(symbol + 1);
+    Relation relation{};
+
+    if(!columns->partitioned()) {
+        std::uint32_t begin = 0;
+        while(data < end) {
+            relation.kind = static_cast<RelationKind::Kind>(read_varint(data));
+            auto context = read_relation(root, data, begin, relation);
+            if(kind.value() != RelationKind::Invalid && !(relation.kind & kind)) {
+                continue;
+            }
+            if(!callback(relation, context)) {
+                return;
+            }
+        }
+        return;
+    }
+
+    llvm::SmallVector<std::pair<RelationKind::Kind, std::uint64_t>, 4> directory;
+    auto partitions = read_varint(data);
+    for(std::uint64_t i = 0; i < partitions; i++) {
+        auto partition_kind = static_cast<RelationKind::Kind>(read_varint(data));
+        directory.emplace_back(partition_kind, read_varint(data));
+    }
+
+    for(auto [partition_kind, size]: directory) {
+        auto partition_end = data + size;
+        if(kind.value() == RelationKind::Invalid || partition_kind == kind.value()) {
+            relation.kind = partition_kind;
+            std::uint32_t begin = 0;
+            while(data < partition_end) {
+                auto context = read_relation(root, data, begin, relation);
+                if(!callback(relation, context)) {
+                    return;
+                }
+            }
+        }
+        data = partition_end;
+    }
+}
+
+/// Whether every canonical context of the context reference from the columns
+/// is removed.
+bool all_removed(const binary::MergedIndex* root,
+                 const roaring::Roaring& removed,
+                 std::uint32_t context) {
+    if(removed.isEmpty()) {
+        return false;
+    }
+    if(root->inline_contexts()) {
+        if(!(context & 1)) {
+            return removed.contains(context >> 1);
+        }
+        context >>= 1;
+    }
+    auto bitmap = read_bitmap(root->contexts()->Get(context)->data());
+    return bitmap.isSubset(removed);
+}
+
+using RelationContexts = llvm::DenseMap<Relation, ContextSet>;
+
+/// Most symbols have a few kinds of relations, e.g. a declaration, a
+/// definition and references.
+constexpr unsigned relations_inline_kinds = 4;
+
+/// The relations of one symbol, partitioned by kind, so that a lookup of one
+/// kind never walks the relations of the others.
+struct SymbolRelations {
+    /// One partition per kind present, sorted by kind.
+    llvm::SmallVector<std::pair<std::uint32_t, RelationContexts>, relations_inline_kinds>
+        partitions;
+
+    const RelationContexts* find(RelationKind kind) const {
+        auto it = std::ranges::lower_bound(partitions, kind.value(), {}, [](const auto& p) {
+            return p.first;
+        });
+        if(it == partitions.end() || it->first != kind.value()) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    RelationContexts& operator[](RelationKind kind) {
+        auto it = std::ranges::lower_bound(partitions, kind.value(), {}, [](const auto& p) {
+            return p.first;
+        });
+        if(it == partitions.end() || it->first != kind.value()) {
+            it = partitions.insert(it, std::pair(kind.value(), RelationContexts()));
+        }
+        return it->second;
+    }
+
+    friend bool operator==(const SymbolRelations&, const SymbolRelations&) = default;
+};
+
+}  // namespace
+
 struct MergedIndex::Impl {
-    /// The content of corresponding source file.
+    /// The hash of the corresponding source file in the content store.
+    ContentHash content_hash{};
+
+    /// The content of the source file, only kept by indices written before
+    /// the content store.
     std::string content;
 
     /// If this file is included by other source file, then it has header contexts.
@@ -118,10 +287,16 @@ struct MergedIndex::Impl {
     /// could provide header contexts for other files.
     llvm::SmallDenseMap<std::uint32_t, CompilationContext, 1> compilation_contexts;
 
-    /// We use the value of SHA256 to judge whether two indices are same.
+    /// We use the value of FileIndex::hash to judge whether two indices are same.
     /// The same indices will be given same canonical id.
     llvm::StringMap<std::uint32_t> canonical_cache;
 
+    /// The number of canonical_cache keys which are still SHA-256 values from
+    /// an index written before the switch to xxh3. They are rekeyed when the
+    /// same index is merged again, and the rest are dropped when the index is
+    /// serialized, so legacy_hash() is only paid while they may still match.
+    std::uint32_t legacy_keys = 0;
+
     /// The max canonical id we have allocated.
     std::uint32_t max_canonical_id = 0;
 
@@ -132,25 +307,45 @@ struct MergedIndex::Impl {
     roaring::Roaring removed;
 
     /// All merged symbol occurrences.
-    llvm::DenseMap<Occurrence, roaring::Roaring> occurrences;
+    llvm::DenseMap<Occurrence, ContextSet> occurrences;
 
     /// All merged symbol relations.
-    llvm::DenseMap<SymbolHash, llvm::DenseMap<Relation, roaring::Roaring>> relations;
+    llvm::DenseMap<SymbolHash, SymbolRelations> relations;
 
-    /// Sorted occurrences cache for fast lookup.
+    /// Occurrences sorted by begin for point lookups, with the subtree max
+    /// ends of them as an interval tree. Rebuilt on the first lookup after a
+    /// change.
     std::vector<Occurrence> occurrences_cache;
+    std::vector<std::uint32_t> occurrence_max_ends;
 
     void merge(this Impl& self, std::uint32_t path_id, FileIndex& index, auto&& add_context) {
         auto hash = index.hash();
         auto hash_key = llvm::StringRef(reinterpret_cast<char*>(hash.data()), hash.size());
         auto [it, success] = self.canonical_cache.try_emplace(hash_key, self.max_canonical_id);
 
+        if(success && self.legacy_keys > 0) {
+            auto legacy = index.legacy_hash();
+            auto legacy_key =
+                llvm::StringRef(reinterpret_cast<char*>(legacy.data()), legacy.size());
+            auto legacy_it = self.canonical_cache.find(legacy_key);
+            if(legacy_it != self.canonical_cache.end()) {
+                it->second = legacy_it->second;
+                self.canonical_cache.erase(legacy_it);
+                self.legacy_keys -= 1;
+                success = false;
+            }
+        }
+
         auto canonical_id = it->second;
-        add_context(self, canonical_id);
+        bool referenced = add_context(self, canonical_id);
 
         if(!success) {
-            self.canonical_ref_counts[canonical_id] += 1;
-            self.removed.remove(canonical_id);
+            // Merging the same context twice (e.g. replaying the index journal)
+            // must not take another reference.
+            if(referenced) {
+                self.canonical_ref_counts[canonical_id] += 1;
+                self.removed.remove(canonical_id);
+            }
             return;
         }
 
@@ -161,7 +356,7 @@ struct MergedIndex::Impl {
         for(auto& [symbol_id, relations]: index.relations) {
             auto& target = self.relations[symbol_id];
             for(auto& relation: relations) {
-                target[relation].add(canonical_id);
+                target[relation.kind][relation].add(canonical_id);
             }
         }
 
@@ -169,6 +364,113 @@ struct MergedIndex::Impl {
         self.max_canonical_id += 1;
     }
 
+    /// Drop a reference to the canonical id, it is removed with the last one.
+    void release(this Impl& self, std::uint32_t canonical_id) {
+        auto& ref_counts = self.canonical_ref_counts[canonical_id];
+        ref_counts -= 1;
+        if(ref_counts == 0) {
+            self.removed.add(canonical_id);
+        }
+    }
+
+    /// Drop the entries only removed contexts refer to and renumber the live
+    /// canonical ids densely.
+    void compact(this Impl& self) {
+        if(self.removed.isEmpty()) {
+            return;
+        }
+
+        // Live ids keep their relative order, so contexts compare the same.
+        std::vector<std::uint32_t> remap(self.max_canonical_id, 0);
+        std::uint32_t live = 0;
+        for(std::uint32_t id = 0; id < self.max_canonical_id; id++) {
+            if(!self.removed.contains(id)) {
+                remap[id] = live;
+                self.canonical_ref_counts[live] = self.canonical_ref_counts[id];
+                live += 1;
+            }
+        }
+        self.canonical_ref_counts.resize(live);
+        self.canonical_ref_counts.shrink_to_fit();
+        self.max_canonical_id = live;
+
+        // Returns false if no live context is left.
+        std::vector<std::uint32_t> ids;
+        auto rewrite = [&](ContextSet& contexts) {
+            ids.clear();
+            contexts.for_each([&](std::uint32_t id) {
+                if(!self.removed.contains(id)) {
+                    ids.emplace_back(remap[id]);
+                }
+            });
+            contexts = ContextSet::from(ids);
+            return !ids.empty();
+        };
+
+        // Rebuilt rather than erased from, and sized for the surviving entries,
+        // so the tables shrink as well.
+        auto compact_map = [&](auto& map) {
+            std::size_t survivors = 0;
+            for(auto& [_, contexts]: map) {
+                survivors += rewrite(contexts);
+            }
+            std::remove_reference_t<decltype(map)> compacted(survivors);
+            for(auto& [key, contexts]: map) {
+                if(!contexts.empty()) {
+                    compacted.try_emplace(key, std::move(contexts));
+                }
+            }
+            map = std::move(compacted);
+        };
+
+        compact_map(self.occurrences);
+
+        std::size_t live_symbols = 0;
+        for(auto& [_, symbol_relations]: self.relations) {
+            auto& partitions = symbol_relations.partitions;
+            for(auto& [_, partition]: partitions) {
+                compact_map(partition);
+            }
+            llvm::erase_if(partitions, [](const auto& p) { return p.second.empty(); });
+            live_symbols += !partitions.empty();
+        }
+        decltype(self.relations) relations(live_symbols);
+        for(auto& [symbol, symbol_relations]: self.relations) {
+            if(!symbol_relations.partitions.empty()) {
+                relations.try_emplace(symbol, std::move(symbol_relations));
+            }
+        }
+        self.relations = std::move(relations);
+
+        // A removed index merged again is a new canonical context now.
+        for(auto it = self.canonical_cache.begin(); it != self.canonical_cache.end();) {
+            auto current = it++;
+            if(self.removed.contains(current->second)) {
+                if(current->first().size() == legacy_key_size) {
+                    self.legacy_keys -= 1;
+                }
+                self.canonical_cache.erase(current);
+            } else {
+                current->second = remap[current->second];
+            }
+        }
+
+        for(auto& [_, context]: self.header_contexts) {
+            llvm::erase_if(context.includes, [&](const IncludeContext& include) {
+                return self.removed.contains(include.canonical_id);
+            });
+            for(auto& include: context.includes) {
+                include.canonical_id = remap[include.canonical_id];
+            }
+        }
+        for(auto& [_, context]: self.compilation_contexts) {
+            context.canonical_id = remap[context.canonical_id];
+        }
+
+        self.removed = roaring::Roaring();
+        self.occurrences_cache.clear();
+    }
+
     friend bool operator==(const Impl&, const Impl&) = default;
 };
 
@@ -186,23 +488,43 @@ MergedIndex& MergedIndex::operator=(MergedIndex&& other) = default;
 
 MergedIndex::~MergedIndex() = default;
 
+const llvm::MemoryBuffer* MergedIndex::mapped(this const Self& self) {
+    if(!self.buffer && !self.path.empty()) {
+        // Without a null terminator requirement, large shards are mmap'd and
+        // only the pages touched by lookups are ever read from disk.
+        auto buffer = llvm::MemoryBuffer::getFile(self.path,
+                                                  /*IsText=*/false,
+                                                  /*RequiresNullTerminator=*/false);
+        if(buffer) {
+            self.buffer = std::move(*buffer);
+        }
+        self.path.clear();
+    }
+    return self.buffer.get();
+}
+
 void MergedIndex::load_in_memory(this Self& self) {
     if(self.impl) {
         return;
     }
 
+    auto buffer = self.mapped();
     self.impl = std::make_unique<MergedIndex::Impl>();
-    if(!self.buffer) {
+    if(!buffer) {
         return;
     }
 
     auto& index = *self.impl;
-    auto root = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+    auto root = fbs::GetRoot<binary::MergedIndex>(buffer->getBufferStart());
 
     index.max_canonical_id = root->max_canonical_id();
 
     for(auto entry: *root->canonical_cache()) {
-        index.canonical_cache.try_emplace(entry->sha256()->string_view(), entry->canonical_id());
+        auto key = entry->hash()->string_view();
+        if(key.size() == legacy_key_size) {
+            index.legacy_keys += 1;
+        }
+        index.canonical_cache.try_emplace(key, entry->canonical_id());
     }
 
     index.canonical_ref_counts.resize(index.max_canonical_id, 0);
@@ -240,16 +562,64 @@ void MergedIndex::load_in_memory(this Self& self) {
         index.removed = read_bitmap(root->removed());
     }
 
-    for(auto entry: *root->occurrences()) {
-        index.occurrences.try_emplace(*safe_cast<Occurrence>(entry->occurrence()),
-                                      read_bitmap(entry->context()));
-    }
+    if(auto columns = root->occurrence_columns()) {
+        std::vector<ContextSet> contexts;
+        contexts.reserve(root->contexts()->size());
+        for(auto context: *root->contexts()) {
+            contexts.emplace_back(ContextSet::from(read_bitmap(context->data())));
+        }
 
-    for(auto entry: *root->relations()) {
-        auto& relations = index.relations[entry->symbol()];
-        for(auto relation_entry: *entry->relations()) {
-            relations.try_emplace(*safe_cast<Relation>(relation_entry->relation()),
-                                  read_bitmap(relation_entry->context()));
+        bool tagged = root->inline_contexts();
+        auto context_of = [&](std::uint32_t context) {
+            if(!tagged) {
+                return contexts[context];
+            }
+            if(context & 1) {
+                return contexts[context >> 1];
+            }
+            std::uint32_t id = context >> 1;
+            return ContextSet::from(llvm::ArrayRef(id));
+        };
+
+        index.occurrences.reserve(columns->count());
+        for(std::uint32_t block = 0; block < columns->block_offsets()->size(); block++) {
+            decode_block(root, block, [&](const Occurrence& occurrence, std::uint32_t context) {
+                index.occurrences.try_emplace(occurrence, context_of(context));
+                return true;
+            });
+        }
+
+        auto symbols = root->symbols();
+        for(std::uint32_t symbol = 0; symbol < symbols->size(); symbol++) {
+            auto offsets = root->relation_columns()->offsets();
+            if(offsets->Get(symbol) == offsets->Get(symbol + 1)) {
+                continue;
+            }
+
+            auto& relations = index.relations[symbols->Get(symbol)];
+            decode_relations(root,
+                             symbol,
+                             RelationKind::Invalid,
+                             [&](const Relation& relation, std::uint32_t context) {
+                                 relations[relation.kind].try_emplace(relation,
+                                                                      context_of(context));
+                                 return true;
+                             });
+        }
+    } else {
+        for(auto entry: *root->occurrences()) {
+            index.occurrences.try_emplace(*safe_cast<Occurrence>(entry->occurrence()),
+                                          ContextSet::from(read_bitmap(entry->context())));
+        }
+
+        for(auto entry: *root->relations()) {
+            auto& relations = index.relations[entry->symbol()];
+            for(auto relation_entry: *entry->relations()) {
+                auto& relation = *safe_cast<Relation>(relation_entry->relation());
+                relations[relation.kind].try_emplace(
+                    relation,
+                    ContextSet::from(read_bitmap(relation_entry->context())));
+            }
         }
     }
 
@@ -257,21 +627,26 @@ void MergedIndex::load_in_memory(this Self& self) {
         index.content = root->content()->str();
     }
 
+    if(auto hash = root->content_hash(); hash && hash->size() == index.content_hash.size()) {
+        std::ranges::copy(*hash, index.content_hash.begin());
+    }
+
     self.buffer.reset();
 }
 
 MergedIndex MergedIndex::load(llvm::StringRef path) {
-    auto buffer = llvm::MemoryBuffer::getFile(path);
-    if(!buffer) {
-        return MergedIndex();
-    } else {
-        return MergedIndex(std::move(*buffer), nullptr);
-    }
+    MergedIndex index;
+    index.path = path.str();
+    return index;
+}
+
+MergedIndex MergedIndex::from_buffer(std::unique_ptr<llvm::MemoryBuffer> buffer) {
+    return MergedIndex(std::move(buffer), nullptr);
 }
 
 void MergedIndex::serialize(this const Self& self, llvm::raw_ostream& out) {
-    if(self.buffer) {
-        out.write(self.buffer->getBufferStart(), self.buffer->getBufferSize());
+    if(auto buffer = self.mapped()) {
+        out.write(buffer->getBufferStart(), buffer->getBufferSize());
         return;
     }
 
@@ -285,10 +660,17 @@ void MergedIndex::serialize(this const Self& self, llvm::raw_ostream& out) {
 
     llvm::SmallVector<char, 1024> buffer;
 
-    auto canonical_cache = transform(index->canonical_cache, [&](auto&& value) {
-        auto&& [hash, canonical_id] = value;
-        return binary::CreateCacheEntry(builder, CreateString(builder, hash), canonical_id);
-    });
+    // SHA-256 keys are only rekeyed by the writer that loaded them, they are
+    // not written back.  An identical index merged later gets a new canonical
+    // id instead, and the old one goes away with its context.
+    Offsets<binary::CacheEntry> canonical_cache;
+    for(auto& entry: index->canonical_cache) {
+        if(entry.first().size() == legacy_key_size)
+            continue;
+        canonical_cache.push_back(binary::CreateCacheEntry(builder,
+                                                           CreateString(builder, entry.first()),
+                                                           entry.second));
+    }
 
     auto header_contexts = transform(index->header_contexts, [&](auto&& value) {
         auto& [path_id, context] = value;
@@ -310,47 +692,156 @@ void MergedIndex::serialize(this const Self& self, llvm::raw_ostream& out) {
             CreateStructVector<binary::IncludeLocation>(builder, context.include_locations));
     });
 
-    llvm::SmallVector<const Occurrence*> occurrence_keys;
-    occurrence_keys.reserve(index->occurrences.size());
-    auto occurrences = transform(index->occurrences, [&](auto&& value) {
-        auto&& [occurrence, bitmap] = value;
+    // Every occurrence target and relation owner is stored once in a sorted
+    // dictionary, the columns refer to it by index.
+    std::vector<SymbolHash> symbols;
+    symbols.reserve(index->occurrences.size() + index->relations.size());
+    for(auto& [occurrence, _]: index->occurrences) {
+        symbols.emplace_back(occurrence.target);
+    }
+    for(auto& [symbol_id, _]: index->relations) {
+        symbols.emplace_back(symbol_id);
+    }
+    std::ranges::sort(symbols);
+    symbols.erase(std::ranges::unique(symbols).begin(), symbols.end());
+
+    auto symbol_index = [&](SymbolHash symbol) -> std::optional<std::uint32_t> {
+        auto it = std::ranges::lower_bound(symbols, symbol);
+        if(it == symbols.end() || *it != symbol) {
+            return std::nullopt;
+        }
+        return static_cast<std::uint32_t>(it - symbols.begin());
+    };
+
+    // An entry in a single context refers to it inline. Entries from the same
+    // set of several contexts (e.g. a header which is included from a few
+    // files) share one serialized bitmap.
+    llvm::StringMap<std::uint32_t> context_ids;
+    Offsets<binary::ContextBitmap> contexts;
+    auto context_index = [&](const ContextSet& set) -> std::uint32_t {
+        if(set.size() == 1) {
+            std::uint32_t id = 0;
+            set.for_each([&](std::uint32_t only) { id = only; });
+            return id << 1;
+        }
+
+        auto bitmap = set.to_bitmap();
         buffer.clear();
         buffer.resize_for_overwrite(bitmap.getSizeInBytes(false));
         bitmap.write(buffer.data(), false);
-        occurrence_keys.emplace_back(&occurrence);
-        return binary::CreateOccurrenceEntry(builder,
-                                             safe_cast<binary::Occurrence>(&occurrence),
-                                             CreateVector(builder, buffer));
-    });
-    std::ranges::sort(std::views::zip(occurrence_keys, occurrences), [](auto lhs, auto rhs) {
-        const auto& lo = *std::get<0>(lhs);
-        const auto& ro = *std::get<0>(rhs);
-        return std::tuple(lo.range.begin, lo.range.end, lo.target) <
-               std::tuple(ro.range.begin, ro.range.end, ro.target);
-    });
+        auto [it, inserted] =
+            context_ids.try_emplace(llvm::StringRef(buffer.data(), buffer.size()),
+                                    contexts.size());
+        if(inserted) {
+            contexts.emplace_back(
+                binary::CreateContextBitmap(builder, CreateVector(builder, buffer)));
+        }
+        return it->second << 1 | 1;
+    };
 
-    llvm::SmallVector<std::uint64_t> relation_keys;
-    relation_keys.reserve(index->relations.size());
-    auto relations = transform(index->relations, [&](auto&& value) {
-        auto&& [symbol_id, symbol_relations] = value;
-        auto relations = transform(symbol_relations, [&](auto&& value) {
-            auto&& [relation, bitmap] = value;
-            buffer.clear();
-            buffer.resize_for_overwrite(bitmap.getSizeInBytes(false));
-            bitmap.write(buffer.data(), false);
-            return binary::CreateRelationEntry(builder,
-                                               safe_cast<binary::Relation>(&relation),
-                                               CreateVector(builder, buffer));
-        });
-        relation_keys.emplace_back(symbol_id);
-        return binary::CreateSymbolRelationsEntry(builder,
-                                                  symbol_id,
-                                                  CreateVector(builder, relations));
-    });
-    std::ranges::sort(std::views::zip(relation_keys, relations), {}, [](auto e) {
-        return std::get<0>(e);
+    std::vector<std::pair<Occurrence, std::uint32_t>> occurrences;
+    occurrences.reserve(index->occurrences.size());
+    for(auto& [occurrence, set]: index->occurrences) {
+        occurrences.emplace_back(occurrence, context_index(set));
+    }
+    std::ranges::sort(occurrences, {}, [](const auto& entry) {
+        auto& o = entry.first;
+        return std::tuple(o.range.begin, o.range.end, o.target);
     });
 
+    llvm::SmallVector<std::uint8_t, 0> data;
+    std::vector<std::uint32_t> block_begins;
+    std::vector<std::uint32_t> block_max_ends;
+    std::vector<std::uint32_t> block_offsets;
+    std::uint32_t previous = 0;
+    for(std::size_t i = 0; i < occurrences.size(); i++) {
+        auto& [occurrence, context] = occurrences[i];
+        if(i % occurrence_block_size == 0) {
+            block_begins.emplace_back(occurrence.range.begin);
+            block_max_ends.emplace_back(occurrence.range.end);
+            block_offsets.emplace_back(data.size());
+            previous = occurrence.range.begin;
+        }
+        block_max_ends.back() = std::max(block_max_ends.back(), occurrence.range.end);
+        write_varint(data, occurrence.range.begin - previous);
+        write_varint(data, occurrence.range.end - occurrence.range.begin);
+        write_varint(data, *symbol_index(occurrence.target));
+        write_varint(data, context);
+        previous = occurrence.range.begin;
+    }
+
+    auto block_tree_max_ends = build_interval_tree(
+        block_max_ends.size(),
+        [&](std::uint32_t block) { return block_max_ends[block]; });
+
+    auto occurrence_columns =
+        binary::CreateOccurrenceColumns(builder,
+                                        occurrence_block_size,
+                                        occurrences.size(),
+                                        CreateVector(builder, block_begins),
+                                        CreateVector(builder, block_max_ends),
+                                        CreateVector(builder, block_offsets),
+                                        CreateVector(builder, data),
+                                        CreateVector(builder, block_tree_max_ends));
+
+    data.clear();
+    std::vector<std::uint32_t> relation_offsets;
+    relation_offsets.reserve(symbols.size() + 1);
+    std::vector<std::pair<Relation, std::uint32_t>> relations;
+    llvm::SmallVector<std::uint8_t, 0> partitions;
+    for(auto symbol: symbols) {
+        relation_offsets.emplace_back(data.size());
+        auto it = index->relations.find(symbol);
+        if(it == index->relations.end()) {
+            continue;
+        }
+
+        // The directory goes first, the partitions are appended after it.
+        partitions.clear();
+        write_varint(data, it->second.partitions.size());
+        for(auto& [kind, partition]: it->second.partitions) {
+            relations.clear();
+            for(auto& [relation, set]: partition) {
+                relations.emplace_back(relation, context_index(set));
+            }
+            std::ranges::sort(relations, {}, [](const auto& entry) {
+                auto& r = entry.first;
+                return std::tuple(r.range.begin, r.range.end, r.target_symbol);
+            });
+
+            auto partition_begin = partitions.size();
+            previous = 0;
+            for(auto& [relation, context]: relations) {
+                write_varint(partitions, relation.range.begin - previous);
+                write_varint(partitions, relation.range.end - relation.range.begin);
+
+                // Targets which are not symbols of this shard (e.g. the packed
+                // definition range of a declaration) are stored raw.
+                if(relation.target_symbol == 0) {
+                    write_varint(partitions, 0);
+                } else if(auto target = symbol_index(relation.target_symbol)) {
+                    write_varint(partitions, *target + 2);
+                } else {
+                    write_varint(partitions, 1);
+                    write_varint(partitions, relation.target_symbol);
+                }
+
+                write_varint(partitions, context);
+                previous = relation.range.begin;
+            }
+
+            write_varint(data, kind);
+            write_varint(data, partitions.size() - partition_begin);
+        }
+        data.append(partitions.begin(), partitions.end());
+    }
+    relation_offsets.emplace_back(data.size());
+
+    auto relation_columns = binary::CreateRelationColumns(builder,
+                                                          CreateVector(builder, relation_offsets),
+                                                          CreateVector(builder, data),
+                                                          /*partitioned=*/true);
+
     // Serialize removed bitmap.
     buffer.clear();
     if(!index->removed.isEmpty()) {
@@ -359,17 +850,31 @@ void MergedIndex::serialize(this const Self& self, llvm::raw_ostream& out) {
     }
     auto removed = CreateVector(builder, buffer);
 
-    auto content_offset = CreateString(builder, index->content);
+    fbs::Offset<fbs::String> content_offset;
+    if(!index->content.empty()) {
+        content_offset = CreateString(builder, index->content);
+    }
+
+    fbs::Offset<fbs::Vector<std::uint8_t>> content_hash;
+    if(index->content_hash != ContentHash{}) {
+        content_hash = CreateVector(builder, index->content_hash);
+    }
 
     auto merged_index = binary::CreateMergedIndex(builder,
                                                   index->max_canonical_id,
                                                   CreateVector(builder, canonical_cache),
                                                   CreateVector(builder, header_contexts),
                                                   CreateVector(builder, compilation_contexts),
-                                                  CreateVector(builder, occurrences),
-                                                  CreateVector(builder, relations),
+                                                  0,
+                                                  0,
                                                   removed,
-                                                  content_offset);
+                                                  content_offset,
+                                                  CreateVector(builder, symbols),
+                                                  CreateVector(builder, contexts),
+                                                  occurrence_columns,
+                                                  relation_columns,
+                                                  content_hash,
+                                                  /*inline_contexts=*/true);
     builder.Finish(merged_index);
 
     out.write(safe_cast<char>(builder.GetBufferPointer()), builder.GetSize());
@@ -389,38 +894,80 @@ void MergedIndex::lookup(this const Self& self,
                 return std::tuple(lhs.range.begin, lhs.range.end, lhs.target) <
                        std::tuple(rhs.range.begin, rhs.range.end, rhs.target);
             });
+            index.occurrence_max_ends =
+                build_interval_tree(occurrences.size(),
+                                    [&](std::uint32_t i) { return occurrences[i].range.end; });
         }
 
-        auto it = std::ranges::lower_bound(occurrences, offset, {}, [](index::Occurrence& o) {
-            return o.range.end;
-        });
-
-        while(it != occurrences.end()) {
-            if(it->range.contains(offset)) {
+        query_interval_tree(
+            occurrences.size(),
+            offset,
+            [&](std::uint32_t i) { return occurrences[i].range.begin; },
+            [&](std::uint32_t i) { return occurrences[i].range.end; },
+            [&](std::uint32_t i) { return index.occurrence_max_ends[i]; },
+            [&](std::uint32_t i) {
                 // Skip occurrences whose canonical_ids are all removed.
                 if(!index.removed.isEmpty()) {
-                    auto bitmap_it = index.occurrences.find(*it);
-                    if(bitmap_it != index.occurrences.end()) {
-                        auto remaining = bitmap_it->second - index.removed;
-                        if(remaining.isEmpty()) {
-                            it++;
-                            continue;
-                        }
+                    auto contexts_it = index.occurrences.find(occurrences[i]);
+                    if(contexts_it != index.occurrences.end() &&
+                       contexts_it->second.subset_of(index.removed)) {
+                        return true;
                     }
                 }
+                return callback(occurrences[i]);
+            });
+    } else if(auto buffer = self.mapped()) {
+        auto index = fbs::GetRoot<binary::MergedIndex>(buffer->getBufferStart());
+        if(auto columns = index->occurrence_columns()) {
+            auto& begins = *columns->block_begins();
+            auto& max_ends = *columns->block_max_ends();
+
+            roaring::Roaring removed;
+            if(index->removed() && index->removed()->size() > 0) {
+                removed = read_bitmap(index->removed());
+            }
+
+            // Decode the block, stopping at the first occurrence after the offset.
+            bool stopped = false;
+            auto scan = [&](std::uint32_t block) {
+                decode_block(index, block, [&](const Occurrence& o, std::uint32_t c) {
+                    if(o.range.begin > offset) {
+                        return false;
+                    }
+                    if(!o.range.contains(offset) || all_removed(index, removed, c)) {
+                        return true;
+                    }
+                    stopped = !callback(o);
+                    return !stopped;
+                });
+                return !stopped;
+            };
+
+            // The blocks whose span contains the offset come from the block
+            // interval tree, so only those are decoded.
+            if(auto tree = columns->block_tree_max_ends()) {
+                query_interval_tree(
+                    begins.size(),
+                    offset,
+                    [&](std::uint32_t block) { return begins.Get(block); },
+                    [&](std::uint32_t block) { return max_ends.Get(block); },
+                    [&](std::uint32_t block) { return tree->Get(block); },
+                    scan);
+                return;
+            }
 
-                if(!callback(*it)) {
+            // Without the tree, check the end of every block starting at or
+            // before the offset.  The max ends are not monotonic, a long
+            // occurrence (e.g. a namespace) may start many blocks earlier.
+            std::uint32_t last = std::ranges::upper_bound(begins, offset) - begins.begin();
+            for(std::uint32_t block = 0; block < last; block++) {
+                if(max_ends.Get(block) >= offset && !scan(block)) {
                     break;
                 }
-
-                it++;
-                continue;
             }
-
-            break;
+            return;
         }
-    } else if(self.buffer) {
-        auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+
         auto& occurrences = *index->occurrences();
 
         auto it = std::ranges::lower_bound(occurrences, offset, {}, [](auto o) {
@@ -453,24 +1000,47 @@ void MergedIndex::lookup(this const Self& self,
             return;
         }
 
-        auto& relations = it->second;
-        for(auto& [relation, bitmap]: relations) {
-            if(relation.kind & kind) {
-                // Skip relations whose canonical_ids are all removed.
-                if(!self.impl->removed.isEmpty()) {
-                    auto remaining = bitmap - self.impl->removed;
-                    if(remaining.isEmpty()) {
-                        continue;
-                    }
-                }
+        auto relations = it->second.find(kind);
+        if(!relations) {
+            return;
+        }
 
-                if(!callback(relation)) {
-                    break;
-                }
+        for(auto& [relation, contexts]: *relations) {
+            // Skip relations whose canonical_ids are all removed.
+            if(!self.impl->removed.isEmpty() && contexts.subset_of(self.impl->removed)) {
+                continue;
             }
+
+            if(!callback(relation)) {
+                break;
+            }
+        }
+    } else if(auto buffer = self.mapped()) {
+        auto index = fbs::GetRoot<binary::MergedIndex>(buffer->getBufferStart());
+        if(index->relation_columns()) {
+            auto& symbols = *index->symbols();
+            auto it = std::ranges::lower_bound(symbols, symbol);
+            if(it == symbols.end() || *it != symbol) [[unlikely]] {
+                return;
+            }
+
+            roaring::Roaring removed;
+            if(index->removed() && index->removed()->size() > 0) {
+                removed = read_bitmap(index->removed());
+            }
+
+            decode_relations(index,
+                             it - symbols.begin(),
+                             kind,
+                             [&](const Relation& relation, std::uint32_t context) {
+                                 if(all_removed(index, removed, context)) {
+                                     return true;
+                                 }
+                                 return callback(relation);
+                             });
+            return;
         }
-    } else if(self.buffer) {
-        auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+
         auto& entries = *index->relations();
 
         auto it = std::ranges::lower_bound(entries, symbol, {}, [](auto e) { return e->symbol(); });
@@ -515,8 +1085,8 @@ bool MergedIndex::need_update(this const Self& self, llvm::ArrayRef<llvm::String
         }
 
         return false;
-    } else if(self.buffer) {
-        auto index = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+    } else if(auto buffer = self.mapped()) {
+        auto index = fbs::GetRoot<binary::MergedIndex>(buffer->getBufferStart());
         if(index->compilation_contexts()->empty()) {
             return true;
         }
@@ -554,11 +1124,7 @@ void MergedIndex::remove(this Self& self, std::uint32_t path_id) {
     auto hc_it = index.header_contexts.find(path_id);
     if(hc_it != index.header_contexts.end()) {
         for(auto& [_, canonical_id]: hc_it->second.includes) {
-            auto& ref_counts = index.canonical_ref_counts[canonical_id];
-            ref_counts -= 1;
-            if(ref_counts == 0) {
-                index.removed.add(canonical_id);
-            }
+            index.release(canonical_id);
         }
         index.header_contexts.erase(hc_it);
     }
@@ -566,12 +1132,7 @@ void MergedIndex::remove(this Self& self, std::uint32_t path_id) {
     // Handle compilation context removal.
     auto cc_it = index.compilation_contexts.find(path_id);
     if(cc_it != index.compilation_contexts.end()) {
-        auto canonical_id = cc_it->second.canonical_id;
-        auto& ref_counts = index.canonical_ref_counts[canonical_id];
-        ref_counts -= 1;
-        if(ref_counts == 0) {
-            index.removed.add(canonical_id);
-        }
+        index.release(cc_it->second.canonical_id);
         index.compilation_contexts.erase(cc_it);
     }
 
@@ -579,19 +1140,49 @@ void MergedIndex::remove(this Self& self, std::uint32_t path_id) {
     index.occurrences_cache.clear();
 }
 
+std::uint64_t MergedIndex::removed_contexts(this const Self& self) {
+    if(self.impl) {
+        return self.impl->removed.cardinality();
+    }
+    if(auto buffer = self.mapped()) {
+        auto root = fbs::GetRoot<binary::MergedIndex>(buffer->getBufferStart());
+        if(root->removed() && root->removed()->size() > 0) {
+            return read_bitmap(root->removed()).cardinality();
+        }
+    }
+    return 0;
+}
+
+std::size_t MergedIndex::compact(this Self& self) {
+    self.load_in_memory();
+    auto before = self.memory_usage();
+    self.impl->compact();
+    auto after = self.memory_usage();
+    return before > after ? before - after : 0;
+}
+
 void MergedIndex::merge(this Self& self,
                         std::uint32_t path_id,
                         std::chrono::milliseconds build_at,
                         std::vector<IncludeLocation> include_locations,
                         FileIndex& index,
-                        llvm::StringRef content) {
+                        const ContentHash& content) {
     self.load_in_memory();
-    self.impl->content = content.str();
+    self.impl->content_hash = content;
+    self.impl->content.clear();
     self.impl->merge(path_id, index, [&](Impl& self, std::uint32_t canonical_id) {
-        auto& context = self.compilation_contexts[path_id];
+        auto [it, inserted] = self.compilation_contexts.try_emplace(path_id);
+        auto& context = it->second;
+        bool referenced = inserted || context.canonical_id != canonical_id;
+        if(!inserted && referenced) {
+            // The file was rebuilt with a different result, the previous one is
+            // dead unless another context shares it.
+            self.release(context.canonical_id);
+        }
         context.canonical_id = canonical_id;
         context.build_at = build_at.count();
         context.include_locations = std::move(include_locations);
+        return referenced;
     });
     self.impl->occurrences_cache.clear();
 }
@@ -600,23 +1191,204 @@ void MergedIndex::merge(this Self& self,
                         std::uint32_t path_id,
                         std::uint32_t include_id,
                         FileIndex& index,
-                        llvm::StringRef content) {
+                        const ContentHash& content) {
     self.load_in_memory();
-    if(self.impl->content.empty() && !content.empty()) {
-        self.impl->content = content.str();
+    if(self.impl->content_hash == ContentHash{} && content != ContentHash{}) {
+        self.impl->content_hash = content;
+        self.impl->content.clear();
     }
     self.impl->merge(path_id, index, [&](Impl& self, std::uint32_t canonical_id) {
         auto& context = self.header_contexts[path_id];
-        context.includes.emplace_back(include_id, canonical_id);
+        for(auto& include: context.includes) {
+            if(include.include_id != include_id)
+                continue;
+            if(include.canonical_id == canonical_id)
+                return false;
+            // The file was rebuilt with a different result for this include,
+            // replace it so the previous one can be compacted away.
+            self.release(include.canonical_id);
+            include.canonical_id = canonical_id;
+            return true;
+        }
+        context.includes.push_back({include_id, canonical_id});
+        return true;
     });
     self.impl->occurrences_cache.clear();
 }
 
+std::size_t MergedIndex::memory_usage(this const Self& self) {
+    if(!self.impl) {
+        // Mmap'd pages belong to the page cache and can be reclaimed by the
+        // kernel at any time, only a buffer read into the heap is resident.
+        if(self.buffer &&
+           self.buffer->getBufferKind() == llvm::MemoryBuffer::MemoryBuffer_Malloc) {
+            return self.buffer->getBufferSize();
+        }
+        return 0;
+    }
+
+    auto& index = *self.impl;
+    std::size_t size = sizeof(Impl) + index.content.capacity();
+    size += index.header_contexts.getMemorySize() + index.compilation_contexts.getMemorySize();
+    size += index.canonical_cache.getNumItems() *
+            (sizeof(llvm::StringMapEntry<std::uint32_t>) + 32 + sizeof(void*));
+    size += index.canonical_ref_counts.capacity() * sizeof(std::uint32_t);
+    // Context sets are stored in the tables, only the promoted ones own more.
+    size += index.occurrences.getMemorySize();
+    for(auto& [_, contexts]: index.occurrences) {
+        size += contexts.heap_bytes();
+    }
+    size += index.relations.getMemorySize();
+    for(auto& [_, relations]: index.relations) {
+        if(relations.partitions.capacity() > relations_inline_kinds) {
+            size += relations.partitions.capacity_in_bytes();
+        }
+        for(auto& [kind, partition]: relations.partitions) {
+            size += partition.getMemorySize();
+            for(auto& [relation, contexts]: partition) {
+                size += contexts.heap_bytes();
+            }
+        }
+    }
+    size += index.occurrences_cache.capacity() * sizeof(Occurrence);
+    size += index.occurrence_max_ends.capacity() * sizeof(std::uint32_t);
+    return size;
+}
+
+MergedIndex::ContextStats MergedIndex::context_stats(this const Self& self) {
+    ContextStats stats;
+    auto count = [&](const ContextSet& contexts) {
+        stats.entries += 1;
+        stats.promoted += contexts.heap_bytes() > 0;
+        stats.bytes += sizeof(ContextSet) + contexts.heap_bytes();
+        stats.bitmap_bytes += sizeof(Bitmap) + contexts.to_bitmap().getSizeInBytes(false);
+    };
+
+    if(self.impl) {
+        for(auto& [_, contexts]: self.impl->occurrences) {
+            count(contexts);
+        }
+        for(auto& [_, relations]: self.impl->relations) {
+            for(auto& [kind, partition]: relations.partitions) {
+                for(auto& [relation, contexts]: partition) {
+                    count(contexts);
+                }
+            }
+        }
+        return stats;
+    }
+
+    // A mapped shard is measured from its columns as load_in_memory() would
+    // build the sets, without building the tables.
+    auto buffer = self.mapped();
+    if(!buffer) {
+        return stats;
+    }
+    auto root = fbs::GetRoot<binary::MergedIndex>(buffer->getBufferStart());
+
+    if(auto columns = root->occurrence_columns()) {
+        std::vector<ContextSet> contexts;
+        contexts.reserve(root->contexts()->size());
+        for(auto context: *root->contexts()) {
+            contexts.emplace_back(ContextSet::from(read_bitmap(context->data())));
+        }
+
+        bool tagged = root->inline_contexts();
+        auto count_context = [&](std::uint32_t context) {
+            if(!tagged) {
+                count(contexts[context]);
+            } else if(context & 1) {
+                count(contexts[context >> 1]);
+            } else {
+                std::uint32_t id = context >> 1;
+                count(ContextSet::from(llvm::ArrayRef(id)));
+            }
+            return true;
+        };
+
+        for(std::uint32_t block = 0; block < columns->block_offsets()->size(); block++) {
+            decode_block(root, block, [&](const Occurrence&, std::uint32_t context) {
+                return count_context(context);
+            });
+        }
+        for(std::uint32_t symbol = 0; symbol < root->symbols()->size(); symbol++) {
+            decode_relations(root,
+                             symbol,
+                             RelationKind::Invalid,
+                             [&](const Relation&, std::uint32_t context) {
+                                 return count_context(context);
+                             });
+        }
+        return stats;
+    }
+
+    for(auto entry: *root->occurrences()) {
+        count(ContextSet::from(read_bitmap(entry->context())));
+    }
+    for(auto entry: *root->relations()) {
+        for(auto relation_entry: *entry->relations()) {
+            count(ContextSet::from(read_bitmap(relation_entry->context())));
+        }
+    }
+    return stats;
+}
+
+void MergedIndex::shrink(this Self& self) {
+    if(!self.impl) {
+        return;
+    }
+
+    self = self.snapshot();
+}
+
+MergedIndex MergedIndex::fork(this const Self& self) {
+    if(self.impl) {
+        return MergedIndex(nullptr, std::make_unique<Impl>(*self.impl));
+    }
+
+    // Not mapped yet, let the fork map the file itself.
+    if(!self.path.empty()) {
+        return load(self.path);
+    }
+
+    // The mapping may go away while the fork is merged into, when the shard is
+    // evicted, rewritten or packed.  Copy the bytes, the merge deserializes
+    // them anyway.
+    if(auto buffer = self.mapped()) {
+        return MergedIndex(llvm::MemoryBuffer::getMemBufferCopy(buffer->getBuffer()), nullptr);
+    }
+    return MergedIndex();
+}
+
+MergedIndex MergedIndex::snapshot(this const Self& self) {
+    llvm::SmallString<0> data;
+    llvm::raw_svector_ostream out(data);
+    self.serialize(out);
+
+    MergedIndex index(llvm::MemoryBuffer::getMemBufferCopy(data), nullptr);
+    index.dirty = true;
+    return index;
+}
+
+ContentHash MergedIndex::content_hash(this const Self& self) {
+    ContentHash hash{};
+    if(self.impl) {
+        hash = self.impl->content_hash;
+    } else if(auto buffer = self.mapped()) {
+        auto root = fbs::GetRoot<binary::MergedIndex>(buffer->getBufferStart());
+        auto stored = root->content_hash();
+        if(stored && stored->size() == hash.size()) {
+            std::ranges::copy(*stored, hash.begin());
+        }
+    }
+    return hash;
+}
+
 llvm::StringRef MergedIndex::content(this const Self& self) {
     if(self.impl) {
         return self.impl->content;
-    } else if(self.buffer) {
-        auto root = fbs::GetRoot<binary::MergedIndex>(self.buffer->getBufferStart());
+    } else if(auto buffer = self.mapped()) {
+        auto root = fbs::GetRoot<binary::MergedIndex>(buffer->getBufferStart());
         if(root->content()) {
             return root->content()->string_view();
         }
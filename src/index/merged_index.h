@@ -1,8 +1,10 @@
 #pragma once
 
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "index/tu_index.h"
@@ -12,6 +14,9 @@
 
 namespace clice::index {
 
+/// The xxh3-128 of a source content, the zero hash stands for no content.
+using ContentHash = std::array<std::uint8_t, 16>;
+
 class MergedIndex {
 private:
     struct Impl;
@@ -22,6 +27,10 @@ private:
 
     void load_in_memory(this Self& self);
 
+    /// Map the on-disk shard on first access. Returns the flatbuffer view, or
+    /// nullptr if the index has no serialized form.
+    const llvm::MemoryBuffer* mapped(this const Self& self);
+
 public:
     MergedIndex();
 
@@ -37,13 +46,24 @@ public:
 
     ~MergedIndex();
 
-    /// Load merged index from disk
+    /// Register a merged index stored on disk. The file is not touched until the
+    /// first query, then it is mapped read-only and served without deserialization.
     static MergedIndex load(llvm::StringRef path);
 
+    /// Serve a merged index from `buffer` without deserialization, e.g. a slice
+    /// of a packed shard store which keeps the whole mapping alive.
+    static MergedIndex from_buffer(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+    /// Whether the on-disk shard has been mapped (or built in memory).
+    bool is_loaded() const {
+        return buffer != nullptr || impl != nullptr;
+    }
+
     /// Serialize it to binary format.
     void serialize(this const Self& self, llvm::raw_ostream& out);
 
-    /// Lookup the occurrence in corresponding offset.
+    /// Lookup the occurrences containing `offset`, in the order of their begin,
+    /// through an interval tree over them.
     void lookup(this const Self& self,
                 std::uint32_t offset,
                 llvm::function_ref<bool(const Occurrence&)> callback);
@@ -58,13 +78,61 @@ public:
     bool need_update(this const Self& self, llvm::ArrayRef<llvm::StringRef> path_mapping);
 
     bool need_rewrite() {
+        return impl != nullptr || dirty;
+    }
+
+    /// Whether the index is materialized as mutable in memory data structures.
+    bool is_materialized() const {
         return impl != nullptr;
     }
 
+    /// Approximate heap bytes held by this index. A mapped shard only counts
+    /// its buffer if it was read into memory instead of mmap'd.
+    std::size_t memory_usage(this const Self& self);
+
+    /// Memory taken by the context sets of all occurrences and relations.
+    struct ContextStats {
+        std::size_t entries = 0;
+        /// Sets with too many contexts to be stored inline.
+        std::size_t promoted = 0;
+        std::size_t bytes = 0;
+        /// What a Roaring bitmap per entry would take instead.
+        std::size_t bitmap_bytes = 0;
+    };
+
+    /// Measure the context sets, of a mapped index as they would be in memory
+    /// without loading it.
+    ContextStats context_stats(this const Self& self);
+
+    /// Serialize the in memory data back to its compact binary form and release
+    /// it. Queries are served from the buffer and the next merge rebuilds it.
+    void shrink(this Self& self);
+
+    /// A mutable index starting from the content of this one, so merges can go
+    /// on elsewhere while this one keeps serving queries. The fork of a mapped
+    /// index owns a copy of its bytes, so it outlives this one.
+    MergedIndex fork(this const Self& self);
+
+    /// An immutable copy of the current content in compact binary form, to be
+    /// published for queries. It is not on disk yet.
+    MergedIndex snapshot(this const Self& self);
+
     /// Remove the index of specific path id.
     void remove(this Self& self, std::uint32_t path_id);
 
-    /// Get the stored source content for position mapping.
+    /// The number of canonical contexts removed but still held by the index.
+    std::uint64_t removed_contexts(this const Self& self);
+
+    /// Drop the occurrences and relations which only belong to removed
+    /// contexts, and renumber the live canonical ids densely. Returns the
+    /// number of heap bytes reclaimed.
+    std::size_t compact(this Self& self);
+
+    /// The hash of the source content in the content store, zero if unknown.
+    ContentHash content_hash(this const Self& self);
+
+    /// The source content stored inline by indices written before the
+    /// content store, empty otherwise.
     llvm::StringRef content(this const Self& self);
 
     /// Merge the index with given compilation context.
@@ -73,14 +141,14 @@ public:
                std::chrono::milliseconds build_at,
                std::vector<IncludeLocation> include_locations,
                FileIndex& index,
-               llvm::StringRef content);
+               const ContentHash& content);
 
     /// Merge the index with given header context.
     void merge(this Self& self,
                std::uint32_t path_id,
                std::uint32_t include_id,
                FileIndex& index,
-               llvm::StringRef content);
+               const ContentHash& content);
 
     friend bool operator==(MergedIndex& lhs, MergedIndex& rhs);
 
@@ -88,10 +156,16 @@ private:
     /// The binary serialization data of index. If you load merged index
     /// from disk, we use directly access the data without deserialization
     /// unless you want to modify it.
-    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    mutable std::unique_ptr<llvm::MemoryBuffer> buffer;
+
+    /// The path of the shard on disk which is not mapped yet.
+    mutable std::string path;
 
     /// The in memory data of the index.
     std::unique_ptr<Impl> impl;
+
+    /// Whether the buffer was produced by shrink() and is not on disk yet.
+    bool dirty = false;
 };
 
 }  // namespace clice::index
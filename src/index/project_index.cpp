@@ -1,10 +1,168 @@
 #include "index/project_index.h"
 
+#include <limits>
+#include <utility>
+
 #include "index/serialization.h"
 
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringExtras.h"
+
 namespace clice::index {
 
-llvm::SmallVector<std::uint32_t> ProjectIndex::merge(this ProjectIndex& self, TUIndex& index) {
+namespace {
+
+std::uint32_t pack_trigram(char a, char b, char c) {
+    return static_cast<std::uint32_t>(static_cast<std::uint8_t>(llvm::toLower(a))) << 16 |
+           static_cast<std::uint32_t>(static_cast<std::uint8_t>(llvm::toLower(b))) << 8 |
+           static_cast<std::uint8_t>(llvm::toLower(c));
+}
+
+/// View a vector of a mapped index in place.
+template <typename T>
+llvm::ArrayRef<T> as_array(const fbs::Vector<T>* vector) {
+    if(!vector) {
+        return {};
+    }
+    return llvm::ArrayRef<T>(vector->data(), vector->size());
+}
+
+void sort_unique(llvm::SmallVectorImpl<std::uint32_t>& out) {
+    std::ranges::sort(out);
+    out.erase(std::ranges::unique(out).begin(), out.end());
+}
+
+/// Collect the distinct packed trigrams of `text`, case-folded.
+void collect_trigrams(llvm::StringRef text, llvm::SmallVectorImpl<std::uint32_t>& out) {
+    for(std::size_t i = 0; i + 3 <= text.size(); ++i) {
+        out.push_back(pack_trigram(text[i], text[i + 1], text[i + 2]));
+    }
+    sort_unique(out);
+}
+
+/// Collect the trigrams a symbol name is found by.  Besides the trigrams of
+/// the text, these are the trigrams of its letters and digits where each next
+/// character is either the following one or the start of a later segment, as
+/// in "gtn" of "get_type_name" or "gtN" of "getTypeName".  A query matching
+/// the name as a subsequence which only jumps ahead to segment starts has all
+/// of its trigrams among them.
+void collect_name_trigrams(llvm::StringRef name, llvm::SmallVectorImpl<std::uint32_t>& out) {
+    for(std::size_t i = 0; i + 3 <= name.size(); ++i) {
+        out.push_back(pack_trigram(name[i], name[i + 1], name[i + 2]));
+    }
+
+    // The letters and digits of the name, and which of them start a segment.
+    llvm::SmallVector<char, 64> chars;
+    llvm::SmallVector<bool, 64> heads;
+    char prev = 0;
+    for(auto c: name) {
+        if(llvm::isAlnum(c)) {
+            bool head = !llvm::isAlnum(prev) || (llvm::isUpper(c) && llvm::isLower(prev)) ||
+                        (llvm::isDigit(c) != llvm::isDigit(prev));
+            chars.push_back(c);
+            heads.push_back(head);
+        }
+        prev = c;
+    }
+
+    // The start of the first segment after each character.
+    auto n = chars.size();
+    llvm::SmallVector<std::size_t, 64> next_head(n, n);
+    for(std::size_t i = n; i-- > 1;) {
+        next_head[i - 1] = heads[i] ? i : next_head[i];
+    }
+
+    for(std::size_t i = 0; i < n; ++i) {
+        for(auto j: {i + 1, next_head[i]}) {
+            if(j >= n)
+                continue;
+            for(auto k: {j + 1, next_head[j]}) {
+                if(k < n) {
+                    out.push_back(pack_trigram(chars[i], chars[j], chars[k]));
+                }
+            }
+        }
+    }
+    sort_unique(out);
+}
+
+}  // namespace
+
+void TrigramIndex::insert(this TrigramIndex& self, SymbolHash symbol, llvm::StringRef name) {
+    llvm::SmallVector<std::uint32_t, 32> trigrams;
+    collect_name_trigrams(name, trigrams);
+    for(auto trigram: trigrams) {
+        self.added[trigram].push_back(symbol);
+    }
+}
+
+llvm::ArrayRef<std::uint32_t> TrigramIndex::loaded(this const TrigramIndex& self,
+                                                   std::uint32_t trigram) {
+    auto it = std::ranges::lower_bound(self.trigrams, trigram);
+    if(it == self.trigrams.end() || *it != trigram) {
+        return {};
+    }
+    auto i = it - self.trigrams.begin();
+    return self.ordinals.slice(self.offsets[i], self.offsets[i + 1] - self.offsets[i]);
+}
+
+bool TrigramIndex::candidates(this const TrigramIndex& self,
+                              llvm::StringRef query,
+                              llvm::SmallVectorImpl<SymbolHash>& out) {
+    if(query.size() < 3) {
+        return false;
+    }
+
+    llvm::SmallVector<std::uint32_t, 32> trigrams;
+    collect_trigrams(query, trigrams);
+
+    // Every trigram of the query must occur in a matching name, so the shortest
+    // postings list bounds the candidates.
+    llvm::ArrayRef<std::uint32_t> shortest_loaded;
+    const std::vector<SymbolHash>* shortest_added = nullptr;
+    std::size_t shortest = std::numeric_limits<std::size_t>::max();
+    for(auto trigram: trigrams) {
+        auto loaded = self.loaded(trigram);
+        auto it = self.added.find(trigram);
+        auto added = it != self.added.end() ? &it->second : nullptr;
+        auto size = loaded.size() + (added ? added->size() : 0);
+        if(size == 0) {
+            return true;
+        }
+        if(size < shortest) {
+            shortest = size;
+            shortest_loaded = loaded;
+            shortest_added = added;
+        }
+    }
+
+    out.reserve(out.size() + shortest);
+    for(auto ordinal: shortest_loaded) {
+        out.push_back(self.symbol_ids[ordinal]);
+    }
+    if(shortest_added) {
+        out.append(shortest_added->begin(), shortest_added->end());
+    }
+    return true;
+}
+
+void TrigramIndex::for_each(this const TrigramIndex& self,
+                            llvm::function_ref<void(std::uint32_t, SymbolHash)> fn) {
+    for(std::size_t i = 0; i < self.trigrams.size(); ++i) {
+        auto begin = self.offsets[i];
+        for(auto ordinal: self.ordinals.slice(begin, self.offsets[i + 1] - begin)) {
+            fn(self.trigrams[i], self.symbol_ids[ordinal]);
+        }
+    }
+    for(auto& [trigram, symbols]: self.added) {
+        for(auto symbol: symbols) {
+            fn(trigram, symbol);
+        }
+    }
+}
+
+llvm::SmallVector<std::uint32_t> ProjectIndex::map_paths(this ProjectIndex& self,
+                                                         const TUIndex& index) {
     auto& paths = index.graph.paths;
     llvm::SmallVector<std::uint32_t> file_ids_map;
     file_ids_map.resize_for_overwrite(paths.size());
@@ -12,19 +170,70 @@ llvm::SmallVector<std::uint32_t> ProjectIndex::merge(this ProjectIndex& self, TU
     for(std::uint32_t i = 0; i < paths.size(); i++) {
         file_ids_map[i] = self.path_pool.path_id(paths[i]);
     }
+    return file_ids_map;
+}
+
+llvm::SmallVector<std::uint32_t> ProjectIndex::merge(this ProjectIndex& self, TUIndex& index) {
+    auto file_ids_map = self.map_paths(index);
+    self.merge_symbols(index, file_ids_map);
+    return file_ids_map;
+}
+
+void ProjectIndex::merge_symbols(this ProjectIndex& self,
+                                 TUIndex& index,
+                                 llvm::ArrayRef<std::uint32_t> file_ids_map) {
+    auto& paths = index.graph.paths;
+
+    // Files indexed by this TU and the symbols they define, a definition
+    // recorded in one of these files that is not reported again is gone.
+    llvm::DenseSet<std::uint32_t> indexed_files;
+    llvm::DenseSet<SymbolHash> defined;
+
+    auto record_definitions = [&](std::uint32_t tu_path_id, FileIndex& file_index) {
+        indexed_files.insert(file_ids_map[tu_path_id]);
+        for(auto& [symbol_id, relations]: file_index.relations) {
+            for(auto& relation: relations) {
+                if(relation.kind.value() != RelationKind::Definition)
+                    continue;
+                defined.insert(symbol_id);
+                self.definitions[symbol_id] = SymbolDefinition{
+                    .path_id = file_ids_map[tu_path_id],
+                    .range = relation.range,
+                    .extent = relation.definition_range(),
+                };
+                break;
+            }
+        }
+    };
+
+    // Deserialized indices are keyed by path id, indices built from an AST by file id.
+    for(auto& [tu_path_id, file_index]: index.path_file_indices) {
+        record_definitions(tu_path_id, file_index);
+    }
+    for(auto& [fid, file_index]: index.file_indices) {
+        record_definitions(index.graph.path_id(fid), file_index);
+    }
+    record_definitions(static_cast<std::uint32_t>(paths.size() - 1), index.main_file_index);
 
     for(auto& [symbol_id, symbol]: index.symbols) {
+        if(!defined.contains(symbol_id)) {
+            auto def_it = self.definitions.find(symbol_id);
+            if(def_it != self.definitions.end() &&
+               indexed_files.contains(def_it->second.path_id)) {
+                self.definitions.erase(def_it);
+            }
+        }
+
         auto& target_symbol = self.symbols[symbol_id];
         if(target_symbol.name.empty()) {
-            target_symbol.name = symbol.name;
+            target_symbol.name = self.save_name(symbol.name);
             target_symbol.kind = symbol.kind;
+            self.trigrams.insert(symbol_id, symbol.name);
         }
         for(auto ref: symbol.reference_files) {
             target_symbol.reference_files.add(file_ids_map[ref]);
         }
     }
-
-    return file_ids_map;
 }
 
 void ProjectIndex::serialize(this ProjectIndex& self, llvm::raw_ostream& os) {
@@ -60,17 +269,93 @@ void ProjectIndex::serialize(this ProjectIndex& self, llvm::raw_ostream& os) {
                                                               CreateVector(builder, buffer)));
     });
 
+    // Number the symbols in the order they are written, the postings refer to
+    // them by ordinal.
+    std::vector<SymbolHash> symbol_ids;
+    llvm::DenseMap<SymbolHash, std::uint32_t> ordinal_of;
+    symbol_ids.reserve(self.symbols.size());
+    for(auto& [symbol_id, _]: self.symbols) {
+        ordinal_of.try_emplace(symbol_id, symbol_ids.size());
+        symbol_ids.push_back(symbol_id);
+    }
+
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> postings;
+    self.trigrams.for_each([&](std::uint32_t trigram, SymbolHash symbol) {
+        if(auto it = ordinal_of.find(symbol); it != ordinal_of.end()) {
+            postings.emplace_back(trigram, it->second);
+        }
+    });
+    std::ranges::sort(postings);
+    postings.erase(std::ranges::unique(postings).begin(), postings.end());
+
+    std::vector<std::uint32_t> trigram_keys;
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint32_t> ordinals;
+    ordinals.reserve(postings.size());
+    for(auto& [trigram, ordinal]: postings) {
+        if(trigram_keys.empty() || trigram_keys.back() != trigram) {
+            trigram_keys.push_back(trigram);
+            offsets.push_back(ordinals.size());
+        }
+        ordinals.push_back(ordinal);
+    }
+    offsets.push_back(ordinals.size());
+
+    auto trigram_postings = binary::CreateTrigramPostings(builder,
+                                                          CreateVector(builder, trigram_keys),
+                                                          CreateVector(builder, offsets),
+                                                          CreateVector(builder, ordinals),
+                                                          CreateVector(builder, symbol_ids));
+
+    auto definitions = transform(self.definitions, [&](auto&& value) {
+        auto& [symbol_id, definition] = value;
+        return binary::SymbolDefinitionEntry(
+            symbol_id,
+            definition.path_id,
+            binary::Range(definition.range.begin, definition.range.end),
+            binary::Range(definition.extent.begin, definition.extent.end));
+    });
+
+    // A partial table saved as it is would read as complete next time, leave
+    // it out so the index is loaded as partial again.
+    fbs::Offset<fbs::Vector<const binary::SymbolDefinitionEntry*>> definitions_offset;
+    if(!self.partial_definitions) {
+        definitions_offset =
+            CreateStructVector<binary::SymbolDefinitionEntry>(builder, definitions);
+    }
+
     auto project_index =
         binary::CreateProjectIndex(builder,
                                    CreateVector(builder, paths),
                                    CreateStructVector<binary::PathMapEntry>(builder, indices),
-                                   CreateVector(builder, symbols));
+                                   CreateVector(builder, symbols),
+                                   definitions_offset,
+                                   trigram_postings);
 
     builder.Finish(project_index);
     os.write(safe_cast<const char>(builder.GetBufferPointer()), builder.GetSize());
 }
 
+llvm::StringRef ProjectIndex::save_name(this ProjectIndex& self, llvm::StringRef name) {
+    if(name.empty()) {
+        return {};
+    }
+    auto data = self.names.Allocate<char>(name.size());
+    std::ranges::copy(name, data);
+    return llvm::StringRef(data, name.size());
+}
+
 ProjectIndex ProjectIndex::from(const void* data) {
+    return from(data, /*copy=*/true);
+}
+
+ProjectIndex ProjectIndex::from_buffer(std::unique_ptr<llvm::MemoryBuffer> buffer) {
+    auto index = from(buffer->getBufferStart(), /*copy=*/false);
+    index.buffer = std::move(buffer);
+    return index;
+}
+
+ProjectIndex ProjectIndex::from(const void* data, bool copy) {
     auto root = fbs::GetRoot<binary::ProjectIndex>(data);
 
     ProjectIndex index;
@@ -91,16 +376,54 @@ ProjectIndex ProjectIndex::from(const void* data) {
         index.indices.try_emplace(entry->source(), entry->index());
     }
 
+    index.symbols.reserve(root->symbols()->size());
     for(auto entry: *root->symbols()) {
         auto& symbol = index.symbols[entry->symbol_id()];
         auto* fb_symbol = entry->symbol();
         if(auto* name = fb_symbol->name()) {
-            symbol.name = name->str();
+            llvm::StringRef view(name->data(), name->size());
+            symbol.name = copy ? index.save_name(view) : view;
         }
         symbol.kind = SymbolKind(static_cast<std::uint8_t>(fb_symbol->kind()));
         symbol.reference_files = read_bitmap(fb_symbol->refs());
     }
 
+    if(auto postings = root->trigram_postings()) {
+        TrigramIndex loaded{
+            .trigrams = as_array(postings->trigrams()),
+            .offsets = as_array(postings->offsets()),
+            .ordinals = as_array(postings->ordinals()),
+            .symbol_ids = as_array(postings->symbol_ids()),
+        };
+        if(copy) {
+            // `data` is not kept, post the loaded symbols like merged ones.
+            loaded.for_each([&](std::uint32_t trigram, SymbolHash symbol) {
+                index.trigrams.added[trigram].push_back(symbol);
+            });
+        } else {
+            index.trigrams = std::move(loaded);
+        }
+    } else {
+        // Indices written before the postings were read in place, rebuild them.
+        for(auto& [symbol_id, symbol]: index.symbols) {
+            index.trigrams.insert(symbol_id, symbol.name);
+        }
+    }
+
+    if(auto definitions = root->definitions()) {
+        for(auto entry: *definitions) {
+            index.definitions.try_emplace(
+                entry->symbol(),
+                SymbolDefinition{
+                    .path_id = entry->path_id(),
+                    .range = LocalSourceRange(entry->range().begin(), entry->range().end()),
+                    .extent = LocalSourceRange(entry->extent().begin(), entry->extent().end()),
+                });
+        }
+    } else {
+        index.partial_definitions = true;
+    }
+
     return index;
 }
 
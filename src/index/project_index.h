@@ -2,15 +2,19 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 #include "index/tu_index.h"
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionExtras.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/Allocator.h"
+#include "llvm/Support/MemoryBuffer.h"
 
 namespace clice::index {
 
@@ -69,6 +73,76 @@ struct PathPool {
     }
 };
 
+/// Trigram postings over symbol names, used to find the candidates of a
+/// case-insensitive fuzzy search without scanning every symbol.
+///
+/// The postings of a loaded index are read in place from its buffer, as sorted
+/// 32-bit ordinals into a dense array of symbol hashes.  Only the symbols
+/// merged after loading are posted on the heap.
+struct TrigramIndex {
+    /// The sorted trigrams of the loaded postings.
+    llvm::ArrayRef<std::uint32_t> trigrams;
+
+    /// The postings of trigrams[i] are ordinals[offsets[i], offsets[i + 1]).
+    llvm::ArrayRef<std::uint32_t> offsets;
+
+    /// Sorted ordinals into `symbol_ids` for each trigram.
+    llvm::ArrayRef<std::uint32_t> ordinals;
+
+    llvm::ArrayRef<SymbolHash> symbol_ids;
+
+    /// Maps a packed, lower-cased trigram to the symbols merged since loading
+    /// whose name has it.
+    llvm::DenseMap<std::uint32_t, std::vector<SymbolHash>> added;
+
+    /// Add the trigrams of `name` to the postings of `symbol`, those of its text
+    /// and those which skip ahead to the start of a later segment.
+    void insert(this TrigramIndex& self, SymbolHash symbol, llvm::StringRef name);
+
+    /// Collect the symbols whose name may contain `query`, or match it as a
+    /// subsequence which only skips ahead to segment starts, e.g. "gtn" for
+    /// "get_type_name". Candidates still need to be verified by the caller.
+    /// Returns false if the query is shorter than a trigram and cannot be
+    /// filtered, then all symbols are candidates.
+    bool candidates(this const TrigramIndex& self,
+                    llvm::StringRef query,
+                    llvm::SmallVectorImpl<SymbolHash>& out);
+
+    /// Call `fn(trigram, symbol)` for every posting, loaded and added.
+    void for_each(this const TrigramIndex& self,
+                  llvm::function_ref<void(std::uint32_t, SymbolHash)> fn);
+
+private:
+    /// The loaded ordinals of `trigram`.
+    llvm::ArrayRef<std::uint32_t> loaded(this const TrigramIndex& self, std::uint32_t trigram);
+};
+
+/// Where a symbol is defined, recorded at merge time so that finding a definition
+/// does not search the shards of every file referencing the symbol.
+struct SymbolDefinition {
+    std::uint32_t path_id;
+
+    /// The range of the defined name.
+    LocalSourceRange range;
+
+    /// The range of the whole definition.
+    LocalSourceRange extent;
+};
+
+/// A symbol of the project.  Unlike the symbols of a TUIndex the name is not
+/// owned, it points into the project.idx buffer the index was loaded from, or
+/// into the name arena of the ProjectIndex for symbols merged later.
+struct ProjectSymbol {
+    llvm::StringRef name;
+
+    SymbolKind kind;
+
+    /// All files that referenced this symbol.
+    Bitmap reference_files;
+};
+
+using ProjectSymbolTable = llvm::DenseMap<SymbolHash, ProjectSymbol>;
+
 struct FileInfo {
     std::int64_t mtime;
 };
@@ -78,13 +152,56 @@ struct ProjectIndex {
 
     llvm::DenseMap<std::uint32_t, std::uint32_t> indices;
 
-    SymbolTable symbols;
+    ProjectSymbolTable symbols;
 
+    TrigramIndex trigrams;
+
+    /// The latest merged definition of each symbol.  A merge drops the entry
+    /// of a symbol it references but no longer defines in the recorded file.
+    llvm::DenseMap<SymbolHash, SymbolDefinition> definitions;
+
+    /// Whether the index was loaded from a project.idx written before the
+    /// definitions were recorded.  `definitions` then only covers the TUs merged
+    /// since, a symbol missing from it may still be defined in any shard that
+    /// references it.  The table is not saved until the index is rebuilt.
+    bool partial_definitions = false;
+
+    /// Merge the paths, symbols and definitions of `index`.  Returns the
+    /// project path_id of every path of the TU.
     llvm::SmallVector<std::uint32_t> merge(this ProjectIndex& self, TUIndex& index);
 
+    /// The paths step of merge(): intern the paths of `index`.
+    llvm::SmallVector<std::uint32_t> map_paths(this ProjectIndex& self, const TUIndex& index);
+
+    /// The symbols step of merge(), with `file_ids_map` from map_paths().
+    /// Done separately so the symbols can be published together with the
+    /// shards built from the same TU.
+    void merge_symbols(this ProjectIndex& self,
+                       TUIndex& index,
+                       llvm::ArrayRef<std::uint32_t> file_ids_map);
+
     void serialize(this ProjectIndex& self, llvm::raw_ostream& os);
 
+    /// Deserialize an index, copying the symbol names and trigram postings out
+    /// of `data`.
     static ProjectIndex from(const void* data);
+
+    /// Deserialize an index which keeps `buffer` alive and reads the symbol
+    /// names and trigram postings from it in place.
+    static ProjectIndex from_buffer(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+private:
+    static ProjectIndex from(const void* data, bool copy);
+
+    /// Copy `name` into the name arena.
+    llvm::StringRef save_name(this ProjectIndex& self, llvm::StringRef name);
+
+    /// Storage of the names of symbols merged after loading.
+    llvm::BumpPtrAllocator names;
+
+    /// The serialized index the names and trigram postings of loaded symbols
+    /// point into.
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
 };
 
 }  // namespace clice::index
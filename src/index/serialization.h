@@ -74,6 +74,27 @@ Bitmap read_bitmap(const fbs::Vector<uint8_t>* buffer) {
     return Bitmap::read(reinterpret_cast<const char*>(buffer->data()), false);
 }
 
+/// Append `value` as a LEB128 varint.
+void write_varint(llvm::SmallVectorImpl<std::uint8_t>& out, std::uint64_t value) {
+    while(value >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+/// Read a LEB128 varint and advance `data` past it.
+std::uint64_t read_varint(const std::uint8_t*& data) {
+    std::uint64_t value = 0;
+    for(unsigned shift = 0;; shift += 7) {
+        auto byte = *data++;
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
 }  // namespace
 
 }  // namespace clice::index
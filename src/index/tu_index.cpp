@@ -1,5 +1,8 @@
 #include "index/tu_index.h"
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include <tuple>
 
 #include "index/serialization.h"
@@ -7,6 +10,7 @@
 #include "semantic/semantic_visitor.h"
 
 #include "llvm/Support/SHA256.h"
+#include "llvm/Support/xxhash.h"
 
 namespace clice::index {
 
@@ -159,14 +163,58 @@ private:
 
 }  // namespace
 
-std::array<std::uint8_t, 32> FileIndex::hash() {
+llvm::ArrayRef<Relation> FileIndex::relations_of(SymbolHash symbol, RelationKind kind) const {
+    auto it = relations.find(symbol);
+    if(it == relations.end()) {
+        return {};
+    }
+
+    auto run = std::ranges::equal_range(it->second, kind.value(), {}, [](const Relation& r) {
+        return r.kind.value();
+    });
+    return llvm::ArrayRef(std::to_address(run.begin()), run.size());
+}
+
+std::array<std::uint8_t, 16> FileIndex::hash() {
+    using u8 = std::uint8_t;
+
+    static_assert(sizeof(Occurrence) == sizeof(Range) + sizeof(SymbolHash));
+    static_assert(sizeof(Occurrence) % 8 == 0);
+    static_assert(sizeof(Relation) ==
+                  sizeof(RelationKind) + 4 + sizeof(Range) + sizeof(SymbolHash));
+    static_assert(sizeof(Relation) % 8 == 0);
+
+    // xxh3 has no streaming interface in LLVM.  Instead of copying every array
+    // into one buffer, hash each array in place and then the list of digests.
+    llvm::SmallVector<std::uint64_t, 0> digests;
+    digests.reserve(2 + relations.size() * 3);
+    auto append = [&](const void* bytes, std::size_t count) {
+        auto digest = llvm::xxh3_128bits(llvm::ArrayRef(static_cast<const u8*>(bytes), count));
+        digests.push_back(digest.low64);
+        digests.push_back(digest.high64);
+    };
+
+    append(occurrences.data(), occurrences.size() * sizeof(Occurrence));
+    for(auto& [symbol_id, relations]: relations) {
+        digests.push_back(symbol_id);
+        append(relations.data(), relations.size() * sizeof(Relation));
+    }
+
+    auto hash = llvm::xxh3_128bits(
+        llvm::ArrayRef(reinterpret_cast<const u8*>(digests.data()),
+                       digests.size() * sizeof(std::uint64_t)));
+    std::array<u8, 16> result;
+    std::memcpy(result.data(), &hash.low64, sizeof(hash.low64));
+    std::memcpy(result.data() + sizeof(hash.low64), &hash.high64, sizeof(hash.high64));
+    return result;
+}
+
+std::array<std::uint8_t, 32> FileIndex::legacy_hash() {
     llvm::SHA256 hasher;
 
     using u8 = std::uint8_t;
 
     if(!occurrences.empty()) {
-        static_assert(sizeof(Occurrence) == sizeof(Range) + sizeof(SymbolHash));
-        static_assert(sizeof(Occurrence) % 8 == 0);
         auto data = reinterpret_cast<u8*>(occurrences.data());
         auto size = occurrences.size() * sizeof(Occurrence);
         hasher.update(llvm::ArrayRef(data, size));
@@ -174,10 +222,6 @@ std::array<std::uint8_t, 32> FileIndex::hash() {
 
     for(auto& [symbol_id, relations]: relations) {
         hasher.update(std::bit_cast<std::array<u8, sizeof(symbol_id)>>(symbol_id));
-        static_assert(sizeof(Relation) ==
-                      sizeof(RelationKind) + 4 + sizeof(Range) + sizeof(SymbolHash));
-        static_assert(sizeof(Relation) % 8 == 0);
-
         if(!relations.empty()) {
             auto data = reinterpret_cast<u8*>(relations.data());
             auto size = relations.size() * sizeof(Relation);
@@ -198,7 +242,7 @@ TUIndex TUIndex::build(CompilationUnitRef unit, bool interested_only) {
     return index;
 }
 
-void TUIndex::serialize(llvm::raw_ostream& os) const {
+void TUIndex::serialize(llvm::raw_ostream& os, const BloomFilter* known) const {
     fbs::FlatBufferBuilder builder(4096);
 
     llvm::SmallVector<char, 1024> buffer;
@@ -211,10 +255,14 @@ void TUIndex::serialize(llvm::raw_ostream& os) const {
         buffer.clear();
         buffer.resize_for_overwrite(symbol.reference_files.getSizeInBytes(false));
         symbol.reference_files.write(buffer.data(), false);
+        fbs::Offset<fbs::String> name;
+        if(!known || !known->may_contain(symbol_id)) {
+            name = CreateString(builder, symbol.name);
+        }
         return binary::CreateSymbolEntry(builder,
                                          symbol_id,
                                          binary::CreateSymbol(builder,
-                                                              CreateString(builder, symbol.name),
+                                                              name,
                                                               symbol.kind.value(),
                                                               CreateVector(builder, buffer)));
     });
@@ -272,7 +320,11 @@ TUIndex TUIndex::from(const void* data) {
 
     for(auto entry: *root->symbols()) {
         auto& symbol = index.symbols[entry->symbol_id()];
-        symbol.name = entry->symbol()->name()->str();
+        if(auto name = entry->symbol()->name()) {
+            symbol.name = name->str();
+        } else {
+            index.unnamed.insert(entry->symbol_id());
+        }
         symbol.kind = SymbolKind(static_cast<std::uint8_t>(entry->symbol()->kind()));
         symbol.reference_files = read_bitmap(entry->symbol()->refs());
     }
@@ -11,7 +11,10 @@
 #include "semantic/relation_kind.h"
 #include "semantic/symbol_kind.h"
 #include "support/bitmap.h"
+#include "support/bloom_filter.h"
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace clice::index {
@@ -48,11 +51,22 @@ struct Occurrence {
 };
 
 struct FileIndex {
+    /// The relations of each symbol, sorted by (kind, begin, end, target).
     llvm::DenseMap<SymbolHash, std::vector<Relation>> relations;
 
     std::vector<Occurrence> occurrences;
 
-    std::array<std::uint8_t, 32> hash();
+    /// The relations of `symbol` of the given kind, a contiguous run since
+    /// relations are sorted by kind first.
+    llvm::ArrayRef<Relation> relations_of(SymbolHash symbol, RelationKind kind) const;
+
+    /// The xxh3-128 of all occurrences and relations, used to deduplicate
+    /// identical header contexts in MergedIndex.
+    std::array<std::uint8_t, 16> hash();
+
+    /// The SHA-256 that hash() used to be, only needed to find the entries of
+    /// MergedIndex shards written before the switch.
+    std::array<std::uint8_t, 32> legacy_hash();
 };
 
 struct Symbol {
@@ -85,9 +99,15 @@ struct TUIndex {
 
     FileIndex main_file_index;
 
+    /// Symbols deserialized without a name because the sender was told the
+    /// receiver already knows it.  Their name is empty in `symbols`.
+    llvm::DenseSet<SymbolHash> unnamed;
+
     static TUIndex build(CompilationUnitRef unit, bool interested_only = false);
 
-    void serialize(llvm::raw_ostream& os) const;
+    /// Serialize the index.  The names of symbols in `known` are left out, the
+    /// receiver is expected to have them already.
+    void serialize(llvm::raw_ostream& os, const BloomFilter* known = nullptr) const;
 
     static TUIndex from(const void* data);
 };
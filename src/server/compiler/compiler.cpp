@@ -1,10 +1,12 @@
 #include "server/compiler/compiler.h"
 
+#include <chrono>
 #include <format>
 #include <ranges>
 #include <string>
 
 #include "command/search_config.h"
+#include "index/interval_tree.h"
 #include "index/tu_index.h"
 #include "server/protocol/worker.h"
 #include "support/filesystem.h"
@@ -31,13 +33,20 @@ Compiler::Compiler(kota::event_loop& loop,
                    Workspace& workspace,
                    WorkerPool& pool,
                    llvm::DenseMap<std::uint32_t, Session>& sessions) :
-    loop(loop), workspace(workspace), pool(pool), sessions(sessions) {}
+    loop(loop), workspace(workspace), pool(pool), sessions(sessions),
+    prebuilder(
+        loop,
+        [this](std::uint32_t path_id) { return wait_compiles(path_id); },
+        [this](std::uint32_t path_id, std::uint64_t preamble) {
+            return prebuild_pch(path_id, preamble);
+        }) {}
 
 Compiler::~Compiler() {
     workspace.cancel_all();
 }
 
 kota::task<> Compiler::stop() {
+    co_await prebuilder.stop();
     compile_tasks.cancel();
     co_await compile_tasks.join();
 }
@@ -439,90 +448,303 @@ void Compiler::clear_diagnostics(const std::string& uri) {
     peer->send_notification(params);
 }
 
+bool Compiler::pch_fresh(std::uint64_t key) {
+    // A PCH is only as fresh as the PCHs it is chained on, and only while they
+    // are the builds it was chained on.
+    auto& cache = workspace.pch_cache;
+    while(key != 0) {
+        auto* st = cache.find(key);
+        if(!st || st->building || st->path.empty() || !cache.base_current(*st) ||
+           deps_changed(workspace.path_pool, st->deps))
+            return false;
+        key = st->base;
+    }
+    return true;
+}
+
+/// The key of the PCH of `preamble`, and where and on which PCH it is chained.
+struct PCHChain {
+    std::uint32_t split = 0;
+    std::uint64_t base = 0;
+    std::uint64_t key = 0;
+};
+
+static PCHChain pch_chain(const std::string& preamble,
+                          const std::string& directory,
+                          const std::vector<std::string>& arguments) {
+    // Split off the leading system includes as a PCH of their own.  It is
+    // shared by every file starting with the same includes, and editing the
+    // project includes after them only rebuilds the PCH chained on it.
+    PCHChain chain;
+    chain.split = compute_preamble_split(preamble, preamble.size());
+    if(chain.split != 0) {
+        chain.base = PCHCache::key(llvm::StringRef(preamble).substr(0, chain.split),
+                                   directory,
+                                   arguments);
+    }
+
+    // The key covers the preamble text and the flags that compile it, but not
+    // the source file, so files with the same preamble and flags share a PCH.
+    chain.key = PCHCache::key(preamble, directory, arguments, chain.base);
+    return chain;
+}
+
 kota::task<bool> Compiler::ensure_pch(Session& session,
                                       const std::string& directory,
                                       const std::vector<std::string>& arguments) {
     auto path_id = session.path_id;
     auto path = workspace.path_pool.resolve(path_id);
     auto& text = session.text;
+    auto& cache = workspace.pch_cache;
     auto bound = compute_preamble_bound(text);
     if(bound == 0) {
-        // No preamble directives — PCH would be empty. Clear any stale entry.
-        workspace.pch_cache.erase(path_id);
+        // No preamble directives — PCH would be empty. Drop any stale reference.
+        cache.release(path_id);
         session.pch_ref.reset();
         co_return true;
     }
 
-    // FIXME: hash should also include compile flags that affect preprocessing
-    // (e.g. -D, -I, -isystem, -std) so that files with the same preamble text
-    // but different flags produce separate PCHs.  Currently only the preamble
-    // text is hashed — the source file path must be excluded from the hash
-    // to allow sharing across files with identical preambles.
-    auto preamble_text = llvm::StringRef(text).substr(0, bound);
-    auto preamble_hash = llvm::xxh3_64bits(preamble_text);
+    // The preamble is copied, the session text may change while PCHs build.
+    auto preamble = text.substr(0, bound);
+    auto key = pch_chain(preamble, directory, arguments).key;
 
-    // Deterministic content-addressed PCH path.
-    auto pch_path = path::join(workspace.config.project.cache_dir,
-                               "cache",
-                               "pch",
-                               std::format("{:016x}.pch", preamble_hash));
-
-    // Reuse existing PCH if preamble content and deps haven't changed.
-    if(auto it = workspace.pch_cache.find(path_id); it != workspace.pch_cache.end()) {
-        auto& st = it->second;
-        if(st.hash == preamble_hash && !st.path.empty() &&
-           !deps_changed(workspace.path_pool, st.deps)) {
-            st.bound = bound;
-            session.pch_ref = Session::PCHRef{path_id, preamble_hash, bound};
-            co_return true;
-        }
+    auto use = [&]() {
+        auto* st = cache.find(key);
+        if(!st || st->path.empty())
+            return false;
+        cache.acquire(path_id, key);
+        session.pch_ref = Session::PCHRef{key, st->bound};
+        return true;
+    };
+
+    // Reuse existing PCH if preamble content, flags and deps haven't changed.
+    if(pch_fresh(key)) {
+        co_return use();
     }
 
     // Preamble incomplete (user still typing) — defer rebuild, reuse old PCH if available.
     if(!is_preamble_complete(text, bound)) {
         LOG_DEBUG("Preamble incomplete for {}, deferring PCH rebuild", path);
-        co_return workspace.pch_cache.count(path_id) && !workspace.pch_cache[path_id].path.empty();
+        auto* old = session.pch_ref ? cache.find(session.pch_ref->hash) : nullptr;
+        co_return old && !old->path.empty();
     }
 
-    // If another coroutine is already building PCH for this file, wait for it.
-    if(auto it = workspace.pch_cache.find(path_id);
-       it != workspace.pch_cache.end() && it->second.building) {
-        co_await it->second.building->wait();
-        if(auto it2 = workspace.pch_cache.find(path_id); it2 != workspace.pch_cache.end()) {
-            session.pch_ref = Session::PCHRef{path_id, it2->second.hash, it2->second.bound};
-        }
-        co_return workspace.pch_cache.count(path_id) && !workspace.pch_cache[path_id].path.empty();
+    key = co_await build_pch(path_id, preamble, directory, arguments);
+    if(key == 0 || !use()) {
+        co_return false;
+    }
+
+    // Make room for new PCHs among the ones no open file uses.
+    if(auto evicted = cache.evict(workspace.config.project.pch_cache_limit)) {
+        LOG_INFO("Evicted {} PCHs, {} bytes left", evicted, cache.disk_bytes());
+    }
+
+    // Persist cache metadata after successful build.
+    workspace.save_cache();
+    co_return true;
+}
+
+kota::task<std::uint64_t> Compiler::build_pch(std::uint32_t path_id,
+                                              const std::string& preamble,
+                                              const std::string& directory,
+                                              const std::vector<std::string>& arguments,
+                                              std::function<bool()> wanted) {
+    auto bound = static_cast<std::uint32_t>(preamble.size());
+    auto [split, base, key] = pch_chain(preamble, directory, arguments);
+    bool background = static_cast<bool>(wanted);
+
+    if(base != 0 && !co_await ensure_pch_link(path_id,
+                                              preamble,
+                                              split,
+                                              directory,
+                                              arguments,
+                                              /*base=*/0,
+                                              /*base_bound=*/0,
+                                              background)) {
+        // Fall back to a single PCH of the whole preamble.
+        LOG_DEBUG("Building unchained PCH for {}", workspace.path_pool.resolve(path_id));
+        base = 0;
+        split = 0;
+        key = PCHCache::key(preamble, directory, arguments);
+    }
+
+    // The first link is shared by other files, a build no longer wanted stops
+    // after it.
+    if(wanted && !wanted()) {
+        co_return 0;
+    }
+
+    if(!co_await ensure_pch_link(path_id,
+                                 preamble,
+                                 bound,
+                                 directory,
+                                 arguments,
+                                 base,
+                                 split,
+                                 background)) {
+        co_return 0;
+    }
+    co_return key;
+}
+
+void Compiler::schedule_pch_prebuild(Session& session) {
+    auto delay = *workspace.config.project.pch_prebuild_delay_ms;
+    if(delay < 0)
+        return;
+
+    // Only a complete preamble is worth building.
+    auto bound = compute_preamble_bound(session.text);
+    std::uint64_t preamble = 0;
+    if(bound != 0 && is_preamble_complete(session.text, bound)) {
+        preamble = llvm::xxh3_64bits(llvm::StringRef(session.text).substr(0, bound));
+    }
+    prebuilder.schedule(session.path_id, preamble, delay);
+}
+
+void Compiler::cancel_pch_prebuild(std::uint32_t path_id) {
+    prebuilder.cancel(path_id);
+}
+
+kota::task<> Compiler::wait_compiles(std::uint32_t path_id) {
+    // A compile in flight builds the PCH itself, the prebuild then finds it fresh.
+    while(true) {
+        auto it = sessions.find(path_id);
+        if(it == sessions.end() || !it->second.compiling)
+            co_return;
+        auto pending = it->second.compiling;
+        co_await pending->done.wait();
+    }
+}
+
+kota::task<> Compiler::prebuild_pch(std::uint32_t path_id, std::uint64_t preamble) {
+    auto it = sessions.find(path_id);
+    if(it == sessions.end())
+        co_return;
+    auto& session = it->second;
+
+    auto path = std::string(workspace.path_pool.resolve(path_id));
+    std::string directory;
+    std::vector<std::string> arguments;
+    if(!fill_compile_args(path, directory, arguments, &session))
+        co_return;
+
+    auto bound = compute_preamble_bound(session.text);
+    auto text = session.text.substr(0, bound);
+    auto key = pch_chain(text, directory, arguments).key;
+    auto wanted = [this, path_id, preamble] {
+        return prebuilder.current(path_id, preamble);
+    };
+
+    if(!pch_fresh(key)) {
+        LOG_DEBUG("Prebuilding PCH for {}", path);
+        if(co_await build_pch(path_id, text, directory, arguments, wanted) == 0)
+            co_return;
+    }
+
+    // Keep the PCH for the next compile of the file, which uses it.  Until
+    // then no open file holds a reference and it could be evicted.
+    if(!wanted() || !sessions.contains(path_id))
+        co_return;
+    workspace.pch_cache.reserve(path_id, key);
+
+    if(auto evicted = workspace.pch_cache.evict(workspace.config.project.pch_cache_limit)) {
+        LOG_INFO("Evicted {} PCHs, {} bytes left", evicted, workspace.pch_cache.disk_bytes());
+    }
+    workspace.save_cache();
+}
+
+/// Join two pre-serialized DocumentLink[] arrays.
+static std::string join_links(llvm::StringRef first, llvm::StringRef second) {
+    if(first.size() <= 2)
+        return second.str();
+    if(second.size() <= 2)
+        return first.str();
+    std::string joined = first.drop_back().str();
+    joined += ',';
+    joined.append(second.drop_front().begin(), second.end());
+    return joined;
+}
+
+kota::task<bool> Compiler::ensure_pch_link(std::uint32_t path_id,
+                                           const std::string& preamble,
+                                           std::uint32_t bound,
+                                           const std::string& directory,
+                                           const std::vector<std::string>& arguments,
+                                           std::uint64_t base,
+                                           std::uint32_t base_bound,
+                                           bool background) {
+    auto path = workspace.path_pool.resolve(path_id);
+    auto& cache = workspace.pch_cache;
+    auto key = PCHCache::key(llvm::StringRef(preamble).substr(0, bound),
+                             directory,
+                             arguments,
+                             base);
+
+    if(pch_fresh(key)) {
+        co_return true;
+    }
+
+    // If another coroutine is already building this PCH, for this file or
+    // another one with the same preamble and flags, wait for it.
+    if(auto* st = cache.find(key); st && st->building) {
+        auto building = st->building;
+        co_await building->wait();
+        auto* built = cache.find(key);
+        co_return built && !built->path.empty();
     }
 
     // Register in-flight build so concurrent requests wait on us.
     auto completion = std::make_shared<kota::event>();
-    workspace.pch_cache[path_id].building = completion;
+    cache.get(key).building = completion;
+
+    auto fail = [&]() {
+        if(auto* st = cache.find(key)) {
+            st->building.reset();
+            if(st->path.empty()) {
+                cache.erase(key);
+            }
+        }
+        completion->set();
+        return false;
+    };
 
     if(workspace.config.project.cache_dir.empty()) {
         LOG_WARN("PCH build skipped: cache_dir is not configured");
-        workspace.pch_cache[path_id].building.reset();
-        completion->set();
-        co_return false;
+        co_return fail();
     }
 
     // Ensure the PCH cache directory exists.
     auto pch_dir = path::join(workspace.config.project.cache_dir, "cache", "pch");
     if(auto ec = llvm::sys::fs::create_directories(pch_dir)) {
         LOG_WARN("Cannot create PCH cache dir {}: {}", pch_dir, ec.message());
-        workspace.pch_cache[path_id].building.reset();
-        completion->set();
-        co_return false;
+        co_return fail();
     }
 
+    // Deterministic content-addressed PCH path.
+    auto pch_path = path::join(pch_dir, std::format("{:016x}.pch", key));
+
     // Build a new PCH via stateless worker.
     worker::BuildParams bp;
     bp.kind = worker::BuildKind::BuildPCH;
     bp.file = std::string(path);
     bp.directory = directory;
     bp.arguments = arguments;
-    bp.text = text;
+    bp.text = preamble;
     bp.preamble_bound = bound;
     bp.output_path = pch_path;
+    bp.background = background;
+
+    // The build the PCH is chained on, if the base is rebuilt meanwhile the
+    // result is stale right away.
+    std::uint64_t base_generation = 0;
+    if(base != 0) {
+        auto* st = cache.find(base);
+        if(!st || st->path.empty()) {
+            co_return fail();
+        }
+        base_generation = st->generation;
+        bp.pch = {st->path, base_bound};
+    }
 
     LOG_DEBUG("Building PCH for {}, bound={}, output={}", path, bound, pch_path);
 
@@ -532,26 +754,34 @@ kota::task<bool> Compiler::ensure_pch(Session& session,
         LOG_WARN("PCH build failed for {}: {}",
                  path,
                  result.has_value() ? result.value().error : result.error().message);
-        workspace.pch_cache[path_id].building.reset();
-        completion->set();
-        co_return false;
+        co_return fail();
+    }
+
+    // The links of the first link cover the directives before `base_bound`.
+    std::string links = std::move(result.value().pch_links_json);
+    if(base != 0) {
+        if(auto* st = cache.find(base)) {
+            links = join_links(st->document_links_json, links);
+        }
     }
 
-    auto& st = workspace.pch_cache[path_id];
+    auto& st = cache.get(key);
     st.path = result.value().output_path;
     st.bound = bound;
-    st.hash = preamble_hash;
+    st.base = base;
+    st.generation = cache.next_generation();
+    st.base_generation = base_generation;
+    st.source = path_id;
     st.deps = capture_deps_snapshot(workspace.path_pool, result.value().deps);
-    st.document_links_json = std::move(result.value().pch_links_json);
+    st.document_links_json = std::move(links);
     st.building.reset();
 
-    session.pch_ref = Session::PCHRef{path_id, preamble_hash, bound};
+    std::uint64_t size = 0;
+    llvm::sys::fs::file_size(st.path, size);
+    cache.set_size(key, size);
 
     LOG_INFO("PCH built for {}: {}", path, result.value().output_path);
 
-    // Persist cache metadata after successful build.
-    workspace.save_cache();
-
     completion->set();
     co_return true;
 }
@@ -600,9 +830,9 @@ kota::task<bool> Compiler::ensure_deps(Session& session,
 
     // Build or reuse PCH.
     auto pch_ok = co_await ensure_pch(session, directory, arguments);
-    if(pch_ok) {
-        if(auto pch_it = workspace.pch_cache.find(path_id); pch_it != workspace.pch_cache.end()) {
-            pch = {pch_it->second.path, pch_it->second.bound};
+    if(pch_ok && session.pch_ref) {
+        if(auto* st = workspace.pch_cache.find(session.pch_ref->hash)) {
+            pch = {st->path, st->bound};
         }
     }
 
@@ -617,12 +847,15 @@ bool Compiler::is_stale(const Session& session) {
     if(session.ast_deps.has_value() && deps_changed(workspace.path_pool, *session.ast_deps))
         return true;
 
-    // Check PCH staleness via the session's pch_ref.
-    if(session.pch_ref.has_value()) {
-        auto pch_it = workspace.pch_cache.find(session.pch_ref->path_id);
-        if(pch_it != workspace.pch_cache.end() &&
-           deps_changed(workspace.path_pool, pch_it->second.deps))
+    // Check PCH staleness via the session's pch_ref and the PCHs it is chained on.
+    auto key = session.pch_ref ? session.pch_ref->hash : 0;
+    while(key != 0) {
+        auto* st = workspace.pch_cache.find(key);
+        if(!st)
+            break;
+        if(!workspace.pch_cache.base_current(*st) || deps_changed(workspace.path_pool, st->deps))
             return true;
+        key = st->base;
     }
 
     return false;
@@ -665,10 +898,15 @@ kota::task<> Compiler::run_compile(std::uint32_t pid, std::shared_ptr<Session::P
     auto uri = lsp::URI::from_file_path(file_path);
     std::string uri_str = uri.has_value() ? uri->str() : file_path;
 
+    // The worker already holds the text if the edits since the last compile
+    // were forwarded to it.
     worker::CompileParams params;
     params.path = file_path;
     params.version = sess->version;
-    params.text = sess->text;
+    params.incremental = sess->synced_version == sess->version;
+    if(!params.incremental) {
+        params.text = sess->text;
+    }
     if(!fill_compile_args(file_path, params.directory, params.arguments, sess)) {
         finish_compile();
         co_return;
@@ -694,6 +932,28 @@ kota::task<> Compiler::run_compile(std::uint32_t pid, std::shared_ptr<Session::P
         co_return;
     }
 
+    // The worker lost its copy (evicted, restarted, or an edit did not
+    // apply), resync it with the full text of the compiled version.
+    if(result.has_value() && result.value().need_text && sess->generation == gen) {
+        LOG_INFO("ensure_compiled: resending full text for {}", uri_str);
+        params.incremental = false;
+        params.text = sess->text;
+        result = co_await pool.send_stateful(pid, params);
+
+        sess = find_session();
+        if(!sess) {
+            pc->done.set();
+            co_return;
+        }
+    }
+
+    if(result.has_value() && !result.value().need_text) {
+        pool.update_memory(pid, result.value().memory_usage);
+        if(sess->version == params.version) {
+            sess->synced_version = params.version;
+        }
+    }
+
     if(sess->generation != gen) {
         LOG_INFO("ensure_compiled: generation mismatch ({} vs {}) for {}",
                  sess->generation,
@@ -721,6 +981,9 @@ kota::task<> Compiler::run_compile(std::uint32_t pid, std::shared_ptr<Session::P
         ofi.symbols = std::move(tu_index.symbols);
         ofi.content = sess->text;
         ofi.mapper.emplace(ofi.content, lsp::PositionEncoding::UTF16);
+        ofi.occurrence_max_ends = index::build_interval_tree(
+            ofi.file_index.occurrences.size(),
+            [&](std::uint32_t i) { return ofi.file_index.occurrences[i].range.end; });
         sess->file_index = std::move(ofi);
     }
 
@@ -736,7 +999,8 @@ kota::task<> Compiler::run_compile(std::uint32_t pid, std::shared_ptr<Session::P
 ///
 /// Lifecycle overview (pull-based model):
 ///
-///   didOpen / didChange          – only update Session, mark ast_dirty
+///   didOpen / didChange          – only update Session, mark ast_dirty, and
+///                                  prebuild the PCH once the preamble settles
 ///   didSave                      – mark dependents dirty, queue indexing
 ///   feature request arrives      – calls ensure_compiled() first
 ///     1. Fast-path exit if AST is already clean (!ast_dirty).
@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "command/command.h"
+#include "server/compiler/pch_prebuilder.h"
 #include "server/service/session.h"
 #include "server/worker/worker_pool.h"
 #include "server/workspace/workspace.h"
@@ -73,6 +74,14 @@ public:
     /// file_index, pch_ref, ast_deps, and publishes diagnostics.
     kota::task<bool> ensure_compiled(Session& session);
 
+    /// Called on every edit.  Once the session's preamble is complete and
+    /// unchanged for `pch_prebuild_delay_ms`, build its PCH in the background
+    /// so the next compile does not have to wait for it.
+    void schedule_pch_prebuild(Session& session);
+
+    /// Supersede the PCH prebuild of a file, e.g. when it is closed.
+    void cancel_pch_prebuild(std::uint32_t path_id);
+
     using RawResult = kota::task<kota::codec::RawValue, kota::ipc::Error>;
 
     /// Forward a query to the stateful worker that holds this file's AST.
@@ -119,6 +128,38 @@ private:
                                 const std::string& directory,
                                 const std::vector<std::string>& arguments);
 
+    /// Build or reuse the PCHs of `preamble`.  Returns the key of the last
+    /// link, or 0 on failure or if `wanted` returns false between the links.
+    /// A build with `wanted` is speculative and runs at background priority.
+    kota::task<std::uint64_t> build_pch(std::uint32_t path_id,
+                                        const std::string& preamble,
+                                        const std::string& directory,
+                                        const std::vector<std::string>& arguments,
+                                        std::function<bool()> wanted = {});
+
+    /// Wait until no compile of the file is in flight.
+    kota::task<> wait_compiles(std::uint32_t path_id);
+
+    /// Build the PCH of the session's preamble `preamble` for `prebuilder` and
+    /// reserve it for the file's next compile.
+    kota::task<> prebuild_pch(std::uint32_t path_id, std::uint64_t preamble);
+
+    /// Build or reuse the PCH of `preamble` up to `bound`, chained on the PCH
+    /// `base` of the preamble up to `base_bound` if `base` is not 0.  A
+    /// `background` build runs at low priority in the worker.
+    kota::task<bool> ensure_pch_link(std::uint32_t path_id,
+                                     const std::string& preamble,
+                                     std::uint32_t bound,
+                                     const std::string& directory,
+                                     const std::vector<std::string>& arguments,
+                                     std::uint64_t base = 0,
+                                     std::uint32_t base_bound = 0,
+                                     bool background = false);
+
+    /// Whether the PCH `key` and the PCHs it is chained on are built and
+    /// their dependencies unchanged.
+    bool pch_fresh(std::uint64_t key);
+
     bool is_stale(const Session& session);
     void record_deps(Session& session, llvm::ArrayRef<std::string> deps);
 
@@ -142,6 +183,7 @@ private:
     WorkerPool& pool;
     llvm::DenseMap<std::uint32_t, Session>& sessions;
     kota::task_group<> compile_tasks{loop};
+    PCHPrebuilder prebuilder;
 };
 
 }  // namespace clice
@@ -1,6 +1,7 @@
 #include "server/compiler/indexer.h"
 
 #include <algorithm>
+#include <chrono>
 #include <string>
 #include <variant>
 #include <vector>
@@ -10,7 +11,11 @@
 #include "server/protocol/worker.h"
 #include "server/service/session.h"
 #include "server/worker/worker_pool.h"
+#include "server/workspace/position_batch.h"
+#include "server/workspace/shard_pack.h"
+#include "support/bloom_filter.h"
 #include "support/filesystem.h"
+#include "support/fuzzy_matcher.h"
 #include "support/logging.h"
 
 #include "kota/ipc/lsp/position.h"
@@ -18,6 +23,7 @@
 #include "kota/ipc/lsp/uri.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Parallel.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -25,41 +31,295 @@ namespace clice {
 
 namespace lsp = kota::ipc::lsp;
 
+/// Write an index file through a temporary file, so a crash never leaves a
+/// partially written index behind.
+static bool write_index_file(const std::string& path,
+                             llvm::function_ref<void(llvm::raw_ostream&)> write) {
+    auto tmp_path = path + ".tmp";
+    {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(tmp_path, ec);
+        if(ec) {
+            LOG_WARN("Failed to write {}: {}", tmp_path, ec.message());
+            return false;
+        }
+        write(os);
+        os.close();
+        if(os.has_error()) {
+            LOG_WARN("Failed to write {}: {}", tmp_path, os.error().message());
+            os.clear_error();
+            return false;
+        }
+    }
+    auto rename_result = fs::rename(tmp_path, path);
+    if(!rename_result) {
+        LOG_WARN("Failed to rename {}: {}", tmp_path, rename_result.error().message());
+        return false;
+    }
+    return true;
+}
+
+/// Take a full save once the journal holds this many bytes, which bounds the
+/// replay work after a crash.
+constexpr std::uint64_t journal_checkpoint_bytes = 256ULL * 1024 * 1024;
+
+/// Serialized shards appended to the shard pack at once, which bounds the
+/// memory of a save while keeping directory rewrites rare.
+constexpr std::size_t pack_append_bytes = 64ULL * 1024 * 1024;
+
+/// The longest merged results stay unpublished while more keep arriving.
+constexpr auto publish_interval = std::chrono::seconds(2);
+
+/// Shards compacted per batch, so a merge arriving meanwhile waits little.
+constexpr std::size_t compaction_batch_size = 8;
+
+/// Shards scanned per batch of streamed query results.
+constexpr std::size_t stream_batch_size = 32;
+
+struct Indexer::PendingMerge {
+    index::TUIndex tu_index;
+
+    /// Journal sequence number of the record, see QueuedMerge.
+    std::uint64_t sequence = 0;
+
+    /// Project-level path_ids of the TU path_ids.
+    llvm::SmallVector<std::uint32_t> file_ids;
+
+    struct ShardMerge {
+        std::uint32_t tu_path_id;
+        std::uint32_t path_id;
+        /// Set for a header context, unset for the main file.
+        std::optional<std::uint32_t> include_id;
+        index::FileIndex* file_index;
+    };
+
+    std::vector<ShardMerge> shards;
+};
+
 void Indexer::merge(const void* tu_index_data, std::size_t size) {
-    auto tu_index = index::TUIndex::from(tu_index_data);
-    if(tu_index.graph.paths.empty()) {
-        LOG_WARN("Ignoring TUIndex with empty path graph");
-        return;
+    auto sequence = journal.append(tu_index_data, size);
+    if(sequence != 0) {
+        unpublished_records.insert(sequence);
     }
-    auto file_ids_map = workspace.project_index.merge(tu_index);
-    auto main_tu_path_id = static_cast<std::uint32_t>(tu_index.graph.paths.size() - 1);
+    merge_queue.push_back({sequence, std::string(static_cast<const char*>(tu_index_data), size)});
 
-    auto merge_file_index = [&](std::uint32_t tu_path_id, index::FileIndex& file_idx) {
-        auto global_path_id = file_ids_map[tu_path_id];
-        auto& shard = workspace.merged_indices[global_path_id];
+    if(!merging && !stopping) {
+        merging = true;
+        if(!merge_tasks.spawn(run_merges())) {
+            merging = false;
+            LOG_WARN("Failed to spawn index merge task (task group stopped)");
+        }
+    }
+}
 
-        if(tu_path_id == main_tu_path_id) {
-            std::vector<index::IncludeLocation> include_locs;
-            for(auto& loc: tu_index.graph.locations) {
-                index::IncludeLocation remapped = loc;
-                remapped.path_id = file_ids_map[loc.path_id];
-                include_locs.push_back(remapped);
+kota::task<> Indexer::run_merges() {
+    // Merged TUs whose shards are not published yet.  While more results keep
+    // arriving, publication is deferred for up to `publish_interval`, so a hot
+    // shard is serialized once for several batches instead of after each.
+    std::vector<PendingMerge> unpublished;
+    llvm::DenseSet<std::uint32_t> touched;
+    auto deferred_since = std::chrono::steady_clock::now();
+
+    while(!stopping) {
+        if(merge_queue.empty()) {
+            if(!unpublished.empty()) {
+                if(!co_await publish_merges(unpublished, touched))
+                    break;
+                continue;
             }
-            auto file_path = workspace.project_index.path_pool.path(global_path_id);
-            llvm::StringRef file_content;
-            std::string file_content_storage;
-            auto buf = llvm::MemoryBuffer::getFile(file_path);
-            if(buf) {
-                file_content_storage = (*buf)->getBuffer().str();
-                file_content = file_content_storage;
+            if(indexing_active || compaction_candidates.empty())
+                break;
+            co_await compact_shards();
+            continue;
+        }
+
+        auto batch = std::move(merge_queue);
+        merge_queue.clear();
+
+        // Decoding only touches the batch, do it on the merge thread.
+        auto decoded = co_await kota::queue(
+            [&]() {
+                std::vector<PendingMerge> merges;
+                merges.reserve(batch.size());
+                for(auto& queued: batch) {
+                    auto& merge =
+                        merges.emplace_back(PendingMerge{index::TUIndex::from(queued.data.data())});
+                    merge.sequence = queued.sequence;
+                }
+                return merges;
+            },
+            loop);
+        if(!decoded.has_value()) {
+            // The records stay unpublished, the next session replays them.
+            LOG_WARN("Failed to decode TUIndex batch: {}", decoded.error().message());
+            continue;
+        }
+
+        // Paths are read by queries, they are interned here.
+        auto& merges = decoded.value();
+        for(auto& merge: merges) {
+            claim(merge);
+        }
+
+        auto merged = co_await kota::queue(
+            [&]() {
+                for(auto& merge: merges) {
+                    merge_shards(merge, touched);
+                }
+                return merges.size();
+            },
+            loop);
+        if(!merged.has_value()) {
+            LOG_WARN("Failed to merge TUIndex batch: {}", merged.error().message());
+        }
+
+        // The shard merges point into the TUIndex, they are done with.
+        auto now = std::chrono::steady_clock::now();
+        if(unpublished.empty()) {
+            deferred_since = now;
+        }
+        for(auto& merge: merges) {
+            merge.shards.clear();
+            unpublished.push_back(std::move(merge));
+        }
+
+        if(merge_queue.empty() || now - deferred_since >= publish_interval) {
+            co_await publish_merges(unpublished, touched);
+        }
+    }
+
+    // Merged data must be published before a save checkpoints the journal.
+    if(!unpublished.empty()) {
+        co_await publish_merges(unpublished, touched);
+    }
+    merging = false;
+
+    if(journal.size() >= journal_checkpoint_bytes) {
+        LOG_INFO("Index journal reached {} bytes, saving", journal.size());
+        save_requested = true;
+    }
+    if(save_requested) {
+        save_requested = false;
+        save(workspace.config.project.index_dir);
+    }
+}
+
+kota::task<bool> Indexer::publish_merges(std::vector<PendingMerge>& merges,
+                                         llvm::DenseSet<std::uint32_t>& touched) {
+    auto snapshots = co_await kota::queue([&]() { return take_snapshots(touched); }, loop);
+    if(!snapshots.has_value()) {
+        // The writers keep the merged data, it goes out with the next batch.
+        LOG_WARN("Failed to snapshot index shards: {}", snapshots.error().message());
+        co_return false;
+    }
+
+    // The symbols and the shards they reference become visible together.
+    for(auto& merge: merges) {
+        if(!merge.file_ids.empty()) {
+            merge_symbols(merge);
+        }
+        unpublished_records.erase(merge.sequence);
+    }
+
+    // Cached query results over these shards are stale from now on.
+    index_epoch += 1;
+    for(auto& snapshot: snapshots.value()) {
+        shard_epochs[snapshot.path_id] = index_epoch;
+    }
+
+    publish(snapshots.value());
+    LOG_INFO("Merged {} TUIndex records into {} shards ({} total)",
+             merges.size(),
+             snapshots.value().size(),
+             workspace.merged_indices.size());
+    merges.clear();
+    touched.clear();
+
+    enforce_memory_limit();
+    co_return true;
+}
+
+void Indexer::compact() {
+    if(merging || stopping || compaction_candidates.empty())
+        return;
+    merging = true;
+    if(!merge_tasks.spawn(run_merges())) {
+        merging = false;
+        LOG_WARN("Failed to spawn index compaction task (task group stopped)");
+    }
+}
+
+kota::task<> Indexer::compact_shards() {
+    struct Compaction {
+        std::uint32_t path_id;
+        std::uint64_t removed_contexts;
+        std::size_t reclaimed = 0;
+    };
+
+    std::vector<Compaction> batch;
+    for(auto path_id: compaction_candidates) {
+        if(batch.size() == compaction_batch_size)
+            break;
+        batch.push_back({path_id, 0});
+    }
+    for(auto& compaction: batch) {
+        compaction_candidates.erase(compaction.path_id);
+    }
+    std::erase_if(batch, [&](Compaction& compaction) {
+        auto shard_it = workspace.merged_indices.find(compaction.path_id);
+        if(shard_it == workspace.merged_indices.end())
+            return true;
+        compaction.removed_contexts = shard_it->second.index.removed_contexts();
+        if(!writers.contains(compaction.path_id)) {
+            writers[compaction.path_id].index = shard_it->second.index.fork();
+        }
+        return false;
+    });
+
+    auto snapshots = co_await kota::queue(
+        [&]() {
+            llvm::DenseSet<std::uint32_t> touched;
+            for(auto& compaction: batch) {
+                compaction.reclaimed = writers.find(compaction.path_id)->second.index.compact();
+                touched.insert(compaction.path_id);
             }
-            shard.index.merge(global_path_id,
-                              tu_index.built_at,
-                              std::move(include_locs),
-                              file_idx,
-                              file_content);
-        } else {
-            std::optional<std::uint32_t> include_id;
+            return take_snapshots(touched);
+        },
+        loop);
+    if(!snapshots.has_value()) {
+        LOG_WARN("Failed to compact index shards: {}", snapshots.error().message());
+        co_return;
+    }
+
+    publish(snapshots.value());
+    for(auto& compaction: batch) {
+        LOG_INFO("Compacted shard {}: {} removed contexts, {} bytes reclaimed",
+                 compaction.path_id,
+                 compaction.removed_contexts,
+                 compaction.reclaimed);
+        shard_memory.compacted += 1;
+        shard_memory.reclaimed_bytes += compaction.reclaimed;
+    }
+
+    // Write the smaller shards back with the next save.
+    save_requested = true;
+    enforce_memory_limit();
+}
+
+bool Indexer::claim(PendingMerge& merge) {
+    auto& tu_index = merge.tu_index;
+    if(tu_index.graph.paths.empty()) {
+        LOG_WARN("Ignoring TUIndex with empty path graph");
+        return false;
+    }
+    // Only the paths are interned here, the symbols are merged when the shards
+    // are published, so queries never see references into shards without them.
+    merge.file_ids = workspace.project_index.map_paths(tu_index);
+    auto main_tu_path_id = static_cast<std::uint32_t>(tu_index.graph.paths.size() - 1);
+
+    auto add_shard = [&](std::uint32_t tu_path_id, index::FileIndex& file_index) {
+        std::optional<std::uint32_t> include_id;
+        if(tu_path_id != main_tu_path_id) {
             for(std::uint32_t i = 0; i < tu_index.graph.locations.size(); ++i) {
                 if(tu_index.graph.locations[i].path_id == tu_path_id) {
                     include_id = i;
@@ -67,88 +327,364 @@ void Indexer::merge(const void* tu_index_data, std::size_t size) {
                 }
             }
             if(!include_id) {
-                LOG_WARN("Skip merge for path {}: include location not found", global_path_id);
+                LOG_WARN("Skip merge for path {}: include location not found",
+                         merge.file_ids[tu_path_id]);
                 return;
             }
-            auto header_path = workspace.project_index.path_pool.path(global_path_id);
-            llvm::StringRef header_content;
-            std::string header_content_storage;
-            auto header_buf = llvm::MemoryBuffer::getFile(header_path);
-            if(header_buf) {
-                header_content_storage = (*header_buf)->getBuffer().str();
-                header_content = header_content_storage;
+        }
+
+        auto path_id = merge.file_ids[tu_path_id];
+        if(!writers.contains(path_id)) {
+            auto shard_it = workspace.merged_indices.find(path_id);
+            auto& writer = writers[path_id];
+            if(shard_it != workspace.merged_indices.end()) {
+                writer.index = shard_it->second.index.fork();
             }
-            shard.index.merge(global_path_id, *include_id, file_idx, header_content);
         }
+        merge.shards.push_back({tu_path_id, path_id, include_id, &file_index});
+    };
+
+    for(auto& [tu_path_id, file_index]: tu_index.path_file_indices) {
+        add_shard(tu_path_id, file_index);
+    }
+    add_shard(main_tu_path_id, tu_index.main_file_index);
+    return true;
+}
+
+void Indexer::merge_symbols(PendingMerge& merge) {
+    auto& tu_index = merge.tu_index;
+    workspace.project_index.merge_symbols(tu_index, merge.file_ids);
+
+    // A false positive of the known-symbol filter left out a name the project
+    // does not have, the worker has to send the file again with all names.
+    auto& symbols = workspace.project_index.symbols;
+    for(auto hash: tu_index.unnamed) {
+        auto it = symbols.find(hash);
+        if(it == symbols.end() || it->second.name.empty()) {
+            auto server_path_id = workspace.path_pool.intern(tu_index.graph.paths.back());
+            if(name_retries.insert(server_path_id).second) {
+                LOG_DEBUG("Missing symbol names from {}, indexing it again",
+                          tu_index.graph.paths.back());
+                enqueue(server_path_id);
+                schedule();
+            }
+            break;
+        }
+    }
+}
+
+void Indexer::merge_shards(PendingMerge& merge, llvm::DenseSet<std::uint32_t>& touched) {
+    auto& tu_index = merge.tu_index;
+    for(auto& shard: merge.shards) {
+        auto& writer = writers.find(shard.path_id)->second;
+
+        // The TU's own copy of the path, the path pool belongs to the event loop.
+        auto content = workspace.contents.put_file(tu_index.graph.paths[shard.tu_path_id]);
+
+        if(shard.include_id) {
+            writer.index.merge(shard.path_id, *shard.include_id, *shard.file_index, content);
+        } else {
+            std::vector<index::IncludeLocation> include_locs;
+            for(auto& loc: tu_index.graph.locations) {
+                index::IncludeLocation remapped = loc;
+                remapped.path_id = merge.file_ids[loc.path_id];
+                include_locs.push_back(remapped);
+            }
+            writer.index.merge(shard.path_id,
+                               tu_index.built_at,
+                               std::move(include_locs),
+                               *shard.file_index,
+                               content);
+        }
+        touched.insert(shard.path_id);
+    }
+}
+
+std::vector<Indexer::ShardSnapshot>
+    Indexer::take_snapshots(const llvm::DenseSet<std::uint32_t>& touched) {
+    std::vector<ShardSnapshot> snapshots;
+    snapshots.reserve(touched.size());
+    for(auto path_id: touched) {
+        auto& writer = writers.find(path_id)->second;
+        snapshots.push_back({path_id, writer.index.snapshot(), writer.index.memory_usage()});
+    }
+    return snapshots;
+}
+
+void Indexer::publish(std::vector<ShardSnapshot>& snapshots) {
+    auto now = std::chrono::steady_clock::now();
+    for(auto& snapshot: snapshots) {
+        auto& writer = writers[snapshot.path_id];
+        shard_memory.resident_bytes =
+            shard_memory.resident_bytes - writer.resident_bytes + snapshot.writer_bytes;
+        writer.resident_bytes = snapshot.writer_bytes;
+
+        auto& shard = workspace.merged_indices[snapshot.path_id];
+        shard.index = std::move(snapshot.index);
+        shard.contents = &workspace.contents;
         shard.invalidate_mapper();
+        shard.last_used = now;
+
+        auto resident = shard.index.memory_usage();
+        shard_memory.resident_bytes = shard_memory.resident_bytes - shard.resident_bytes + resident;
+        shard.resident_bytes = resident;
+
+        if(shard.index.removed_contexts() > 0) {
+            compaction_candidates.insert(snapshot.path_id);
+        }
+    }
+}
+
+void Indexer::enforce_memory_limit() {
+    std::uint64_t limit = workspace.config.project.index_memory_limit;
+    if(limit == 0 || shard_memory.resident_bytes <= limit)
+        return;
+
+    llvm::SmallVector<std::pair<std::uint32_t, MergedIndexShard*>> candidates;
+    for(auto& [path_id, shard]: workspace.merged_indices) {
+        if(shard.resident_bytes > 0 || writers.contains(path_id))
+            candidates.emplace_back(path_id, &shard);
+    }
+    std::ranges::sort(candidates, [](const auto& lhs, const auto& rhs) {
+        return lhs.second->last_used < rhs.second->last_used;
+    });
+
+    // Without an index directory cold snapshots have to stay in memory.
+    bool can_drop = !workspace.config.project.index_dir.empty();
+
+    auto before = shard_memory;
+    llvm::SmallVector<std::pair<std::uint32_t, MergedIndexShard*>> dropped;
+    std::size_t dropped_bytes = 0;
+    for(auto& [path_id, shard]: candidates) {
+        if(shard_memory.resident_bytes - dropped_bytes <= limit)
+            break;
+
+        // The published snapshot holds everything the writer has.
+        auto writer_it = writers.find(path_id);
+        if(writer_it != writers.end()) {
+            shard_memory.resident_bytes -= writer_it->second.resident_bytes;
+            writers.erase(writer_it);
+            shard_memory.shrunk += 1;
+        }
+
+        // Still over budget, write the snapshot back and map it again on demand.
+        if(shard_memory.resident_bytes - dropped_bytes > limit && shard->resident_bytes > 0 &&
+           can_drop) {
+            dropped.emplace_back(path_id, shard);
+            dropped_bytes += shard->resident_bytes;
+        }
+    }
+    shard_memory.dropped += write_shards(workspace.config.project.index_dir, dropped);
+
+    LOG_INFO("Index memory {} -> {} bytes (limit {}): {} writers released, {} shards dropped",
+             before.resident_bytes,
+             shard_memory.resident_bytes,
+             limit,
+             shard_memory.shrunk - before.shrunk,
+             shard_memory.dropped - before.dropped);
+}
+
+std::size_t
+    Indexer::write_shards(llvm::StringRef index_dir,
+                          llvm::ArrayRef<std::pair<std::uint32_t, MergedIndexShard*>> shards) {
+    if(shards.empty() || index_dir.empty())
+        return 0;
+
+    auto shards_dir = path::join(index_dir, "shards");
+    if(auto ec = llvm::sys::fs::create_directories(shards_dir)) {
+        LOG_WARN("Failed to create shards directory: {}", ec.message());
+        return 0;
+    }
+
+    // The snapshot is on disk now, map it instead of keeping it on the heap.
+    auto written = [&](MergedIndexShard& shard, index::MergedIndex index) {
+        shard.index = std::move(index);
+        shard.invalidate_mapper();
+        shard_memory.resident_bytes -= shard.resident_bytes;
+        shard.resident_bytes = 0;
     };
 
-    for(auto& [tu_path_id, file_idx]: tu_index.path_file_indices) {
-        merge_file_index(tu_path_id, file_idx);
+    std::size_t count = 0;
+    if(!workspace.config.project.packed_index) {
+        for(auto& [path_id, shard]: shards) {
+            auto shard_path = path::join(shards_dir, std::to_string(path_id) + ".idx");
+            if(write_index_file(shard_path,
+                                [&](llvm::raw_ostream& os) { shard->index.serialize(os); })) {
+                written(*shard, index::MergedIndex::load(shard_path));
+                loose_shards.insert(path_id);
+                count += 1;
+            }
+        }
+        return count;
     }
-    merge_file_index(main_tu_path_id, tu_index.main_file_index);
 
-    LOG_INFO("Merged TUIndex: {} paths, {} symbols, {} merged_shards",
-             tu_index.graph.paths.size(),
-             tu_index.symbols.size(),
-             workspace.merged_indices.size());
+    if(!shard_pack.is_open()) {
+        shard_pack.open(path::join(index_dir, "shards.pack"));
+    }
+
+    // Serialize a bounded batch at a time and append it in one commit.
+    std::vector<std::string> blobs;
+    std::vector<std::pair<std::uint32_t, llvm::StringRef>> entries;
+    std::size_t first = 0;
+    std::size_t batch_bytes = 0;
+    for(std::size_t i = 0; i < shards.size(); i++) {
+        auto& blob = blobs.emplace_back();
+        llvm::raw_string_ostream os(blob);
+        shards[i].second->index.serialize(os);
+        os.flush();
+        batch_bytes += blob.size();
+        if(batch_bytes < pack_append_bytes && i + 1 < shards.size())
+            continue;
+
+        for(std::size_t j = first; j <= i; j++) {
+            entries.emplace_back(shards[j].first, blobs[j - first]);
+        }
+        if(shard_pack.append(entries)) {
+            for(std::size_t j = first; j <= i; j++) {
+                auto [path_id, shard] = shards[j];
+                written(*shard, index::MergedIndex::from_buffer(shard_pack.get(path_id)));
+                // A shard saved before the pack was enabled is superseded now.
+                llvm::sys::fs::remove(path::join(shards_dir, std::to_string(path_id) + ".idx"));
+                loose_shards.erase(path_id);
+                count += 1;
+            }
+        }
+        blobs.clear();
+        entries.clear();
+        first = i + 1;
+        batch_bytes = 0;
+    }
+    return count;
 }
 
 void Indexer::save(llvm::StringRef index_dir) {
     if(index_dir.empty())
         return;
 
+    // The journal must not be checkpointed past records which are not published.
+    if(merging) {
+        save_requested = true;
+        return;
+    }
+
     auto ec = llvm::sys::fs::create_directories(index_dir);
     if(ec) {
         LOG_WARN("Failed to create index directory {}: {}", std::string(index_dir), ec.message());
         return;
     }
 
+    // Shards first, so a saved project.idx never refers to missing shard data.
+    bool packed = workspace.config.project.packed_index;
+    if(packed && !shard_pack.is_open()) {
+        shard_pack.open(path::join(index_dir, "shards.pack"));
+    }
+    llvm::SmallVector<std::pair<std::uint32_t, MergedIndexShard*>> pending;
+    for(auto& [path_id, shard]: workspace.merged_indices) {
+        // With the pack enabled, shards saved in their own files move into it,
+        // also when the pack has an older copy of them.
+        bool loose = !shard_pack.contains(path_id) || loose_shards.contains(path_id);
+        if(shard.index.need_rewrite() || (packed && loose))
+            pending.emplace_back(path_id, &shard);
+    }
+    auto saved = write_shards(index_dir, pending);
+    bool complete = saved == pending.size();
+    LOG_INFO("Saved {} MergedIndex shards (of {} total)", saved, workspace.merged_indices.size());
+
+    // Reclaim superseded shard versions once they outweigh the live ones.
+    if(packed && complete && shard_pack.dead_bytes() > shard_pack.live_bytes() &&
+       shard_pack.repack()) {
+        // Every shard not rewritten since is served from the pack, move them to
+        // the new file so the old one can be released.
+        shard_pack.for_each([&](std::uint32_t path_id) {
+            auto shard_it = workspace.merged_indices.find(path_id);
+            if(shard_it != workspace.merged_indices.end() &&
+               !shard_it->second.index.need_rewrite()) {
+                shard_it->second.index = index::MergedIndex::from_buffer(shard_pack.get(path_id));
+                shard_it->second.invalidate_mapper();
+            }
+        });
+    }
+
     auto project_path = path::join(index_dir, "project.idx");
-    {
-        std::error_code write_ec;
-        llvm::raw_fd_ostream os(project_path, write_ec);
-        if(!write_ec) {
-            workspace.project_index.serialize(os);
-            LOG_INFO("Saved ProjectIndex to {}", project_path);
+    if(write_index_file(project_path,
+                        [&](llvm::raw_ostream& os) { workspace.project_index.serialize(os); })) {
+        LOG_INFO("Saved ProjectIndex to {}", project_path);
+    } else {
+        complete = false;
+    }
+
+    // Only drop journal records once everything they produced is on disk.
+    // Records not published yet (queued when merging stopped, or in a batch
+    // that failed) are in neither the shards nor project.idx, keep them.  The
+    // published records after the oldest of them are replayed as well, which
+    // merges the same TUs again in order.
+    if(complete) {
+        if(unpublished_records.empty()) {
+            journal.checkpoint();
         } else {
-            LOG_WARN("Failed to save ProjectIndex: {}", write_ec.message());
+            journal.checkpoint(*unpublished_records.begin() - 1);
         }
+        collect_contents();
     }
+}
 
-    auto shards_dir = path::join(index_dir, "shards");
-    ec = llvm::sys::fs::create_directories(shards_dir);
-    if(ec) {
-        LOG_WARN("Failed to create shards directory: {}", ec.message());
+void Indexer::collect_contents() {
+    if(workspace.contents.added() == 0)
         return;
-    }
 
-    std::size_t saved = 0;
-    for(auto& [path_id, shard]: workspace.merged_indices) {
-        if(!shard.index.need_rewrite())
-            continue;
-        auto shard_path = path::join(shards_dir, std::to_string(path_id) + ".idx");
-        std::error_code write_ec;
-        llvm::raw_fd_ostream os(shard_path, write_ec);
-        if(!write_ec) {
-            shard.index.serialize(os);
-            ++saved;
+    // Every saved shard is current, so the contents they do not reference are
+    // not needed by any version of the index on disk either.
+    std::vector<index::ContentHash> live;
+    live.reserve(workspace.merged_indices.size() + writers.size());
+    auto add = [&](const index::MergedIndex& index) {
+        auto hash = index.content_hash();
+        if(hash != index::ContentHash{}) {
+            live.push_back(hash);
         }
+    };
+    for(auto& [_, shard]: workspace.merged_indices) {
+        add(shard.index);
+    }
+    for(auto& [_, writer]: writers) {
+        add(writer.index);
+    }
+
+    if(auto released = workspace.contents.collect(live)) {
+        LOG_INFO("Released {} shard contents no longer referenced", released);
+    }
+}
+
+void Indexer::flush(llvm::StringRef index_dir) {
+    if(!journal.is_open()) {
+        save(index_dir);
     }
-    LOG_INFO("Saved {} MergedIndex shards (of {} total)", saved, workspace.merged_indices.size());
 }
 
 void Indexer::load(llvm::StringRef index_dir) {
     if(index_dir.empty())
         return;
 
+    workspace.contents.open(path::join(index_dir, "contents"));
+
     auto project_path = path::join(index_dir, "project.idx");
-    auto buf = llvm::MemoryBuffer::getFile(project_path);
+    // Map the file and keep it, symbol names are read from it in place.
+    auto buf = llvm::MemoryBuffer::getFile(project_path,
+                                           /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
     if(buf) {
-        workspace.project_index = index::ProjectIndex::from((*buf)->getBufferStart());
+        workspace.project_index = index::ProjectIndex::from_buffer(std::move(*buf));
         LOG_INFO("Loaded ProjectIndex: {} symbols", workspace.project_index.symbols.size());
     }
 
+    // Shards in the pack are slices of one mapping, registering them is free.
+    shard_pack.open(path::join(index_dir, "shards.pack"));
+    shard_pack.for_each([&](std::uint32_t path_id) {
+        auto& shard = workspace.merged_indices[path_id];
+        shard.index = index::MergedIndex::from_buffer(shard_pack.get(path_id));
+        shard.contents = &workspace.contents;
+    });
+
+    // A shard in its own file was saved after the pack was disabled, it is newer.
     auto shards_dir = path::join(index_dir, "shards");
     std::error_code ec;
     for(auto it = llvm::sys::fs::directory_iterator(shards_dir, ec);
@@ -161,11 +697,32 @@ void Indexer::load(llvm::StringRef index_dir) {
         std::uint32_t path_id = 0;
         if(stem.getAsInteger(10, path_id))
             continue;
-        workspace.merged_indices[path_id] = MergedIndexShard{index::MergedIndex::load(it->path())};
+        // Only register the shard here, it is mapped on the first query that hits it.
+        auto& shard = workspace.merged_indices[path_id];
+        shard.index = index::MergedIndex::load(it->path());
+        shard.contents = &workspace.contents;
+        loose_shards.insert(path_id);
     }
 
     if(!workspace.merged_indices.empty()) {
-        LOG_INFO("Loaded {} MergedIndex shards", workspace.merged_indices.size());
+        LOG_INFO("Registered {} MergedIndex shards", workspace.merged_indices.size());
+    }
+
+    // Recover the merges of the previous session that were not saved in full.
+    // The records are already journaled, queue them like fresh results so a
+    // long journal is merged on the merge thread instead of delaying startup.
+    journal.open(index_dir);
+    auto replayed = journal.replay([&](std::uint64_t sequence, const void* data, std::size_t size) {
+        unpublished_records.insert(sequence);
+        merge_queue.push_back({sequence, std::string(static_cast<const char*>(data), size)});
+    });
+    if(replayed > 0) {
+        LOG_INFO("Replaying {} TUIndex records from the index journal", replayed);
+        merging = true;
+        if(!merge_tasks.spawn(run_merges())) {
+            merging = false;
+            LOG_WARN("Failed to spawn index merge task (task group stopped)");
+        }
     }
 }
 
@@ -198,7 +755,7 @@ bool Indexer::find_symbol_info(index::SymbolHash hash, std::string& name, Symbol
     }
     auto it = workspace.project_index.symbols.find(hash);
     if(it != workspace.project_index.symbols.end()) {
-        name = it->second.name;
+        name = it->second.name.str();
         kind = it->second.kind;
         return true;
     }
@@ -242,6 +799,74 @@ Indexer::CursorHit Indexer::resolve_cursor(llvm::StringRef path,
     return {};
 }
 
+const CachedRelations* Indexer::cached_relations(index::SymbolHash hash, RelationKind kind) {
+    auto sym_it = workspace.project_index.symbols.find(hash);
+    if(sym_it == workspace.project_index.symbols.end())
+        return nullptr;
+
+    // The epoch of a symbol is the newest epoch of the shards referencing it.
+    auto& files = sym_it->second.reference_files;
+    std::uint64_t epoch = 0;
+    for(auto file_id: files) {
+        auto epoch_it = shard_epochs.find(file_id);
+        if(epoch_it != shard_epochs.end()) {
+            epoch = std::max(epoch, epoch_it->second);
+        }
+    }
+    return query_cache.find(hash, kind, epoch, files.cardinality());
+}
+
+const CachedRelations* Indexer::shard_relations(index::SymbolHash hash, RelationKind kind) {
+    if(auto* cached = cached_relations(hash, kind))
+        return cached;
+
+    auto sym_it = workspace.project_index.symbols.find(hash);
+    if(sym_it == workspace.project_index.symbols.end())
+        return nullptr;
+
+    auto& files = sym_it->second.reference_files;
+    CachedRelations relations;
+    relations.epoch = index_epoch;
+    relations.file_count = files.cardinality();
+    for(auto file_id: files) {
+        collect_shard_relations(hash, kind, file_id, relations);
+    }
+    return &query_cache.insert(hash, kind, std::move(relations));
+}
+
+void Indexer::collect_shard_relations(index::SymbolHash hash,
+                                      RelationKind kind,
+                                      std::uint32_t file_id,
+                                      CachedRelations& relations) {
+    auto shard_it = workspace.merged_indices.find(file_id);
+    if(shard_it == workspace.merged_indices.end())
+        return;
+    CachedRelations::File file{file_id};
+    shard_it->second.find_relations(hash, kind, [&](const auto& r, protocol::Range range) {
+        file.ranges.emplace_back(r.target_symbol, range);
+        return true;
+    });
+    if(!file.ranges.empty()) {
+        relations.files.push_back(std::move(file));
+    }
+}
+
+void Indexer::collect_open_file_locations(index::SymbolHash hash,
+                                          RelationKind kind,
+                                          std::vector<protocol::Location>& locations) {
+    for(auto& [id, sess]: sessions) {
+        if(!sess.file_index)
+            continue;
+        auto uri = lsp::URI::from_file_path(std::string(workspace.path_pool.resolve(id)));
+        if(!uri)
+            continue;
+        sess.file_index->find_relations(hash, kind, [&](const auto&, protocol::Range range) {
+            locations.push_back({uri->str(), range});
+            return true;
+        });
+    }
+}
+
 std::vector<protocol::Location> Indexer::query_relations(llvm::StringRef path,
                                                          const protocol::Position& position,
                                                          RelationKind kind,
@@ -252,39 +877,119 @@ std::vector<protocol::Location> Indexer::query_relations(llvm::StringRef path,
 
     std::vector<protocol::Location> locations;
 
-    auto sym_it = workspace.project_index.symbols.find(hit.hash);
-    if(sym_it != workspace.project_index.symbols.end()) {
-        for(auto file_id: sym_it->second.reference_files) {
-            if(is_proj_path_open(file_id))
-                continue;
-            auto shard_it = workspace.merged_indices.find(file_id);
-            if(shard_it == workspace.merged_indices.end())
+    if(auto* relations = shard_relations(hit.hash, kind)) {
+        for(auto& file: relations->files) {
+            if(is_proj_path_open(file.path_id))
                 continue;
-            auto uri = lsp::URI::from_file_path(workspace.project_index.path_pool.path(file_id));
+            auto uri =
+                lsp::URI::from_file_path(workspace.project_index.path_pool.path(file.path_id));
             if(!uri)
                 continue;
-            shard_it->second.find_relations(hit.hash,
-                                            kind,
-                                            [&](const auto&, protocol::Range range) {
-                                                locations.push_back({uri->str(), range});
-                                                return true;
-                                            });
+            for(auto& [_, range]: file.ranges) {
+                locations.push_back({uri->str(), range});
+            }
         }
     }
 
-    for(auto& [id, sess]: sessions) {
-        if(!sess.file_index)
-            continue;
-        auto uri = lsp::URI::from_file_path(std::string(workspace.path_pool.resolve(id)));
+    collect_open_file_locations(hit.hash, kind, locations);
+    return locations;
+}
+
+kota::task<> Indexer::stream_relations(
+    llvm::StringRef path,
+    const protocol::Position& position,
+    llvm::ArrayRef<RelationKind> kinds,
+    Session* session,
+    std::function<void(std::vector<protocol::Location>)> on_batch) {
+    auto hit = resolve_cursor(path, position, session);
+    if(hit.hash == 0)
+        co_return;
+
+    // Open files are what the user is looking at, report them first.  Their
+    // shards are skipped for the whole walk, also if a file is opened or
+    // closed meanwhile, so no file is reported twice or not at all.
+    llvm::DenseSet<std::uint32_t> open_files;
+    for(auto& [id, _]: sessions) {
+        auto it = workspace.project_index.path_pool.find(workspace.path_pool.resolve(id));
+        if(it != workspace.project_index.path_pool.cache.end()) {
+            open_files.insert(it->second);
+        }
+    }
+
+    std::vector<protocol::Location> locations;
+    auto flush = [&] {
+        if(!locations.empty()) {
+            on_batch(std::move(locations));
+            locations.clear();
+        }
+    };
+    auto append = [&](const CachedRelations::File& file) {
+        if(open_files.contains(file.path_id))
+            return;
+        auto uri = lsp::URI::from_file_path(workspace.project_index.path_pool.path(file.path_id));
         if(!uri)
-            continue;
-        sess.file_index->find_relations(hit.hash, kind, [&](const auto&, protocol::Range range) {
+            return;
+        for(auto& [_, range]: file.ranges) {
             locations.push_back({uri->str(), range});
-            return true;
-        });
+        }
+    };
+
+    for(auto kind: kinds) {
+        collect_open_file_locations(hit.hash, kind, locations);
     }
+    flush();
+
+    for(auto kind: kinds) {
+        // A cached result needs no decoding, it is sent without yielding since
+        // the entry may be replaced while the walk is suspended.
+        if(auto* cached = cached_relations(hit.hash, kind)) {
+            for(std::size_t i = 0; i < cached->files.size(); i++) {
+                append(cached->files[i]);
+                if((i + 1) % stream_batch_size == 0) {
+                    flush();
+                }
+            }
+            flush();
+            continue;
+        }
 
-    return locations;
+        // The symbol table may be republished while this walk is suspended,
+        // take the file list up front.
+        auto sym_it = workspace.project_index.symbols.find(hit.hash);
+        if(sym_it == workspace.project_index.symbols.end())
+            continue;
+        std::vector<std::uint32_t> files;
+        for(auto file_id: sym_it->second.reference_files) {
+            files.push_back(file_id);
+        }
+
+        // Collect the shards of open files too, the result is cached for
+        // query_relations() as well if no merge is published meanwhile.
+        CachedRelations relations;
+        relations.epoch = index_epoch;
+        relations.file_count = files.size();
+        for(std::size_t i = 0; i < files.size(); i += stream_batch_size) {
+            // Give the loop a chance to deliver the batch and a $/cancelRequest,
+            // which cancels the awaiting request and this walk with it.
+            if(i > 0) {
+                co_await kota::sleep(std::chrono::milliseconds(0));
+            }
+
+            auto first = relations.files.size();
+            auto end = std::min(files.size(), i + stream_batch_size);
+            for(auto j = i; j < end; j++) {
+                collect_shard_relations(hit.hash, kind, files[j], relations);
+            }
+            for(auto j = first; j < relations.files.size(); j++) {
+                append(relations.files[j]);
+            }
+            flush();
+        }
+
+        if(relations.epoch == index_epoch) {
+            query_cache.insert(hit.hash, kind, std::move(relations));
+        }
+    }
 }
 
 std::optional<SymbolInfo> Indexer::lookup_symbol(const std::string& uri,
@@ -303,6 +1008,43 @@ std::optional<SymbolInfo> Indexer::lookup_symbol(const std::string& uri,
     return SymbolInfo{hit.hash, std::move(name), sym_kind, uri, hit.range};
 }
 
+llvm::SmallVector<std::uint32_t>
+    Indexer::unrecorded_definition_files(index::SymbolHash hash) const {
+    auto& project = workspace.project_index;
+    llvm::SmallVector<std::uint32_t> files;
+    if(!project.partial_definitions || project.definitions.contains(hash))
+        return files;
+
+    // Only an index saved before definitions were recorded gets here, the
+    // symbol may be defined in any file referencing it.
+    auto sym_it = project.symbols.find(hash);
+    if(sym_it != project.symbols.end()) {
+        for(auto file_id: sym_it->second.reference_files) {
+            files.push_back(file_id);
+        }
+    }
+    return files;
+}
+
+std::optional<protocol::Location>
+    Indexer::recorded_definition_location(const index::SymbolDefinition& definition) {
+    if(is_proj_path_open(definition.path_id))
+        return std::nullopt;
+    auto shard_it = workspace.merged_indices.find(definition.path_id);
+    if(shard_it == workspace.merged_indices.end())
+        return std::nullopt;
+    auto* mapper = shard_it->second.mapper();
+    auto uri =
+        lsp::URI::from_file_path(workspace.project_index.path_pool.path(definition.path_id));
+    if(!mapper || !uri)
+        return std::nullopt;
+    auto start = mapper->to_position(definition.range.begin);
+    auto end = mapper->to_position(definition.range.end);
+    if(!start || !end)
+        return std::nullopt;
+    return protocol::Location{uri->str(), protocol::Range{*start, *end}};
+}
+
 std::optional<protocol::Location> Indexer::find_definition_location(index::SymbolHash hash) {
     // Open file indices first (fresher data for actively-edited files).
     for(auto& [id, sess]: sessions) {
@@ -322,12 +1064,14 @@ std::optional<protocol::Location> Indexer::find_definition_location(index::Symbo
             return result;
     }
 
-    // Fall back to ProjectIndex reference files.
-    auto sym_it = workspace.project_index.symbols.find(hash);
-    if(sym_it == workspace.project_index.symbols.end())
-        return std::nullopt;
+    // The definition recorded at merge time.  An open file was searched above,
+    // the session no longer defines it.
+    auto& project = workspace.project_index;
+    if(auto def_it = project.definitions.find(hash); def_it != project.definitions.end()) {
+        return recorded_definition_location(def_it->second);
+    }
 
-    for(auto file_id: sym_it->second.reference_files) {
+    for(auto file_id: unrecorded_definition_files(hash)) {
         if(is_proj_path_open(file_id))
             continue;
         auto shard_it = workspace.merged_indices.find(file_id);
@@ -373,18 +1117,13 @@ void Indexer::collect_grouped_relations(
     index::SymbolHash hash,
     RelationKind kind,
     llvm::DenseMap<index::SymbolHash, std::vector<protocol::Range>>& target_ranges) {
-    auto sym_it = workspace.project_index.symbols.find(hash);
-    if(sym_it != workspace.project_index.symbols.end()) {
-        for(auto file_id: sym_it->second.reference_files) {
-            if(is_proj_path_open(file_id))
-                continue;
-            auto shard_it = workspace.merged_indices.find(file_id);
-            if(shard_it == workspace.merged_indices.end())
+    if(auto* relations = shard_relations(hash, kind)) {
+        for(auto& file: relations->files) {
+            if(is_proj_path_open(file.path_id))
                 continue;
-            shard_it->second.find_relations(hash, kind, [&](const auto& r, protocol::Range range) {
-                target_ranges[r.target_symbol].push_back(range);
-                return true;
-            });
+            for(auto& [target, range]: file.ranges) {
+                target_ranges[target].push_back(range);
+            }
         }
     }
     for(auto& [_, sess]: sessions) {
@@ -410,7 +1149,7 @@ void Indexer::collect_unique_targets(index::SymbolHash hash,
             if(shard_it == workspace.merged_indices.end())
                 continue;
             /// No position conversion needed -- just collect target symbol hashes.
-            shard_it->second.index.lookup(hash, kind, [&](const index::Relation& r) {
+            shard_it->second.lookup(hash, kind, [&](const index::Relation& r) {
                 if(seen.insert(r.target_symbol).second) {
                     targets.push_back(r.target_symbol);
                 }
@@ -421,14 +1160,9 @@ void Indexer::collect_unique_targets(index::SymbolHash hash,
     for(auto& [_, sess]: sessions) {
         if(!sess.file_index)
             continue;
-        auto rel_it = sess.file_index->file_index.relations.find(hash);
-        if(rel_it == sess.file_index->file_index.relations.end())
-            continue;
-        for(auto& r: rel_it->second) {
-            if(r.kind & kind) {
-                if(seen.insert(r.target_symbol).second) {
-                    targets.push_back(r.target_symbol);
-                }
+        for(auto& r: sess.file_index->file_index.relations_of(hash, kind)) {
+            if(seen.insert(r.target_symbol).second) {
+                targets.push_back(r.target_symbol);
             }
         }
     }
@@ -466,12 +1200,7 @@ std::optional<Indexer::DefinitionText> Indexer::get_definition_text(index::Symbo
     for(auto& [id, sess]: sessions) {
         if(!sess.file_index || !sess.file_index->mapper)
             continue;
-        auto it = sess.file_index->file_index.relations.find(hash);
-        if(it == sess.file_index->file_index.relations.end())
-            continue;
-        for(auto& rel: it->second) {
-            if(rel.kind.value() != RelationKind::Definition)
-                continue;
+        for(auto& rel: sess.file_index->file_index.relations_of(hash, RelationKind::Definition)) {
             auto def_range = std::bit_cast<LocalSourceRange>(rel.target_symbol);
             if(def_range.begin >= def_range.end)
                 continue;
@@ -492,42 +1221,46 @@ std::optional<Indexer::DefinitionText> Indexer::get_definition_text(index::Symbo
         }
     }
 
-    auto sym_it = workspace.project_index.symbols.find(hash);
-    if(sym_it == workspace.project_index.symbols.end())
-        return std::nullopt;
+    auto shard_text = [&](std::uint32_t file_id,
+                          LocalSourceRange def_range) -> std::optional<DefinitionText> {
+        auto shard_it = workspace.merged_indices.find(file_id);
+        if(shard_it == workspace.merged_indices.end())
+            return std::nullopt;
+        auto* m = shard_it->second.mapper();
+        auto content = shard_it->second.content();
+        if(!m || def_range.begin >= def_range.end || def_range.end > content.size())
+            return std::nullopt;
+        auto start = m->to_position(def_range.begin);
+        auto end = m->to_position(def_range.end);
+        if(!start || !end)
+            return std::nullopt;
+        return DefinitionText{
+            .file = workspace.project_index.path_pool.path(file_id).str(),
+            .start_line = static_cast<int>(start->line) + 1,
+            .end_line = static_cast<int>(end->line) + 1,
+            .text = std::string(content.substr(def_range.begin, def_range.end - def_range.begin)),
+        };
+    };
+
+    // The extent recorded at merge time, unless the file is open.
+    auto& project = workspace.project_index;
+    if(auto def_it = project.definitions.find(hash); def_it != project.definitions.end()) {
+        if(is_proj_path_open(def_it->second.path_id))
+            return std::nullopt;
+        return shard_text(def_it->second.path_id, def_it->second.extent);
+    }
 
-    for(auto file_id: sym_it->second.reference_files) {
+    for(auto file_id: unrecorded_definition_files(hash)) {
         if(is_proj_path_open(file_id))
             continue;
         auto shard_it = workspace.merged_indices.find(file_id);
         if(shard_it == workspace.merged_indices.end())
             continue;
-        auto* m = shard_it->second.mapper();
-        if(!m)
-            continue;
-        auto content = shard_it->second.index.content();
-
         std::optional<DefinitionText> result;
-        shard_it->second.index.lookup(
-            hash,
-            RelationKind::Definition,
-            [&](const index::Relation& r) {
-                auto def_range = std::bit_cast<LocalSourceRange>(r.target_symbol);
-                if(def_range.begin >= def_range.end || def_range.end > content.size())
-                    return true;
-                auto start = m->to_position(def_range.begin);
-                auto end = m->to_position(def_range.end);
-                if(!start || !end)
-                    return true;
-                result = DefinitionText{
-                    .file = workspace.project_index.path_pool.path(file_id).str(),
-                    .start_line = static_cast<int>(start->line) + 1,
-                    .end_line = static_cast<int>(end->line) + 1,
-                    .text = std::string(
-                        content.substr(def_range.begin, def_range.end - def_range.begin)),
-                };
-                return false;
-            });
+        shard_it->second.lookup(hash, RelationKind::Definition, [&](const index::Relation& r) {
+            result = shard_text(file_id, std::bit_cast<LocalSourceRange>(r.target_symbol));
+            return !result;
+        });
         if(result)
             return result;
     }
@@ -539,6 +1272,28 @@ std::vector<Indexer::ReferenceWithContext> Indexer::collect_references(index::Sy
                                                                        RelationKind kind) {
     std::vector<ReferenceWithContext> results;
 
+    // Only the start lines are needed, convert all of a file at once.
+    auto add_references = [&](llvm::StringRef file_path,
+                              llvm::StringRef content,
+                              llvm::ArrayRef<index::Relation> relations,
+                              const lsp::PositionMapper* lines) {
+        std::vector<std::uint32_t> offsets;
+        offsets.reserve(relations.size());
+        for(auto& r: relations) {
+            offsets.push_back(r.range.begin);
+        }
+        auto positions = to_positions(content, offsets, lines);
+        for(std::size_t i = 0; i < relations.size(); i++) {
+            if(!positions[i])
+                continue;
+            results.push_back(ReferenceWithContext{
+                .file = file_path.str(),
+                .line = static_cast<int>(positions[i]->line) + 1,
+                .context = extract_line(content, relations[i].range.begin),
+            });
+        }
+    };
+
     auto sym_it = workspace.project_index.symbols.find(hash);
     if(sym_it != workspace.project_index.symbols.end()) {
         for(auto file_id: sym_it->second.reference_files) {
@@ -547,47 +1302,29 @@ std::vector<Indexer::ReferenceWithContext> Indexer::collect_references(index::Sy
             auto shard_it = workspace.merged_indices.find(file_id);
             if(shard_it == workspace.merged_indices.end())
                 continue;
-            auto* m = shard_it->second.mapper();
-            if(!m)
-                continue;
-            auto content = shard_it->second.index.content();
+            auto content = shard_it->second.content();
             auto file_path = workspace.project_index.path_pool.path(file_id);
 
-            shard_it->second.index.lookup(hash, kind, [&](const index::Relation& r) {
-                auto start = m->to_position(r.range.begin);
-                if(!start)
-                    return true;
-                results.push_back(ReferenceWithContext{
-                    .file = file_path.str(),
-                    .line = static_cast<int>(start->line) + 1,
-                    .context = extract_line(content, r.range.begin),
-                });
+            std::vector<index::Relation> relations;
+            shard_it->second.lookup(hash, kind, [&](const index::Relation& r) {
+                relations.push_back(r);
                 return true;
             });
+            add_references(file_path, content, relations, shard_it->second.mapper());
         }
     }
 
     for(auto& [id, sess]: sessions) {
-        if(!sess.file_index || !sess.file_index->mapper)
+        if(!sess.file_index)
             continue;
-        auto it = sess.file_index->file_index.relations.find(hash);
-        if(it == sess.file_index->file_index.relations.end())
+        auto relations = sess.file_index->file_index.relations_of(hash, kind);
+        if(relations.empty())
             continue;
-        auto file_path = workspace.path_pool.resolve(id);
-        llvm::StringRef content = sess.file_index->content;
-
-        for(auto& rel: it->second) {
-            if(rel.kind != kind)
-                continue;
-            auto start = sess.file_index->mapper->to_position(rel.range.begin);
-            if(!start)
-                continue;
-            results.push_back(ReferenceWithContext{
-                .file = file_path.str(),
-                .line = static_cast<int>(start->line) + 1,
-                .context = extract_line(content, rel.range.begin),
-            });
-        }
+        auto& mapper = sess.file_index->mapper;
+        add_references(workspace.path_pool.resolve(id),
+                       sess.file_index->content,
+                       relations,
+                       mapper ? &*mapper : nullptr);
     }
 
     return results;
@@ -651,74 +1388,180 @@ std::vector<protocol::TypeHierarchyItem> Indexer::find_subtypes(index::SymbolHas
     return results;
 }
 
+namespace {
+
+/// A scored candidate of workspace symbol search.
+struct ScoredSymbol {
+    float score;
+    index::SymbolHash hash;
+    llvm::StringRef name;
+    SymbolKind kind;
+};
+
+/// Order by descending score, ties broken by name and hash so that results
+/// are deterministic regardless of hash table order.
+bool ranks_before(const ScoredSymbol& lhs, const ScoredSymbol& rhs) {
+    if(lhs.score != rhs.score)
+        return lhs.score > rhs.score;
+    if(lhs.name != rhs.name)
+        return lhs.name < rhs.name;
+    return lhs.hash < rhs.hash;
+}
+
+/// Bounded selection of the best `limit` candidates. The heap top is the worst
+/// kept candidate, so a new one only costs a comparison unless it ranks higher.
+struct TopSymbols {
+    std::size_t limit;
+    std::vector<ScoredSymbol> heap;
+
+    void push(ScoredSymbol candidate) {
+        if(heap.size() < limit) {
+            heap.push_back(candidate);
+            std::ranges::push_heap(heap, ranks_before);
+        } else if(!heap.empty() && ranks_before(candidate, heap.front())) {
+            std::ranges::pop_heap(heap, ranks_before);
+            heap.back() = candidate;
+            std::ranges::push_heap(heap, ranks_before);
+        }
+    }
+
+    std::vector<ScoredSymbol> take_sorted() && {
+        std::ranges::sort_heap(heap, ranks_before);
+        return std::move(heap);
+    }
+};
+
+bool is_indexable_kind(SymbolKind sk) {
+    return sk == SymbolKind::Namespace || sk == SymbolKind::Class || sk == SymbolKind::Struct ||
+           sk == SymbolKind::Union || sk == SymbolKind::Enum || sk == SymbolKind::Type ||
+           sk == SymbolKind::Field || sk == SymbolKind::EnumMember ||
+           sk == SymbolKind::Function || sk == SymbolKind::Method ||
+           sk == SymbolKind::Variable || sk == SymbolKind::Parameter ||
+           sk == SymbolKind::Macro || sk == SymbolKind::Concept || sk == SymbolKind::Module ||
+           sk == SymbolKind::Operator || sk == SymbolKind::MacroParameter ||
+           sk == SymbolKind::Label || sk == SymbolKind::Attribute;
+}
+
+}  // namespace
+
 std::vector<protocol::SymbolInformation> Indexer::search_symbols(llvm::StringRef query,
                                                                  std::size_t max_results) {
-    std::string query_lower = query.lower();
-
-    auto is_indexable_kind = [](SymbolKind sk) {
-        return sk == SymbolKind::Namespace || sk == SymbolKind::Class || sk == SymbolKind::Struct ||
-               sk == SymbolKind::Union || sk == SymbolKind::Enum || sk == SymbolKind::Type ||
-               sk == SymbolKind::Field || sk == SymbolKind::EnumMember ||
-               sk == SymbolKind::Function || sk == SymbolKind::Method ||
-               sk == SymbolKind::Variable || sk == SymbolKind::Parameter ||
-               sk == SymbolKind::Macro || sk == SymbolKind::Concept || sk == SymbolKind::Module ||
-               sk == SymbolKind::Operator || sk == SymbolKind::MacroParameter ||
-               sk == SymbolKind::Label || sk == SymbolKind::Attribute;
+    auto& project = workspace.project_index;
+    auto& symbols = project.symbols;
+
+    // Only symbols with a known definition can be listed, check that before
+    // ranking so they do not crowd out the ones that can.  A symbol of the
+    // project needs a recorded definition, unless the index was saved before
+    // definitions were recorded.
+    auto score = [&](FuzzyMatcher& matcher,
+                     TopSymbols& top,
+                     index::SymbolHash hash,
+                     llvm::StringRef name,
+                     SymbolKind kind) {
+        if(!is_indexable_kind(kind) || name.empty())
+            return;
+        if(!project.partial_definitions && !project.definitions.contains(hash))
+            return;
+        if(auto s = matcher.match(name)) {
+            top.push({*s, hash, name, kind});
+        }
     };
 
-    auto matches_query = [&](llvm::StringRef name) {
-        if(query_lower.empty())
-            return true;
-        return llvm::StringRef(name).lower().find(query_lower) != std::string::npos;
-    };
+    TopSymbols top{max_results, {}};
+
+    // The trigram postings find substring matches and subsequence matches which
+    // only skip ahead to segment starts, the matches FuzzyMatcher ranks highest.
+    // Only if there are none, or the query is too short to filter, look for the
+    // other subsequence matches in the whole table.
+    llvm::SmallVector<index::SymbolHash> candidates;
+    bool filtered = project.trigrams.candidates(query, candidates);
+    if(filtered) {
+        FuzzyMatcher matcher(query);
+        for(auto hash: candidates) {
+            auto it = symbols.find(hash);
+            if(it != symbols.end()) {
+                score(matcher, top, hash, it->second.name, it->second.kind);
+            }
+        }
+    }
 
-    std::vector<protocol::SymbolInformation> results;
-    llvm::DenseSet<index::SymbolHash> seen;
+    if(!filtered || top.heap.empty()) {
+        // Score the whole table in slices on all cores. The event loop is blocked
+        // meanwhile, so the table cannot be modified by a merge.
+        std::vector<const index::ProjectSymbolTable::value_type*> entries;
+        entries.reserve(symbols.size());
+        for(auto& entry: symbols) {
+            entries.push_back(&entry);
+        }
 
-    for(auto& [hash, symbol]: workspace.project_index.symbols) {
-        if(results.size() >= max_results)
-            break;
-        if(!is_indexable_kind(symbol.kind) || symbol.name.empty())
-            continue;
-        if(!matches_query(symbol.name))
-            continue;
-        auto def_loc = find_definition_location(hash);
-        if(!def_loc)
-            continue;
+        constexpr std::size_t min_slice_size = 1 << 16;
+        std::size_t slices = std::clamp<std::size_t>(entries.size() / min_slice_size,
+                                                     1,
+                                                     kota::sys::parallelism());
+        std::size_t slice_size = (entries.size() + slices - 1) / slices;
+        std::vector<TopSymbols> slice_tops(slices, TopSymbols{max_results, {}});
+        llvm::parallelFor(0, slices, [&](std::size_t slice) {
+            FuzzyMatcher matcher(query);
+            auto begin = std::min(slice * slice_size, entries.size());
+            auto end = std::min(begin + slice_size, entries.size());
+            for(auto i = begin; i < end; i++) {
+                auto& [hash, symbol] = *entries[i];
+                score(matcher, slice_tops[slice], hash, symbol.name, symbol.kind);
+            }
+        });
 
-        protocol::SymbolInformation info;
-        info.name = symbol.name;
-        info.kind = to_lsp_symbol_kind(symbol.kind);
-        info.location = std::move(*def_loc);
-        results.push_back(std::move(info));
-        seen.insert(hash);
+        // Nothing was kept from the trigram pass, so no symbol is pushed twice.
+        for(auto& slice_top: slice_tops) {
+            for(auto& candidate: slice_top.heap) {
+                top.push(candidate);
+            }
+        }
+    }
+
+    llvm::DenseSet<index::SymbolHash> seen;
+    for(auto& candidate: top.heap) {
+        seen.insert(candidate.hash);
     }
 
+    // Symbols defined in open files, which may not be indexed yet or be defined
+    // elsewhere by the index.  Their location is found in the session.
+    FuzzyMatcher matcher(query);
+    llvm::DenseSet<index::SymbolHash> open_definitions;
     for(auto& [_, sess]: sessions) {
-        if(results.size() >= max_results)
-            break;
         if(!sess.file_index)
             continue;
         for(auto& [hash, symbol]: sess.file_index->symbols) {
-            if(results.size() >= max_results)
-                break;
-            if(seen.contains(hash))
-                continue;
             if(!is_indexable_kind(symbol.kind) || symbol.name.empty())
                 continue;
-            if(!matches_query(symbol.name))
+            if(sess.file_index->file_index.relations_of(hash, RelationKind::Definition).empty())
                 continue;
-            auto def_loc = find_definition_location(hash);
-            if(!def_loc)
+            open_definitions.insert(hash);
+            if(!seen.insert(hash).second)
                 continue;
+            if(auto s = matcher.match(symbol.name)) {
+                top.push({*s, hash, symbol.name, symbol.kind});
+            }
+        }
+    }
 
-            protocol::SymbolInformation info;
-            info.name = symbol.name;
-            info.kind = to_lsp_symbol_kind(symbol.kind);
-            info.location = std::move(*def_loc);
-            results.push_back(std::move(info));
-            seen.insert(hash);
+    std::vector<protocol::SymbolInformation> results;
+    for(auto& candidate: std::move(top).take_sorted()) {
+        std::optional<protocol::Location> def_loc;
+        auto def_it = project.definitions.find(candidate.hash);
+        if(def_it != project.definitions.end() && !open_definitions.contains(candidate.hash)) {
+            def_loc = recorded_definition_location(def_it->second);
+        } else {
+            // Defined in an open file, or in an index without recorded definitions.
+            def_loc = find_definition_location(candidate.hash);
         }
+        if(!def_loc)
+            continue;
+
+        protocol::SymbolInformation info;
+        info.name = candidate.name.str();
+        info.kind = to_lsp_symbol_kind(candidate.kind);
+        info.location = std::move(*def_loc);
+        results.push_back(std::move(info));
     }
     return results;
 }
@@ -790,7 +1633,9 @@ void Indexer::resume_indexing() {
 
 kota::task<> Indexer::stop() {
     bg_tasks.cancel();
-    co_await bg_tasks.join();
+    // A merge batch in flight is running on the merge thread, let it finish.
+    stopping = true;
+    co_await kota::when_all(bg_tasks.join(), merge_tasks.join());
 }
 
 void Indexer::schedule() {
@@ -815,7 +1660,8 @@ kota::task<> Indexer::index_one(std::uint32_t server_path_id) {
     if(sessions.contains(server_path_id))
         co_return;
 
-    if(!need_update(file_path))
+    auto name_retry = name_retries.erase(server_path_id);
+    if(!name_retry && !need_update(file_path))
         co_return;
 
     // For module interface units, compile their PCM (and transitive deps)
@@ -832,6 +1678,11 @@ kota::task<> Indexer::index_one(std::uint32_t server_path_id) {
 
     workspace.fill_pcm_deps(params.pcms);
 
+    if(!name_retry) {
+        refresh_known_symbols();
+        params.known_symbols = known_symbols_generation;
+    }
+
     LOG_INFO("Background indexing: {}", file_path);
 
     auto result = co_await pool.send_stateless(params);
@@ -849,6 +1700,33 @@ kota::task<> Indexer::index_one(std::uint32_t server_path_id) {
     }
 }
 
+void Indexer::refresh_known_symbols() {
+    // Building the filter scans the whole table and the broadcast costs about
+    // 3 bytes per symbol and worker, so wait until the table grew by a quarter.
+    constexpr std::size_t min_symbols = 4096;
+    auto& symbols = workspace.project_index.symbols;
+    if(symbols.size() < min_symbols || symbols.size() < known_symbols_count * 5 / 4)
+        return;
+
+    BloomFilter filter(symbols.size());
+    for(auto& [hash, symbol]: symbols) {
+        if(!symbol.name.empty()) {
+            filter.insert(hash);
+        }
+    }
+
+    known_symbols_generation += 1;
+    known_symbols_count = symbols.size();
+    pool.notify_stateless(worker::KnownSymbolsParams{
+        .generation = known_symbols_generation,
+        .filter = filter.serialize(),
+    });
+    LOG_INFO("Sent known-symbol filter {}: {} symbols, {} bytes",
+             known_symbols_generation,
+             known_symbols_count,
+             filter.bytes());
+}
+
 kota::task<> Indexer::monitor_resources() {
     while(true) {
         co_await kota::sleep(std::chrono::milliseconds(3000));
@@ -921,7 +1799,8 @@ kota::task<> Indexer::run_background_indexing() {
 
         auto server_path_id = index_queue[index_queue_pos++];
         auto file_path = std::string(workspace.path_pool.resolve(server_path_id));
-        if(sessions.contains(server_path_id) || !need_update(file_path)) {
+        if(sessions.contains(server_path_id) ||
+           (!name_retries.contains(server_path_id) && !need_update(file_path))) {
             ++completed;
             continue;
         }
@@ -955,6 +1834,8 @@ kota::task<> Indexer::run_background_indexing() {
 
     indexing_active = false;
     LOG_INFO("Background indexing complete: {} files dispatched", dispatched);
+    // A save while compacting is deferred until the compaction is done.
+    compact();
     save(workspace.config.project.index_dir);
 }
 
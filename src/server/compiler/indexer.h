@@ -4,11 +4,15 @@
 #include <functional>
 #include <memory>
 #include <optional>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "semantic/relation_kind.h"
 #include "semantic/symbol_kind.h"
+#include "server/compiler/query_cache.h"
+#include "server/workspace/index_journal.h"
+#include "server/workspace/shard_pack.h"
 #include "server/workspace/workspace.h"
 
 #include "kota/async/async.h"
@@ -16,7 +20,9 @@
 #include "kota/ipc/lsp/position.h"
 #include "kota/ipc/lsp/progress.h"
 #include "kota/ipc/lsp/protocol.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 
@@ -62,7 +68,7 @@ public:
             Compiler& compiler,
             std::function<bool(std::uint32_t)> is_file_open = {}) :
         loop(loop), bg_tasks(loop), workspace(workspace), sessions(sessions), pool(pool),
-        compiler(compiler), is_file_open(std::move(is_file_open)) {}
+        compiler(compiler), is_file_open(std::move(is_file_open)), merge_tasks(loop) {}
 
     /// Set the LSP peer for progress reporting.  Must be called before
     /// schedule() if progress notifications are desired.
@@ -111,13 +117,33 @@ public:
     /// Schedule background indexing (respects idle timeout and dedup).
     void schedule();
 
-    /// Merge a TUIndex result into Workspace's ProjectIndex and MergedIndex shards.
+    /// Queue a TUIndex result for merging into Workspace's ProjectIndex and
+    /// MergedIndex shards.  The data is appended to the index journal first,
+    /// and a full save is taken once the journal grows too large.
+    ///
+    /// Shards are merged on a worker thread into private writers, then their
+    /// snapshots replace the published shards on the event loop, so queries
+    /// never wait for a merge and never see a half merged shard.
     void merge(const void* tu_index_data, std::size_t size);
 
-    /// Save Workspace's ProjectIndex and MergedIndex shards to disk.
+    /// Compact the MergedIndex shards holding removed contexts, a few shards
+    /// at a time on the merge thread.  Queued merges always go first, and
+    /// nothing is compacted while background indexing is active.
+    void compact();
+
+    /// Save Workspace's ProjectIndex and MergedIndex shards to disk, then
+    /// checkpoint the index journal.  While merges are in flight the save is
+    /// deferred until the merge queue drains.
     void save(llvm::StringRef index_dir);
 
-    /// Load Workspace's ProjectIndex and MergedIndex shards from disk.
+    /// Make merged results durable before exit.  Every merge is already in
+    /// the journal, so this only saves in full when there is no journal.
+    void flush(llvm::StringRef index_dir);
+
+    /// Load Workspace's ProjectIndex and register MergedIndex shards on disk,
+    /// then queue the records of the index journal left by the previous
+    /// session for merging in the background.
+    /// Shards are mapped lazily by the first query that touches them.
     void load(llvm::StringRef index_dir);
 
     /// Check whether a file needs re-indexing (stale or missing shard).
@@ -130,6 +156,18 @@ public:
                                                     RelationKind kind,
                                                     Session* session);
 
+    /// Like query_relations() for each of `kinds`, but hands the locations to
+    /// `on_batch` as they are found: open files first, then the shards of the
+    /// files which were not open a batch at a time.  The walk yields to the
+    /// event loop between batches, so cancelling the awaiting request (e.g. by
+    /// $/cancelRequest) stops it there.  Shard results come from and fill the
+    /// same `query_cache` as shard_relations().
+    kota::task<> stream_relations(llvm::StringRef path,
+                                  const protocol::Position& position,
+                                  llvm::ArrayRef<RelationKind> kinds,
+                                  Session* session,
+                                  std::function<void(std::vector<protocol::Location>)> on_batch);
+
     /// Look up symbol info (hash, name, kind, range) at a cursor position.
     /// @param session  Active Session for this file, or nullptr.
     std::optional<SymbolInfo> lookup_symbol(const std::string& uri,
@@ -186,12 +224,15 @@ public:
     /// Collect references (or definitions) with context lines from stored content.
     std::vector<ReferenceWithContext> collect_references(index::SymbolHash hash, RelationKind kind);
 
-    /// Cancel background indexing and wait for all tasks to settle.
+    /// Cancel background indexing and wait for all tasks to settle.  The merge
+    /// batch in flight is finished, queued merges stay in the index journal
+    /// and a save does not checkpoint past them.
     kota::task<> stop();
 
-    /// Whether background indexing is currently idle (no active or queued work).
+    /// Whether background indexing is currently idle (no active, queued or
+    /// merging work).
     bool is_idle() const {
-        return !indexing_active && index_queue_pos >= index_queue.size();
+        return !indexing_active && !merging && index_queue_pos >= index_queue.size();
     }
 
     /// Number of files remaining in the indexing queue.
@@ -204,6 +245,24 @@ public:
         return index_queue.size();
     }
 
+    /// Resident memory accounting of the MergedIndex shards.
+    struct ShardMemoryStats {
+        /// Heap bytes held by shard writers and by snapshots not on disk.
+        std::size_t resident_bytes = 0;
+        /// Number of shard writers released, leaving only their snapshot.
+        std::size_t shrunk = 0;
+        /// Number of shards written to disk and released.
+        std::size_t dropped = 0;
+        /// Number of shards compacted.
+        std::size_t compacted = 0;
+        /// Heap bytes reclaimed by compaction.
+        std::size_t reclaimed_bytes = 0;
+    };
+
+    const ShardMemoryStats& memory_stats() const {
+        return shard_memory;
+    }
+
     /// Convert internal SymbolKind to LSP SymbolKind.
     static protocol::SymbolKind to_lsp_symbol_kind(SymbolKind kind);
 
@@ -224,6 +283,27 @@ private:
                              const protocol::Position& position,
                              Session* session);
 
+    /// The `kind` relations of `hash` in every shard referencing it, from
+    /// `query_cache` unless a merge touched one of those shards since they
+    /// were collected.  Returns nullptr for a symbol no file references.
+    const CachedRelations* shard_relations(index::SymbolHash hash, RelationKind kind);
+
+    /// The entry of `query_cache` used by shard_relations(), or nullptr if
+    /// there is none or it is stale.
+    const CachedRelations* cached_relations(index::SymbolHash hash, RelationKind kind);
+
+    /// Append the `kind` relations of `hash` in the shard of `file_id` to
+    /// `relations`, if there are any.
+    void collect_shard_relations(index::SymbolHash hash,
+                                 RelationKind kind,
+                                 std::uint32_t file_id,
+                                 CachedRelations& relations);
+
+    /// Append the locations of `kind` relations of `hash` in all open files.
+    void collect_open_file_locations(index::SymbolHash hash,
+                                     RelationKind kind,
+                                     std::vector<protocol::Location>& locations);
+
     /// Collect relations grouped by target symbol, across all index sources.
     void collect_grouped_relations(
         index::SymbolHash hash,
@@ -235,9 +315,82 @@ private:
                                 RelationKind kind,
                                 llvm::SmallVectorImpl<index::SymbolHash>& targets);
 
+    /// Project-level path_ids whose shards may define a symbol which has no
+    /// recorded definition.  Empty unless the ProjectIndex was loaded with
+    /// partial definitions, then every file referencing the symbol.
+    llvm::SmallVector<std::uint32_t> unrecorded_definition_files(index::SymbolHash hash) const;
+
+    /// Convert a definition recorded in the ProjectIndex into a Location with
+    /// the line table of its shard.  Fails for an open file, whose session is
+    /// more recent than the record.
+    std::optional<protocol::Location>
+        recorded_definition_location(const index::SymbolDefinition& definition);
+
     /// Resolve a symbol hash into a SymbolInfo with definition location.
     std::optional<SymbolInfo> resolve_symbol(index::SymbolHash hash);
 
+    /// A decoded TUIndex and the shard merges it turns into.
+    struct PendingMerge;
+
+    /// A snapshot of a shard writer, ready to be published.
+    struct ShardSnapshot {
+        std::uint32_t path_id;
+        index::MergedIndex index;
+        /// Heap bytes of the writer it was taken from.
+        std::size_t writer_bytes;
+    };
+
+    /// The mutable form of a shard, owned by the merge pipeline.
+    struct ShardWriter {
+        index::MergedIndex index;
+        std::size_t resident_bytes = 0;
+    };
+
+    /// Merge queued TUIndex data batch by batch until the queue is empty, then
+    /// compact shards while there is nothing else to do.
+    kota::task<> run_merges();
+
+    /// Compact one batch of `compaction_candidates` and publish the results.
+    kota::task<> compact_shards();
+
+    /// Snapshot the `touched` shards on the merge thread, then publish them
+    /// together with the symbols of `merges`.  Clears both and returns true on
+    /// success.
+    kota::task<bool> publish_merges(std::vector<PendingMerge>& merges,
+                                    llvm::DenseSet<std::uint32_t>& touched);
+
+    /// On the event loop: intern the paths of the TUIndex into the ProjectIndex
+    /// and prepare a writer for every shard it touches.  Returns false for
+    /// unusable data.
+    bool claim(PendingMerge& merge);
+
+    /// On the event loop: merge the symbols and definitions of a claimed
+    /// TUIndex into the ProjectIndex, when its shards are published.
+    void merge_symbols(PendingMerge& merge);
+
+    /// On the merge thread: merge the file indices into the shard writers.
+    void merge_shards(PendingMerge& merge, llvm::DenseSet<std::uint32_t>& touched);
+
+    /// On the merge thread: serialize the touched writers for publication.
+    std::vector<ShardSnapshot> take_snapshots(const llvm::DenseSet<std::uint32_t>& touched);
+
+    /// On the event loop: replace the published shards by the snapshots.
+    void publish(std::vector<ShardSnapshot>& snapshots);
+
+    /// Write the snapshots of `shards` to `index_dir`, in the shard pack if it
+    /// is enabled and in their own files otherwise, and map them from there
+    /// instead of keeping them on the heap.  Returns the number written.
+    std::size_t write_shards(llvm::StringRef index_dir,
+                             llvm::ArrayRef<std::pair<std::uint32_t, MergedIndexShard*>> shards);
+
+    /// After a complete save: release the stored contents no shard references
+    /// any more, if contents were added since the last time.
+    void collect_contents();
+
+    /// Release writers, then drop snapshots to disk, of the least recently used
+    /// shards until their resident memory fits in `index_memory_limit`.
+    void enforce_memory_limit();
+
     /// Check whether a project-level path_id has an active Session.
     bool is_proj_path_open(std::uint32_t proj_path_id) const {
         return is_file_open && is_file_open(proj_path_id);
@@ -266,6 +419,75 @@ private:
     bool indexing_scheduled = false;
     std::shared_ptr<kota::timer> index_idle_timer;
 
+    /// Generation of the known-symbol filter last sent to the stateless
+    /// workers, 0 before the first one.
+    std::uint64_t known_symbols_generation = 0;
+
+    /// Size of the symbol table when that filter was built.
+    std::size_t known_symbols_count = 0;
+
+    /// Server path_ids to index again with all symbol names, because the
+    /// known-symbol filter dropped a name the ProjectIndex did not have.
+    llvm::DenseSet<std::uint32_t> name_retries;
+
+    ShardMemoryStats shard_memory;
+
+    /// Journal of the TUIndex data merged since the last save.
+    IndexJournal journal;
+
+    /// The packed shard store, see ShardPack.  Always read on load, written
+    /// only with `packed_index` enabled.
+    ShardPack shard_pack;
+
+    /// Shards saved in their own file.  The pack may hold an older copy of
+    /// them, so with `packed_index` enabled they are rewritten into it.
+    llvm::DenseSet<std::uint32_t> loose_shards;
+
+    /// A TUIndex journaled but not merged yet.
+    struct QueuedMerge {
+        /// Journal sequence number of the record, 0 without a journal.
+        std::uint64_t sequence = 0;
+        std::string data;
+    };
+
+    /// TUIndex data journaled but not merged yet, in arrival order.
+    std::vector<QueuedMerge> merge_queue;
+
+    /// Journal sequence numbers of the records queued, merged or failed but
+    /// not published.  A save checkpoints the journal only up to the oldest,
+    /// so they are replayed by the next session.
+    std::set<std::uint64_t> unpublished_records;
+
+    /// Whether the merge task is running.  Writers are only touched by the
+    /// merge thread while it is, queries read Workspace::merged_indices.
+    bool merging = false;
+
+    /// Stop merging after the batch in flight.
+    bool stopping = false;
+
+    /// A save was requested while merging, it is taken once the queue drains.
+    bool save_requested = false;
+
+    /// Shard writers keyed by project-level path_id.  Kept between batches so
+    /// a shard merged again is not rebuilt from its snapshot.
+    llvm::DenseMap<std::uint32_t, ShardWriter> writers;
+
+    /// Project-level path_ids of the published shards with removed contexts.
+    llvm::DenseSet<std::uint32_t> compaction_candidates;
+
+    /// Advanced by every merge batch that publishes shards.
+    std::uint64_t index_epoch = 0;
+
+    /// The index epoch at which a merge last republished each shard, keyed by
+    /// project-level path_id.  Shards loaded from disk and not merged since
+    /// have none, i.e. epoch 0.
+    llvm::DenseMap<std::uint32_t, std::uint64_t> shard_epochs;
+
+    /// Shard results of recent cross-file queries.
+    QueryCache query_cache;
+
+    kota::task_group<> merge_tasks;
+
     /// Concurrency control for background indexing.
     std::size_t max_concurrent = 2;
     std::size_t baseline_concurrent = 2;
@@ -275,6 +497,10 @@ private:
     std::size_t pause_depth = 0;
     kota::event resume_event{true};
 
+    /// Send the stateless workers a new filter of the named symbols of the
+    /// ProjectIndex once the symbol table outgrew the last one.
+    void refresh_known_symbols();
+
     kota::task<> run_background_indexing();
     kota::task<> index_one(std::uint32_t server_path_id);
     kota::task<> monitor_resources();
@@ -0,0 +1,66 @@
+#include "server/compiler/pch_prebuilder.h"
+
+#include <chrono>
+
+namespace clice {
+
+PCHPrebuilder::PCHPrebuilder(kota::event_loop& loop, wait_fn wait, build_fn build) :
+    wait(std::move(wait)), build(std::move(build)), tasks(loop) {}
+
+bool PCHPrebuilder::schedule(std::uint32_t path_id, std::uint64_t preamble, int delay) {
+    if(preamble == 0) {
+        cancel(path_id);
+        return false;
+    }
+
+    auto [it, inserted] = scheduled.try_emplace(path_id, preamble);
+    if(!inserted) {
+        if(it->second == preamble)
+            return false;
+        it->second = preamble;
+    }
+    return tasks.spawn(run(path_id, preamble, delay));
+}
+
+bool PCHPrebuilder::current(std::uint32_t path_id, std::uint64_t preamble) const {
+    auto it = scheduled.find(path_id);
+    return it != scheduled.end() && it->second == preamble;
+}
+
+void PCHPrebuilder::cancel(std::uint32_t path_id) {
+    scheduled.erase(path_id);
+}
+
+kota::task<> PCHPrebuilder::stop() {
+    scheduled.clear();
+    tasks.cancel();
+    co_await tasks.join();
+}
+
+kota::task<> PCHPrebuilder::run(std::uint32_t path_id, std::uint64_t preamble, int delay) {
+    co_await kota::sleep(std::chrono::milliseconds(delay));
+
+    while(current(path_id, preamble)) {
+        // A superseded prebuild cannot be stopped inside its worker, build one
+        // PCH of the file at a time.
+        if(auto it = running.find(path_id); it != running.end()) {
+            auto building = it->second;
+            co_await building->wait();
+            continue;
+        }
+
+        // Interactive work goes first.
+        co_await wait(path_id);
+        if(!current(path_id, preamble) || running.contains(path_id))
+            continue;
+
+        auto done = std::make_shared<kota::event>();
+        running[path_id] = done;
+        co_await build(path_id, preamble);
+        running.erase(path_id);
+        done->set();
+        co_return;
+    }
+}
+
+}  // namespace clice
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "kota/async/async.h"
+#include "llvm/ADT/DenseMap.h"
+
+namespace clice {
+
+/// Schedules speculative PCH builds of open files.
+///
+/// schedule() is called on every edit with the hash of the file's preamble.
+/// Once a preamble has stayed the scheduled one for the delay, its prebuild
+/// waits for the interactive work on the file (`wait_fn`) and for an earlier
+/// prebuild of the file, then builds the PCH (`build_fn`).  A newer preamble
+/// or cancel() supersedes it: a prebuild still waiting gives up, and a running
+/// one sees it through current() and stops after the link it is building.
+class PCHPrebuilder {
+public:
+    /// Waits until no interactive work on the file is in flight.
+    using wait_fn = std::function<kota::task<>(std::uint32_t path_id)>;
+
+    /// Builds the PCH of the preamble of the file.
+    using build_fn = std::function<kota::task<>(std::uint32_t path_id, std::uint64_t preamble)>;
+
+    PCHPrebuilder(kota::event_loop& loop, wait_fn wait, build_fn build);
+
+    /// Schedule a prebuild of `preamble` for `path_id` in `delay` milliseconds,
+    /// superseding the one scheduled before.  A `preamble` of 0 (not complete
+    /// yet) only supersedes.  Returns whether a new prebuild was scheduled,
+    /// which is not the case for the preamble scheduled already.
+    bool schedule(std::uint32_t path_id, std::uint64_t preamble, int delay);
+
+    /// Whether `preamble` is still the one scheduled for `path_id`.
+    bool current(std::uint32_t path_id, std::uint64_t preamble) const;
+
+    /// Supersede the prebuild of `path_id`, e.g. when the file is closed.
+    void cancel(std::uint32_t path_id);
+
+    /// Cancel all prebuilds and wait for them to finish.
+    kota::task<> stop();
+
+private:
+    kota::task<> run(std::uint32_t path_id, std::uint64_t preamble, int delay);
+
+    wait_fn wait;
+    build_fn build;
+
+    /// The preamble scheduled for each file.
+    llvm::DenseMap<std::uint32_t, std::uint64_t> scheduled;
+
+    /// The prebuild of each file which is building, set when it finishes.
+    llvm::DenseMap<std::uint32_t, std::shared_ptr<kota::event>> running;
+
+    kota::task_group<> tasks;
+};
+
+}  // namespace clice
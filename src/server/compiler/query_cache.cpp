@@ -0,0 +1,74 @@
+#include "server/compiler/query_cache.h"
+
+#include <iterator>
+
+namespace clice {
+
+std::size_t CachedRelations::heap_bytes() const {
+    auto bytes = files.capacity() * sizeof(File);
+    for(auto& file: files) {
+        bytes += file.ranges.capacity() * sizeof(file.ranges[0]);
+    }
+    return bytes;
+}
+
+const CachedRelations* QueryCache::find(index::SymbolHash symbol,
+                                        RelationKind kind,
+                                        std::uint64_t epoch,
+                                        std::uint64_t file_count) {
+    auto it = index.find(Key(symbol, kind.value()));
+    if(it == index.end()) {
+        miss_count += 1;
+        return nullptr;
+    }
+
+    auto& relations = it->second->relations;
+    if(relations.epoch < epoch || relations.file_count != file_count) {
+        erase(it->second);
+        miss_count += 1;
+        return nullptr;
+    }
+
+    entries.splice(entries.begin(), entries, it->second);
+    hit_count += 1;
+    return &relations;
+}
+
+const CachedRelations& QueryCache::insert(index::SymbolHash symbol,
+                                          RelationKind kind,
+                                          CachedRelations relations) {
+    Key key(symbol, kind.value());
+    if(auto it = index.find(key); it != index.end()) {
+        erase(it->second);
+    }
+
+    auto bytes = sizeof(Entry) + relations.heap_bytes();
+    if(bytes > byte_budget / 8) {
+        uncached = std::move(relations);
+        return uncached;
+    }
+
+    entries.push_front(Entry{key, std::move(relations), bytes});
+    index[key] = entries.begin();
+    total_bytes += bytes;
+
+    while(entries.size() > capacity || total_bytes > byte_budget) {
+        erase(std::prev(entries.end()));
+    }
+    return entries.front().relations;
+}
+
+void QueryCache::clear() {
+    entries.clear();
+    index.clear();
+    total_bytes = 0;
+    uncached = {};
+}
+
+void QueryCache::erase(std::list<Entry>::iterator entry) {
+    total_bytes -= entry->bytes;
+    index.erase(entry->key);
+    entries.erase(entry);
+}
+
+}  // namespace clice
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <utility>
+#include <vector>
+
+#include "index/tu_index.h"
+#include "semantic/relation_kind.h"
+
+#include "kota/ipc/lsp/protocol.h"
+#include "llvm/ADT/DenseMap.h"
+
+namespace clice {
+
+namespace protocol = kota::ipc::protocol;
+
+/// The relations of one kind of a symbol found in the MergedIndex shards, with
+/// their ranges already converted to positions.
+struct CachedRelations {
+    struct File {
+        /// Project-level path_id of the shard.
+        std::uint32_t path_id = 0;
+
+        /// (target symbol, range) of every relation in the shard.
+        std::vector<std::pair<index::SymbolHash, protocol::Range>> ranges;
+    };
+
+    /// The index epoch the relations were collected at.
+    std::uint64_t epoch = 0;
+
+    /// How many files referenced the symbol at that time.
+    std::uint64_t file_count = 0;
+
+    /// Shards with at least one relation.  Open files are included, the
+    /// caller skips them in favor of the open file index.
+    std::vector<File> files;
+
+    /// Heap bytes held by `files`.
+    std::size_t heap_bytes() const;
+};
+
+/// An LRU cache of shard query results keyed by (symbol, relation kind).
+///
+/// Entries are never invalidated eagerly.  The Indexer advances the epoch of a
+/// shard whenever a merge republishes it, and an entry is only used while no
+/// shard referencing the symbol has a newer epoch than the entry, so repeated
+/// queries between merges skip decoding and position conversion.
+///
+/// The cache holds at most `capacity` entries and `byte_budget` heap bytes.
+/// A result larger than an eighth of the budget is not cached at all, one
+/// symbol referenced everywhere would otherwise evict every other entry.
+class QueryCache {
+public:
+    explicit QueryCache(std::size_t capacity = 256, std::size_t byte_budget = 64 * 1024 * 1024) :
+        capacity(capacity), byte_budget(byte_budget) {}
+
+    /// The entry of (`symbol`, `kind`) if it is not older than `epoch` and was
+    /// collected over `file_count` files.  A hit becomes the most recently used.
+    const CachedRelations* find(index::SymbolHash symbol,
+                                RelationKind kind,
+                                std::uint64_t epoch,
+                                std::uint64_t file_count);
+
+    /// Insert or replace the entry of (`symbol`, `kind`), evicting the least
+    /// recently used entries beyond the capacity or the byte budget.  A result
+    /// too large to cache only drops the old entry.  The returned reference
+    /// stays valid until the next insert.
+    const CachedRelations& insert(index::SymbolHash symbol,
+                                  RelationKind kind,
+                                  CachedRelations relations);
+
+    void clear();
+
+    std::size_t size() const {
+        return entries.size();
+    }
+
+    /// Heap bytes of the cached entries.
+    std::size_t bytes() const {
+        return total_bytes;
+    }
+
+    std::uint64_t hits() const {
+        return hit_count;
+    }
+
+    std::uint64_t misses() const {
+        return miss_count;
+    }
+
+private:
+    using Key = std::pair<index::SymbolHash, std::uint32_t>;
+
+    struct Entry {
+        Key key;
+        CachedRelations relations;
+        std::size_t bytes = 0;
+    };
+
+    void erase(std::list<Entry>::iterator entry);
+
+    std::size_t capacity;
+
+    std::size_t byte_budget;
+
+    std::size_t total_bytes = 0;
+
+    /// The last inserted result which was too large to cache.
+    CachedRelations uncached;
+
+    /// Most recently used first.
+    std::list<Entry> entries;
+
+    llvm::DenseMap<Key, std::list<Entry>::iterator> index;
+
+    std::uint64_t hit_count = 0;
+    std::uint64_t miss_count = 0;
+};
+
+}  // namespace clice
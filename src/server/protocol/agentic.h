@@ -209,6 +209,9 @@ struct StatusResult {
     int pending = 0;
     int total = 0;
     int indexed = 0;
+    std::uint64_t index_memory = 0;
+    int shrunk_shards = 0;
+    int dropped_shards = 0;
 };
 
 struct ShutdownParams {};
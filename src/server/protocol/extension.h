@@ -2,10 +2,15 @@
 
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "kota/ipc/lsp/protocol.h"
+
 namespace clice::ext {
 
+namespace protocol = kota::ipc::protocol;
+
 struct ContextItem {
     std::string label;
     std::string description;
@@ -39,4 +44,20 @@ struct SwitchContextResult {
     bool success = false;
 };
 
+/// A `$/progress` notification carrying a batch of partial locations for
+/// the request that passed `token` as its partialResultToken.
+struct PartialLocationsParams {
+    protocol::ProgressToken token;
+    std::vector<protocol::Location> value;
+};
+
 }  // namespace clice::ext
+
+namespace kota::ipc::protocol {
+
+template <>
+struct NotificationTraits<clice::ext::PartialLocationsParams> {
+    constexpr inline static std::string_view method = "$/progress";
+};
+
+}  // namespace kota::ipc::protocol
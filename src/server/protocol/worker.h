@@ -41,6 +41,9 @@ struct CompileParams {
     std::string path;
     int version;
     std::string text;
+    /// `text` is left empty, compile the worker's copy of the text, which
+    /// DocumentUpdateParams edits brought to `version`.
+    bool incremental = false;
     std::string directory;
     std::vector<std::string> arguments;
     std::pair<std::string, uint32_t> pch;
@@ -55,6 +58,9 @@ struct CompileResult {
     std::vector<std::string> deps;
     /// Serialized TUIndex for the main file (interested_only=true).
     std::string tu_index_data;
+    /// An incremental compile found no copy of the text at `version`, nothing
+    /// was compiled.  Send the full text again.
+    bool need_text = false;
 };
 
 /// Kind of build task dispatched to a stateless worker.
@@ -70,9 +76,10 @@ enum class BuildKind : uint8_t {
 /// Unified parameters for all stateless build/compilation tasks.
 /// Fields are used selectively based on `kind`:
 ///   - All:           file, directory, arguments
-///   - BuildPCH:      + content, preamble_bound, output_path
+///   - BuildPCH:      + content, preamble_bound, output_path, pch (to chain on),
+///                    background
 ///   - BuildPCM:      + module_name, pcms, output_path
-///   - Index:         + pcms
+///   - Index:         + pcms, known_symbols
 ///   - Completion:    + text, version, offset, pch, pcms
 ///   - SignatureHelp: + text, version, offset, pch, pcms
 ///   - Format:        + text, format_range (optional)
@@ -93,6 +100,8 @@ struct BuildParams {
     std::string module_name;               ///< BuildPCM
     uint32_t preamble_bound = UINT32_MAX;  ///< BuildPCH
     LocalSourceRange format_range;         ///< Format (default = full document)
+    uint64_t known_symbols = 0;            ///< Index: KnownSymbolsParams generation, 0 = none
+    bool background = false;               ///< BuildPCH: speculative, run at low priority
 };
 
 /// Unified result for stateless build tasks.
@@ -108,9 +117,31 @@ struct BuildResult {
     kota::codec::RawValue result_json;  ///< Completion/SignatureHelp result
 };
 
+/// Replace the bytes [begin, end) of a document with `text`.
+struct TextEdit {
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    std::string text;
+};
+
+/// The document changed from `previous_version` to `version`.  The worker
+/// applies `edits` in order to its copy of the text if the copy is at
+/// `previous_version`, otherwise, or if there are no edits, it drops the copy
+/// and the next compile sends the full text.
 struct DocumentUpdateParams {
     std::string path;
     int version;
+    int previous_version = 0;
+    std::vector<TextEdit> edits;
+};
+
+/// Broadcast to stateless workers: a filter of the symbol hashes whose names
+/// the master already knows.  An Index task naming the same generation leaves
+/// those names out of its TUIndex.
+struct KnownSymbolsParams {
+    uint64_t generation = 0;
+    /// A serialized BloomFilter.
+    std::string filter;
 };
 
 struct EvictParams {
@@ -148,6 +179,11 @@ struct NotificationTraits<clice::worker::DocumentUpdateParams> {
     constexpr inline static std::string_view method = "clice/worker/documentUpdate";
 };
 
+template <>
+struct NotificationTraits<clice::worker::KnownSymbolsParams> {
+    constexpr inline static std::string_view method = "clice/worker/knownSymbols";
+};
+
 template <>
 struct NotificationTraits<clice::worker::EvictParams> {
     constexpr inline static std::string_view method = "clice/worker/evict";
@@ -65,7 +65,7 @@ static std::vector<ResolvedSymbol> resolve_locator(const agentic::ReadSymbolPara
         std::vector<ResolvedSymbol> exact_matches;
         llvm::DenseSet<index::SymbolHash> seen;
 
-        auto try_symbol = [&](index::SymbolHash hash, const index::Symbol& symbol) {
+        auto try_symbol = [&](index::SymbolHash hash, const auto& symbol) {
             if(symbol.name.empty())
                 return;
             if(llvm::StringRef(symbol.name).lower().find(query_lower) == std::string::npos)
@@ -93,7 +93,7 @@ static std::vector<ResolvedSymbol> resolve_locator(const agentic::ReadSymbolPara
             bool is_exact = llvm::StringRef(symbol.name).lower() == query_lower ||
                             llvm::StringRef(symbol.name).ends_with("::" + *loc.name);
 
-            ResolvedSymbol rs{hash, symbol.name, symbol.kind, std::move(file), line_num};
+            ResolvedSymbol rs{hash, std::string(symbol.name), symbol.kind, std::move(file), line_num};
             if(is_exact)
                 exact_matches.push_back(std::move(rs));
             else
@@ -167,7 +167,7 @@ static std::vector<ResolvedSymbol> resolve_locator(const agentic::ReadSymbolPara
                                             });
             if(found)
                 return {
-                    {hash, symbol.name, symbol.kind, path_str, *loc.line}
+                    {hash, symbol.name.str(), symbol.kind, path_str, *loc.line}
                 };
         }
 
@@ -402,7 +402,7 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
         SymbolSearchResult result;
         llvm::DenseSet<index::SymbolHash> seen;
 
-        auto try_symbol = [&](index::SymbolHash hash, const index::Symbol& symbol) {
+        auto try_symbol = [&](index::SymbolHash hash, const auto& symbol) {
             if(static_cast<int>(result.symbols.size()) >= max)
                 return;
             if(symbol.name.empty())
@@ -423,7 +423,7 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
                 return;
             auto file = uri_to_path(def_loc->uri);
             result.symbols.push_back(SymbolEntry{
-                .name = symbol.name,
+                .name = std::string(symbol.name),
                 .kind = std::string(symbol_kind_name(symbol.kind)),
                 .file = std::move(file),
                 .line = static_cast<int>(def_loc->range.start.line) + 1,
@@ -544,7 +544,7 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
                     RelationKind::Definition,
                     [&](const index::Relation&, protocol::Range range) {
                         result.symbols.push_back(DocumentSymbolEntry{
-                            .name = symbol.name,
+                            .name = symbol.name.str(),
                             .kind = std::string(symbol_kind_name(symbol.kind)),
                             .start_line = static_cast<int>(range.start.line) + 1,
                             .end_line = static_cast<int>(range.end.line) + 1,
@@ -775,6 +775,10 @@ AgentClient::AgentClient(MasterServer& server, kota::ipc::JsonPeer& peer) :
         result.pending = static_cast<int>(srv.indexer.pending_files());
         result.total = static_cast<int>(srv.indexer.total_queued());
         result.indexed = std::max(0, result.total - result.pending);
+        auto& memory = srv.indexer.memory_stats();
+        result.index_memory = memory.resident_bytes;
+        result.shrunk_shards = static_cast<int>(memory.shrunk);
+        result.dropped_shards = static_cast<int>(memory.dropped);
         co_return result;
     });
 
@@ -186,8 +186,15 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         if(!session)
             return;
 
+        auto previous_version = session->version;
         session->version = params.text_document.version;
 
+        // While the worker holds the previous text, forward the changes as
+        // byte edits so the next compile does not resend the whole file.  A
+        // whole-document change is not forwarded, the compile sends it anyway.
+        bool synced = session->synced_version == previous_version;
+        std::vector<worker::TextEdit> edits;
+
         for(auto& change: params.content_changes) {
             std::visit(
                 [&](auto& c) {
@@ -195,6 +202,7 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
                     if constexpr(std::is_same_v<T,
                                                 protocol::TextDocumentContentChangeWholeDocument>) {
                         session->text = c.text;
+                        synced = false;
                     } else {
                         auto& range = c.range;
                         lsp::PositionMapper mapper(session->text, lsp::PositionEncoding::UTF16);
@@ -202,6 +210,15 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
                         auto end = mapper.to_offset(range.end);
                         if(start && end && *start <= *end) {
                             session->text.replace(*start, *end - *start, c.text);
+                            if(synced) {
+                                edits.push_back({
+                                    .begin = static_cast<std::uint32_t>(*start),
+                                    .end = static_cast<std::uint32_t>(*end),
+                                    .text = c.text,
+                                });
+                            }
+                        } else {
+                            synced = false;
                         }
                     }
                 },
@@ -219,7 +236,14 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
         worker::DocumentUpdateParams update;
         update.path = path;
         update.version = session->version;
+        if(synced) {
+            update.previous_version = previous_version;
+            update.edits = std::move(edits);
+        }
+        session->synced_version = synced ? session->version : -1;
         srv.pool.notify_stateful(path_id, update);
+
+        srv.compiler.schedule_pch_prebuild(*session);
     });
 
     peer.on_notification([this](const protocol::DidCloseTextDocumentParams& params) {
@@ -318,10 +342,9 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
             auto& links = result.value();
             auto* session2 = srv.find_session(path_id);
             if(session2 && session2->pch_ref) {
-                auto& pch_cache = srv.workspace.pch_cache;
-                auto pch_it = pch_cache.find(session2->pch_ref->path_id);
-                if(pch_it != pch_cache.end() && !pch_it->second.document_links_json.empty()) {
-                    auto& pch_json = pch_it->second.document_links_json;
+                auto* pch = srv.workspace.pch_cache.find(session2->pch_ref->hash);
+                if(pch && !pch->document_links_json.empty()) {
+                    auto& pch_json = pch->document_links_json;
                     if(!links.data.empty() && links.data != "null" && links.data.size() > 2) {
                         links.data.pop_back();
                         links.data += ',';
@@ -399,11 +422,28 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
                                                       pos);
     });
 
-    peer.on_request([this, query_at](RequestContext& ctx,
-                                     const protocol::ReferenceParams& params) -> RawResult {
+    peer.on_request([this, query_at, resolve_uri](
+                        RequestContext& ctx,
+                        const protocol::ReferenceParams& params) -> RawResult {
         auto& uri = params.text_document_position_params.text_document.uri;
         auto& pos = params.text_document_position_params.position;
 
+        // With a partialResultToken, stream the locations as $/progress
+        // batches, and the final response carries none of them.
+        if(auto& token = params.partial_result_params.partial_result_token) {
+            auto [path, path_id, session] = resolve_uri(uri);
+            auto send = [this, token = *token](std::vector<protocol::Location> batch) {
+                this->peer.send_notification(ext::PartialLocationsParams{token, std::move(batch)});
+            };
+
+            std::vector<RelationKind> kinds = {RelationKind::Reference};
+            if(params.context.include_declaration) {
+                kinds.push_back(RelationKind::Definition);
+            }
+            co_await this->server.indexer.stream_relations(path, pos, kinds, session, send);
+            co_return serde_raw{"[]"};
+        }
+
         auto locations = query_at(uri, pos, RelationKind::Reference);
 
         if(params.context.include_declaration) {
@@ -698,6 +738,7 @@ LSPClient::LSPClient(MasterServer& server, kota::ipc::JsonPeer& peer) : server(s
             session->active_context = context_path_id;
             session->header_context.reset();
             session->pch_ref.reset();
+            ws.pch_cache.release(path_id);
             session->ast_deps.reset();
             session->ast_dirty = true;
 
@@ -166,6 +166,7 @@ void MasterServer::close_session(std::uint32_t path_id, kota::ipc::JsonPeer& pee
 
     auto path = workspace.path_pool.resolve(path_id);
     workspace.on_file_closed(path_id);
+    compiler.cancel_pch_prebuild(path_id);
     pool.notify_stateful(path_id, worker::EvictParams{std::string(path)});
 
     protocol::PublishDiagnosticsParams diag_params;
@@ -208,7 +209,7 @@ void MasterServer::schedule_shutdown() {
         return;
     lifecycle = ServerLifecycle::Exited;
 
-    indexer.save(workspace.config.project.index_dir);
+    indexer.flush(workspace.config.project.index_dir);
     workspace.save_cache();
     shutdown_event.set();
 
@@ -240,8 +241,8 @@ void MasterServer::load_workspace() {
                 LOG_WARN("Failed to create {}: {}", dir, ec2.message());
         }
 
-        workspace.cleanup_cache();
         workspace.load_cache();
+        workspace.cleanup_cache();
     }
 
     std::string cdb_path;
@@ -36,6 +36,11 @@ struct Session {
     /// Used to detect stale compilation results (ABA prevention).
     std::uint64_t generation = 0;
 
+    /// The version whose text the stateful worker holds a copy of, as far as
+    /// the master knows, -1 if none.  Edits are forwarded to the worker while
+    /// it is in sync, and a compile of this version sends no text.
+    int synced_version = -1;
+
     /// Whether the AST needs to be rebuilt before serving queries.
     bool ast_dirty = true;
 
@@ -51,11 +56,11 @@ struct Session {
 
     /// Reference to the PCH entry in Workspace.pch_cache, if any.
     /// The PCH itself is owned by Workspace (shared, content-addressed);
-    /// Session only stores enough to locate and validate it.
+    /// Session only stores enough to locate and validate it.  The reference
+    /// is counted in the cache, see PCHCache::acquire().
     struct PCHRef {
-        std::uint32_t path_id = 0;  ///< Key into Workspace.pch_cache.
-        std::uint64_t hash = 0;     ///< Preamble hash at build time.
-        std::uint32_t bound = 0;    ///< Preamble byte boundary.
+        std::uint64_t hash = 0;   ///< Key into Workspace.pch_cache.
+        std::uint32_t bound = 0;  ///< Preamble byte boundary.
     };
 
     std::optional<PCHRef> pch_ref;
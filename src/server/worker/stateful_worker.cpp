@@ -1,5 +1,6 @@
 #include "server/worker/stateful_worker.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <list>
@@ -18,6 +19,7 @@
 #include "kota/ipc/codec/bincode.h"
 #include "kota/ipc/peer.h"
 #include "kota/ipc/transport.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -29,10 +31,19 @@ using RequestContext = kota::ipc::BincodePeer::RequestContext;
 struct DocumentEntry {
     int version = 0;
     std::string text;
+
+    // The latest text the master sent, at `latest_version` (-1 if unknown).
+    // Only touched on the event loop, DocumentUpdate edits apply to it while
+    // a compilation may be reading `text` on the thread pool.
+    std::string latest_text;
+    int latest_version = -1;
     bool has_ast = false;
     CompilationUnit unit{nullptr};
     std::atomic<bool> dirty{false};
 
+    // Bytes held by `unit`, measured on the thread pool after each compilation.
+    std::atomic<std::size_t> memory{0};
+
     // Signaled when the first compilation completes (has_ast becomes true).
     // Feature handlers co_await this before accessing the AST.
     kota::event ast_ready{false};
@@ -47,6 +58,16 @@ struct DocumentEntry {
     kota::mutex strand;
 };
 
+/// Apply `edits` in order to `text`.  Returns false if one is out of range.
+static bool apply_edits(std::string& text, llvm::ArrayRef<worker::TextEdit> edits) {
+    for(auto& edit: edits) {
+        if(edit.begin > edit.end || edit.end > text.size())
+            return false;
+        text.replace(edit.begin, edit.end - edit.begin, edit.text);
+    }
+    return true;
+}
+
 class StatefulWorker {
     kota::ipc::BincodePeer& peer;
     std::uint64_t memory_limit;
@@ -66,16 +87,30 @@ class StatefulWorker {
         lru_index[path] = lru.begin();
     }
 
+    std::size_t memory_usage() const {
+        std::size_t total = 0;
+        for(auto& entry: documents) {
+            total += entry.second->memory.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    /// Evict the least recently used documents until the ASTs fit in
+    /// memory_limit.  The most recently used one is always kept, even if it
+    /// alone is over the limit.
     void shrink_if_over_limit() {
-        // TODO: Implement memory-based eviction using memory_limit.
-        // For now, cap at a fixed number of documents.
-        while(documents.size() > 16 && !lru.empty()) {
+        auto total = memory_usage();
+        while(total > memory_limit && lru.size() > 1) {
             auto path = lru.back();
             lru.pop_back();
             lru_index.erase(path);
-            LOG_DEBUG("Evicting document: {}", path);
+            if(auto it = documents.find(path); it != documents.end()) {
+                auto memory = it->second->memory.load(std::memory_order_relaxed);
+                total -= std::min(total, memory);
+                LOG_DEBUG("Evicting document: {} ({}MB)", path, memory >> 20);
+                documents.erase(it);
+            }
             peer.send_notification(worker::EvictedParams{std::string(path)});
-            documents.erase(path);
         }
     }
 
@@ -126,19 +161,44 @@ void StatefulWorker::register_handlers() {
     peer.on_request(
         [this](RequestContext& ctx,
                const worker::CompileParams& params) -> RequestResult<worker::CompileParams> {
-            LOG_INFO("Compile request: path={}, version={}", params.path, params.version);
+            LOG_INFO("Compile request: path={}, version={}, incremental={}",
+                     params.path,
+                     params.version,
+                     params.incremental);
+
+            if(params.incremental) {
+                auto it = documents.find(params.path);
+                if(it == documents.end() || it->second->latest_version != params.version) {
+                    LOG_INFO("Compile needs full text: path={}, version={}",
+                             params.path,
+                             params.version);
+                    worker::CompileResult result;
+                    result.version = params.version;
+                    result.diagnostics = kota::codec::RawValue{"[]"};
+                    result.memory_usage = 0;
+                    result.need_text = true;
+                    co_return result;
+                }
+            }
 
             // Hold shared_ptr so Evict can't destroy the entry mid-compile.
             auto doc = get_or_create(params.path);
             touch_lru(params.path);
 
+            // Later edits apply to the copy, take the text at this version now.
+            if(!params.incremental) {
+                doc->latest_text = params.text;
+                doc->latest_version = params.version;
+            }
+            auto text = doc->latest_text;
+
             co_await doc->strand.lock();
 
             // Copy params to doc AFTER acquiring the strand lock, so that
             // concurrent Compile requests waiting on the strand don't
             // overwrite our fields before we use them.
             doc->version = params.version;
-            doc->text = params.text;
+            doc->text = std::move(text);
             doc->directory = params.directory;
             doc->arguments = params.arguments;
             doc->pch = params.pch;
@@ -162,6 +222,7 @@ void StatefulWorker::register_handlers() {
                 }
 
                 doc->unit = compile(cp);
+                doc->memory.store(doc->unit.memory_usage(), std::memory_order_relaxed);
                 doc->has_ast = true;
                 doc->dirty.store(false, std::memory_order_release);
 
@@ -180,7 +241,7 @@ void StatefulWorker::register_handlers() {
                     result.diagnostics = kota::codec::RawValue{"[]"};
                     LOG_WARN("Compile incomplete: path={}, {}ms", params.path, timer.ms());
                 }
-                result.memory_usage = 0;  // TODO: query actual memory
+                result.memory_usage = doc->memory.load(std::memory_order_relaxed);
                 if(doc->unit.completed()) {
                     result.deps = doc->unit.deps();
 
@@ -200,13 +261,17 @@ void StatefulWorker::register_handlers() {
         });
 
     // === DocumentUpdate ===
-    // Only mark the document dirty — do NOT update doc.text or doc.version
-    // here.  The kota::queue compilation work may be reading doc.text on the
-    // thread pool concurrently, so writing it from the event loop would be
-    // a data race.  The next Compile request will bring the correct text
-    // and update it inside the strand lock.
+    // Mark the document dirty and apply the edits to doc.latest_text — do NOT
+    // update doc.text or doc.version here.  The kota::queue compilation work
+    // may be reading doc.text on the thread pool concurrently, so writing it
+    // from the event loop would be a data race.  The next Compile request
+    // takes the text from doc.latest_text, or brings it in full, and updates
+    // doc.text inside the strand lock.
     peer.on_notification([this](const worker::DocumentUpdateParams& params) {
-        LOG_TRACE("DocumentUpdate: path={}, version={}", params.path, params.version);
+        LOG_TRACE("DocumentUpdate: path={}, version={}, {} edits",
+                  params.path,
+                  params.version,
+                  params.edits.size());
 
         auto it = documents.find(params.path);
         if(it == documents.end()) {
@@ -214,7 +279,17 @@ void StatefulWorker::register_handlers() {
             return;
         }
 
-        it->second->dirty.store(true, std::memory_order_release);
+        auto& doc = *it->second;
+        doc.dirty.store(true, std::memory_order_release);
+
+        if(params.edits.empty() || doc.latest_version != params.previous_version ||
+           !apply_edits(doc.latest_text, params.edits)) {
+            // Out of sync, the next compile brings the full text.
+            doc.latest_text.clear();
+            doc.latest_version = -1;
+            return;
+        }
+        doc.latest_version = params.version;
     });
 
     // === Evict ===
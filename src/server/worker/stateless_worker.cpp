@@ -1,10 +1,13 @@
 #include "server/worker/stateless_worker.h"
 
+#include <optional>
+
 #include "compile/compilation.h"
 #include "feature/feature.h"
 #include "index/tu_index.h"
 #include "server/protocol/worker.h"
 #include "server/worker/worker_common.h"
+#include "support/bloom_filter.h"
 #include "support/logging.h"
 
 #include "kota/async/async.h"
@@ -89,6 +92,11 @@ static worker::BuildResult handle_build_pch(const worker::BuildParams& params) {
     fill_args(cp, params.directory, params.arguments);
     cp.add_remapped_file(params.file, params.text, params.preamble_bound);
 
+    // Chain on the PCH of a prefix of the preamble, only the rest is written.
+    if(!params.pch.first.empty()) {
+        cp.pch = params.pch;
+    }
+
     std::string tmp_path;
     bool has_output = !params.output_path.empty();
     if(has_output) {
@@ -197,7 +205,8 @@ static worker::BuildResult handle_build_pcm(const worker::BuildParams& params) {
     }
 }
 
-static worker::BuildResult handle_index(const worker::BuildParams& params) {
+static worker::BuildResult handle_index(const worker::BuildParams& params,
+                                        const BloomFilter* known_symbols) {
     ScopedTimer timer;
 
     CompilationParams cp;
@@ -216,11 +225,12 @@ static worker::BuildResult handle_index(const worker::BuildParams& params) {
     auto tu_index = index::TUIndex::build(unit);
     std::string serialized;
     llvm::raw_string_ostream os(serialized);
-    tu_index.serialize(os);
+    tu_index.serialize(os, known_symbols);
 
-    LOG_INFO("Index done: file={}, {} symbols, {}ms",
+    LOG_INFO("Index done: file={}, {} symbols, {} bytes, {}ms",
              params.file,
              tu_index.symbols.size(),
+             serialized.size(),
              timer.ms());
     worker::BuildResult result;
     result.success = true;
@@ -308,16 +318,41 @@ int run_stateless_worker_mode(const std::string& worker_name, const std::string&
 
     kota::ipc::BincodePeer peer(loop, std::move(*transport_result));
 
+    // The latest filter of symbols the master knows, only read on the loop.
+    std::uint64_t known_generation = 0;
+    std::shared_ptr<const BloomFilter> known_symbols;
+
+    peer.on_notification([&](const worker::KnownSymbolsParams& params) {
+        known_symbols = std::make_shared<const BloomFilter>(BloomFilter::from(params.filter));
+        known_generation = params.generation;
+        LOG_DEBUG("Known symbols: generation={}, {} bytes",
+                  params.generation,
+                  known_symbols->bytes());
+    });
+
     peer.on_request([&](RequestContext& ctx,
                         const worker::BuildParams& params) -> RequestResult<worker::BuildParams> {
         using K = worker::BuildKind;
+        // A task naming another generation was sent before this worker got the
+        // filter it expects, or after it was replaced, keep all names then.
+        std::shared_ptr<const BloomFilter> known;
+        if(params.known_symbols != 0 && params.known_symbols == known_generation) {
+            known = known_symbols;
+        }
         auto result = co_await kota::queue([&]() -> worker::BuildResult {
             switch(params.kind) {
-                case K::BuildPCH: return handle_build_pch(params);
+                case K::BuildPCH: {
+                    // A prebuild must not take the cores from interactive work.
+                    std::optional<ScopedNice> guard;
+                    if(params.background) {
+                        guard.emplace();
+                    }
+                    return handle_build_pch(params);
+                }
                 case K::BuildPCM: return handle_build_pcm(params);
                 case K::Index: {
                     ScopedNice guard;
-                    return handle_index(params);
+                    return handle_index(params, known.get());
                 }
                 case K::Completion: return handle_completion(params);
                 case K::SignatureHelp: return handle_signature_help(params);
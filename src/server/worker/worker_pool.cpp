@@ -2,6 +2,7 @@
 
 #include <csignal>
 #include <string>
+#include <utility>
 
 #include "support/logging.h"
 
@@ -187,18 +188,35 @@ std::size_t WorkerPool::assign_worker(std::uint32_t path_id) {
 }
 
 std::size_t WorkerPool::pick_least_loaded() {
+    // Documents differ in AST size by orders of magnitude, so compare the
+    // reported memory first and the document count only on a tie.
+    auto load = [&](std::size_t i) {
+        auto& w = stateful_workers[i];
+        return std::pair(w.memory, w.owned_documents);
+    };
+
     std::size_t best = 0;
     for(std::size_t i = 1; i < stateful_workers.size(); ++i) {
         if(!stateful_workers[i].alive)
             continue;
-        if(!stateful_workers[best].alive ||
-           stateful_workers[i].owned_documents < stateful_workers[best].owned_documents) {
+        if(!stateful_workers[best].alive || load(i) < load(best)) {
             best = i;
         }
     }
     return best;
 }
 
+void WorkerPool::update_memory(std::uint32_t path_id, std::uint64_t bytes) {
+    auto it = owner.find(path_id);
+    if(it == owner.end())
+        return;
+
+    auto& memory = document_memory[path_id];
+    auto& worker = stateful_workers[it->second];
+    worker.memory = worker.memory - memory + bytes;
+    memory = bytes;
+}
+
 void WorkerPool::remove_owner(std::uint32_t path_id) {
     auto it = owner.find(path_id);
     if(it == owner.end())
@@ -208,6 +226,11 @@ void WorkerPool::remove_owner(std::uint32_t path_id) {
     stateful_workers[worker_idx].owned_documents--;
     owner.erase(it);
 
+    if(auto memory = document_memory.find(path_id); memory != document_memory.end()) {
+        stateful_workers[worker_idx].memory -= memory->second;
+        document_memory.erase(memory);
+    }
+
     auto lru_it = owner_lru_index.find(path_id);
     if(lru_it != owner_lru_index.end()) {
         owner_lru.erase(lru_it->second);
@@ -47,6 +47,11 @@ public:
     RequestResult<Params> send_stateless(const Params& params,
                                          kota::ipc::request_options opts = {});
 
+    /// Send a notification to every live stateless worker.  A worker spawned
+    /// later does not receive it.
+    template <typename Params>
+    void notify_stateless(const Params& params);
+
     /// Send a notification to the stateful worker owning path_id (if any).
     template <typename Params>
     void notify_stateful(std::uint32_t path_id, const Params& params);
@@ -55,6 +60,10 @@ public:
     /// document was evicted).
     void remove_owner(std::uint32_t path_id);
 
+    /// Record the AST memory the owning stateful worker reported for
+    /// path_id, new documents go to the worker holding the least.
+    void update_memory(std::uint32_t path_id, std::uint64_t bytes);
+
     /// Callback invoked when a stateful worker sends an EvictedParams notification.
     /// The master should translate the path to a path_id and call remove_owner().
     std::function<void(const std::string& path)> on_evicted;
@@ -64,6 +73,7 @@ private:
         kota::process proc;
         std::unique_ptr<kota::ipc::BincodePeer> peer;
         std::size_t owned_documents = 0;
+        std::uint64_t memory = 0;  ///< Sum of document_memory of its documents.
         bool alive = true;
         unsigned restart_count = 0;
     };
@@ -78,6 +88,9 @@ private:
     std::list<std::uint32_t> owner_lru;
     llvm::DenseMap<std::uint32_t, std::list<std::uint32_t>::iterator> owner_lru_index;
 
+    /// Last reported AST memory of each owned document.
+    llvm::DenseMap<std::uint32_t, std::uint64_t> document_memory;
+
     std::size_t assign_worker(std::uint32_t path_id);
     void clear_owner(std::size_t worker_index);
     std::size_t pick_least_loaded();
@@ -129,6 +142,15 @@ RequestResult<Params> WorkerPool::send_stateless(const Params& params,
     co_return kota::outcome_error(kota::ipc::Error{"All stateless workers are down"});
 }
 
+template <typename Params>
+void WorkerPool::notify_stateless(const Params& params) {
+    for(auto& worker: stateless_workers) {
+        if(worker.alive) {
+            worker.peer->send_notification(params);
+        }
+    }
+}
+
 template <typename Params>
 void WorkerPool::notify_stateful(std::uint32_t path_id, const Params& params) {
     auto it = owner.find(path_id);
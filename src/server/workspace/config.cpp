@@ -63,6 +63,8 @@ void Config::apply_defaults(llvm::StringRef workspace_root) {
         p.enable_indexing = true;
     if(!p.idle_timeout_ms)
         p.idle_timeout_ms = 3000;
+    if(!p.pch_prebuild_delay_ms)
+        p.pch_prebuild_delay_ms = 500;
 
     if(p.stateful_worker_count == 0)
         p.stateful_worker_count = 2;
@@ -72,6 +74,10 @@ void Config::apply_defaults(llvm::StringRef workspace_root) {
     }
     if(p.worker_memory_limit == 0)
         p.worker_memory_limit = 4ULL * 1024 * 1024 * 1024;  // 4GB
+    if(p.index_memory_limit == 0)
+        p.index_memory_limit = 1ULL * 1024 * 1024 * 1024;  // 1GB
+    if(p.pch_cache_limit == 0)
+        p.pch_cache_limit = 2ULL * 1024 * 1024 * 1024;  // 2GB
 
     if(p.cache_dir.empty() && !workspace_root.empty()) {
         p.cache_dir = resolve_xdg_cache_dir(workspace_root);
@@ -36,9 +36,20 @@ struct ProjectConfig {
     std::optional<bool> enable_indexing;
     std::optional<int> idle_timeout_ms;
 
+    /// How long the preamble of an open file must stay unchanged before its
+    /// PCH is built in the background, negative to build only on demand.
+    std::optional<int> pch_prebuild_delay_ms;
+
     defaulted<std::uint32_t> stateful_worker_count = {};
     defaulted<std::uint32_t> stateless_worker_count = {};
     defaulted<std::uint64_t> worker_memory_limit = {};
+    defaulted<std::uint64_t> index_memory_limit = {};
+
+    /// Disk budget of the PCHs in `cache_dir/cache/pch`.
+    defaulted<std::uint64_t> pch_cache_limit = {};
+
+    /// Save all index shards into one packed file instead of a file per shard.
+    defaulted<bool> packed_index = {};
 };
 
 struct CompiledRule {
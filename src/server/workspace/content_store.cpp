@@ -0,0 +1,213 @@
+#include "server/workspace/content_store.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "support/filesystem.h"
+#include "support/logging.h"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+namespace clice {
+
+namespace {
+
+llvm::StringRef key_of(const index::ContentHash& hash) {
+    return llvm::StringRef(reinterpret_cast<const char*>(hash.data()), hash.size());
+}
+
+}  // namespace
+
+void ContentStore::open(llvm::StringRef dir) {
+    std::lock_guard lock(mutex);
+    this->dir.clear();
+    if(auto ec = llvm::sys::fs::create_directories(dir)) {
+        LOG_WARN("Failed to create content directory {}: {}", std::string(dir), ec.message());
+        return;
+    }
+    this->dir = dir.str();
+}
+
+std::string ContentStore::path_of(const index::ContentHash& hash) const {
+    return path::join(dir, llvm::toHex(hash, /*LowerCase=*/true) + ".src");
+}
+
+index::ContentHash ContentStore::put(llvm::StringRef content) {
+    auto digest = llvm::xxh3_128bits(llvm::arrayRefFromStringRef(content));
+    index::ContentHash hash;
+    std::memcpy(hash.data(), &digest.low64, sizeof(digest.low64));
+    std::memcpy(hash.data() + sizeof(digest.low64), &digest.high64, sizeof(digest.high64));
+
+    std::lock_guard lock(mutex);
+    if(!find(hash)) {
+        insert(hash, content);
+    }
+    return hash;
+}
+
+index::ContentHash ContentStore::put_file(llvm::StringRef path) {
+    llvm::sys::fs::file_status status;
+    if(llvm::sys::fs::status(path, status)) {
+        return {};
+    }
+    auto mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     status.getLastModificationTime().time_since_epoch())
+                     .count();
+
+    {
+        std::lock_guard lock(mutex);
+        auto it = files.find(path);
+        if(it != files.end() && it->second.size == status.getSize() &&
+           it->second.mtime == mtime) {
+            return it->second.hash;
+        }
+    }
+
+    // Source files may change while they are read, never map them.
+    auto buffer = llvm::MemoryBuffer::getFile(path,
+                                              /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false,
+                                              /*IsVolatile=*/true);
+    if(!buffer) {
+        return {};
+    }
+
+    auto hash = put((*buffer)->getBuffer());
+
+    std::lock_guard lock(mutex);
+    files[path] = FileStamp{status.getSize(), mtime, hash};
+    return hash;
+}
+
+llvm::StringRef ContentStore::get(const index::ContentHash& hash) {
+    std::lock_guard lock(mutex);
+    if(auto entry = find(hash)) {
+        return entry->buffer->getBuffer();
+    }
+    return {};
+}
+
+const lsp::PositionMapper* ContentStore::mapper(const index::ContentHash& hash) {
+    std::lock_guard lock(mutex);
+    auto entry = find(hash);
+    if(!entry) {
+        return nullptr;
+    }
+    if(!entry->mapper) {
+        entry->mapper = std::make_unique<lsp::PositionMapper>(entry->buffer->getBuffer(),
+                                                              lsp::PositionEncoding::UTF16);
+    }
+    return entry->mapper.get();
+}
+
+std::size_t ContentStore::size() const {
+    std::lock_guard lock(mutex);
+    return entries.size();
+}
+
+std::size_t ContentStore::added() const {
+    std::lock_guard lock(mutex);
+    return added_count;
+}
+
+std::size_t ContentStore::collect(llvm::ArrayRef<index::ContentHash> live) {
+    llvm::StringSet<> keys;
+    llvm::StringSet<> names;
+    for(auto& hash: live) {
+        keys.insert(key_of(hash));
+        names.insert(llvm::toHex(hash, /*LowerCase=*/true) + ".src");
+    }
+
+    std::lock_guard lock(mutex);
+    added_count = 0;
+
+    std::size_t released = 0;
+    for(auto it = entries.begin(); it != entries.end();) {
+        auto current = it++;
+        if(!keys.contains(current->first())) {
+            entries.erase(current);
+            released += dir.empty();
+        }
+    }
+
+    for(auto it = files.begin(); it != files.end();) {
+        auto current = it++;
+        if(!keys.contains(key_of(current->second.hash))) {
+            files.erase(current);
+        }
+    }
+
+    if(dir.empty()) {
+        return released;
+    }
+
+    // Contents of earlier sessions are only on disk, and a crash may have left
+    // a temporary file behind.
+    std::error_code ec;
+    for(auto it = llvm::sys::fs::directory_iterator(dir, ec);
+        !ec && it != llvm::sys::fs::directory_iterator();
+        it.increment(ec)) {
+        auto filename = llvm::sys::path::filename(it->path());
+        if(names.contains(filename))
+            continue;
+        if(filename.ends_with(".src") && !llvm::sys::fs::remove(it->path())) {
+            released += 1;
+        } else if(filename.ends_with(".src.tmp")) {
+            llvm::sys::fs::remove(it->path());
+        }
+    }
+    return released;
+}
+
+ContentStore::Entry* ContentStore::find(const index::ContentHash& hash) {
+    auto it = entries.find(key_of(hash));
+    if(it != entries.end()) {
+        return &it->second;
+    }
+
+    if(dir.empty()) {
+        return nullptr;
+    }
+
+    // Stored by an earlier session.
+    auto buffer = llvm::MemoryBuffer::getFile(path_of(hash),
+                                              /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if(!buffer) {
+        return nullptr;
+    }
+    auto& entry = entries[key_of(hash)];
+    entry.buffer = std::move(*buffer);
+    return &entry;
+}
+
+ContentStore::Entry* ContentStore::insert(const index::ContentHash& hash,
+                                          llvm::StringRef content) {
+    auto& entry = entries[key_of(hash)];
+    added_count += 1;
+
+    if(!dir.empty()) {
+        // Stored files are immutable, so they are safe to map.
+        auto path = path_of(hash);
+        auto tmp_path = path + ".tmp";
+        if(fs::write(tmp_path, content) && fs::rename(tmp_path, path)) {
+            auto buffer = llvm::MemoryBuffer::getFile(path,
+                                                      /*IsText=*/false,
+                                                      /*RequiresNullTerminator=*/false);
+            if(buffer) {
+                entry.buffer = std::move(*buffer);
+                return &entry;
+            }
+        }
+        LOG_WARN("Failed to store content {}, keeping it in memory", path);
+    }
+
+    entry.buffer = llvm::MemoryBuffer::getMemBufferCopy(content);
+    return &entry;
+}
+
+}  // namespace clice
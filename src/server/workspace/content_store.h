@@ -0,0 +1,95 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "index/merged_index.h"
+
+#include "kota/ipc/lsp/position.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace clice {
+
+namespace lsp = kota::ipc::lsp;
+
+/// Source contents of the indexed files, shared by all MergedIndex shards.
+///
+/// Contents are addressed by the xxh3-128 of their bytes, so identical files
+/// (vendored copies, generated headers) are stored once, and a shard only
+/// keeps the hash.  Every content is written to `<dir>/<hash>.src` and read
+/// back through mmap.  The line table of a content is built once and shared
+/// by every shard that references it.  Without a directory the contents are
+/// kept on the heap.
+///
+/// Contents are added by the merge thread and read by the event loop, all
+/// methods are thread safe.  Returned contents and mappers stay valid until
+/// collect() releases them.
+class ContentStore {
+public:
+    /// Store new contents under `dir`, and find contents stored by earlier sessions.
+    void open(llvm::StringRef dir);
+
+    /// Add `content` unless it is already stored, and return its hash.
+    index::ContentHash put(llvm::StringRef content);
+
+    /// Add the current content of the file at `path`.  A file with the same
+    /// size and modification time as last time is not read again.  Returns
+    /// the zero hash if the file cannot be read.
+    index::ContentHash put_file(llvm::StringRef path);
+
+    /// The content with `hash`, or empty if it is unknown.
+    llvm::StringRef get(const index::ContentHash& hash);
+
+    /// The shared line table of the content with `hash`, or nullptr if unknown.
+    const lsp::PositionMapper* mapper(const index::ContentHash& hash);
+
+    /// Number of distinct contents in memory.
+    std::size_t size() const;
+
+    /// Number of contents added since the last collect().
+    std::size_t added() const;
+
+    /// Release every content not in `live`, in memory and on disk, including
+    /// the ones stored by earlier sessions.  Files whose last content was
+    /// released are read again by put_file().  Returns the number of stored
+    /// contents released, on disk if the store has a directory.
+    std::size_t collect(llvm::ArrayRef<index::ContentHash> live);
+
+private:
+    struct Entry {
+        std::unique_ptr<llvm::MemoryBuffer> buffer;
+        std::unique_ptr<lsp::PositionMapper> mapper;
+    };
+
+    struct FileStamp {
+        std::uint64_t size = 0;
+        std::int64_t mtime = 0;
+        index::ContentHash hash{};
+    };
+
+    /// Find or load the entry of `hash`, with `mutex` held.
+    Entry* find(const index::ContentHash& hash);
+
+    /// Add `content` with `hash`, with `mutex` held.
+    Entry* insert(const index::ContentHash& hash, llvm::StringRef content);
+
+    std::string path_of(const index::ContentHash& hash) const;
+
+    mutable std::mutex mutex;
+
+    std::string dir;
+
+    /// Entries keyed by the raw bytes of the hash.
+    llvm::StringMap<Entry> entries;
+
+    /// The last stored content of each file passed to put_file().
+    llvm::StringMap<FileStamp> files;
+
+    std::size_t added_count = 0;
+};
+
+}  // namespace clice
@@ -0,0 +1,191 @@
+#include "server/workspace/index_journal.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "support/filesystem.h"
+#include "support/logging.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/xxhash.h"
+
+namespace clice {
+
+namespace {
+
+struct RecordHeader {
+    std::uint32_t size = 0;
+    std::uint32_t reserved = 0;
+    std::uint64_t sequence = 0;
+    std::uint64_t hash = 0;
+};
+
+static_assert(sizeof(RecordHeader) == 24);
+
+constexpr std::size_t padded(std::size_t size) {
+    return (size + 7) & ~std::size_t(7);
+}
+
+/// Call `fn(header, record, payload)` for every intact record of `data` in
+/// order.  Returns the end offset of the last intact record.
+template <typename Fn>
+std::size_t for_each_record(llvm::StringRef data, Fn&& fn) {
+    std::size_t offset = 0;
+    while(offset + sizeof(RecordHeader) <= data.size()) {
+        RecordHeader header;
+        std::memcpy(&header, data.data() + offset, sizeof(header));
+
+        auto payload = offset + sizeof(RecordHeader);
+        if(payload + padded(header.size) > data.size())
+            break;
+        auto content = data.substr(payload, header.size);
+        if(llvm::xxh3_64bits(content) != header.hash)
+            break;
+
+        auto end = payload + padded(header.size);
+        fn(header, data.slice(offset, end), content);
+        offset = end;
+    }
+    return offset;
+}
+
+}  // namespace
+
+void IndexJournal::open(llvm::StringRef index_dir) {
+    journal_path = path::join(index_dir, "journal.log");
+    checkpoint_path = path::join(index_dir, "journal.ckpt");
+    out.reset();
+    checkpointed = 0;
+    bytes = 0;
+
+    if(auto ec = llvm::sys::fs::create_directories(index_dir)) {
+        LOG_WARN("Failed to create index directory {}: {}", std::string(index_dir), ec.message());
+        journal_path.clear();
+        return;
+    }
+
+    if(auto content = fs::read(checkpoint_path)) {
+        if(llvm::StringRef(*content).trim().getAsInteger(10, checkpointed)) {
+            checkpointed = 0;
+        }
+    }
+    sequence = checkpointed;
+}
+
+std::size_t IndexJournal::replay(
+    llvm::function_ref<void(std::uint64_t sequence, const void* data, std::size_t size)>
+        callback) {
+    if(!is_open())
+        return 0;
+
+    auto buffer = llvm::MemoryBuffer::getFile(journal_path,
+                                              /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if(!buffer)
+        return 0;
+
+    auto data = (*buffer)->getBuffer();
+    std::size_t replayed = 0;
+    auto offset = for_each_record(data, [&](const RecordHeader& header,
+                                            llvm::StringRef record,
+                                            llvm::StringRef content) {
+        // Already covered by the saved index, the journal was not truncated.
+        if(header.sequence <= checkpointed)
+            return;
+
+        sequence = std::max(sequence, header.sequence);
+        bytes += record.size();
+        callback(header.sequence, content.data(), content.size());
+        replayed += 1;
+    });
+
+    if(offset < data.size()) {
+        LOG_WARN("Dropping {} bytes of torn index journal", data.size() - offset);
+        auto tmp_path = journal_path + ".tmp";
+        auto write_result = fs::write(tmp_path, data.take_front(offset));
+        if(!write_result || !fs::rename(tmp_path, journal_path)) {
+            LOG_WARN("Failed to truncate index journal {}", journal_path);
+        }
+    }
+
+    return replayed;
+}
+
+std::uint64_t IndexJournal::append(const void* data, std::size_t size) {
+    if(!is_open())
+        return 0;
+
+    if(!out) {
+        std::error_code ec;
+        out = std::make_unique<llvm::raw_fd_ostream>(journal_path, ec, llvm::sys::fs::OF_Append);
+        if(ec) {
+            LOG_WARN("Failed to open index journal {}: {}", journal_path, ec.message());
+            out.reset();
+            journal_path.clear();
+            return 0;
+        }
+    }
+
+    llvm::StringRef content(static_cast<const char*>(data), size);
+    RecordHeader header{
+        .size = static_cast<std::uint32_t>(size),
+        .sequence = ++sequence,
+        .hash = llvm::xxh3_64bits(content),
+    };
+
+    constexpr char padding[8] = {};
+    out->write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out->write(content.data(), content.size());
+    out->write(padding, padded(size) - size);
+    out->flush();
+    bytes += sizeof(RecordHeader) + padded(size);
+    return header.sequence;
+}
+
+void IndexJournal::checkpoint(std::uint64_t covered) {
+    if(!is_open())
+        return;
+    covered = std::min(covered, sequence);
+
+    auto tmp_path = checkpoint_path + ".tmp";
+    auto write_result = fs::write(tmp_path, std::to_string(covered));
+    if(!write_result) {
+        LOG_WARN("Failed to write {}: {}", tmp_path, write_result.error().message());
+        return;
+    }
+    auto rename_result = fs::rename(tmp_path, checkpoint_path);
+    if(!rename_result) {
+        LOG_WARN("Failed to rename {}: {}", tmp_path, rename_result.error().message());
+        return;
+    }
+    checkpointed = covered;
+
+    // The records after `covered` are not in the saved index yet, the next
+    // session replays them.  Keep only those.
+    out.reset();
+    std::string kept;
+    if(covered < sequence) {
+        auto buffer = llvm::MemoryBuffer::getFile(journal_path,
+                                                  /*IsText=*/false,
+                                                  /*RequiresNullTerminator=*/false);
+        if(buffer) {
+            for_each_record((*buffer)->getBuffer(),
+                            [&](const RecordHeader& header,
+                                llvm::StringRef record,
+                                llvm::StringRef) {
+                                if(header.sequence > covered) {
+                                    kept.append(record.data(), record.size());
+                                }
+                            });
+        }
+    }
+
+    auto journal_tmp = journal_path + ".tmp";
+    auto truncated = fs::write(journal_tmp, kept);
+    if(!truncated || !fs::rename(journal_tmp, journal_path)) {
+        LOG_WARN("Failed to truncate index journal {}", journal_path);
+    }
+    bytes = kept.size();
+}
+
+}  // namespace clice
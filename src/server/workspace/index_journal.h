@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace clice {
+
+/// Append-only log of the TUIndex data merged since the last full save.
+///
+/// Every TUIndex is appended before it is merged, so the work of a crashed
+/// session is recovered by replaying the journal on top of the saved
+/// ProjectIndex and shards.  A checkpoint (a full Indexer::save) records the
+/// sequence number of the last record it covers, and drops the records up to
+/// it from the journal.  Records appended but not merged yet are not covered
+/// and stay.  Records up to that number are skipped on replay, so a crash
+/// between the save and the truncation never merges a TUIndex twice.
+///
+/// Record layout, padded to 8 bytes so the payload can be read in place:
+///   u32 size | u32 reserved | u64 sequence | u64 xxh3(payload) | payload
+class IndexJournal {
+public:
+    /// Use the journal in `index_dir`.  Nothing is written until append().
+    void open(llvm::StringRef index_dir);
+
+    bool is_open() const {
+        return !journal_path.empty();
+    }
+
+    /// Call `callback` with every intact record newer than the last checkpoint
+    /// and its sequence number.  A torn record at the tail (crash while
+    /// appending) is cut off.  Returns the number of replayed records.
+    std::size_t replay(
+        llvm::function_ref<void(std::uint64_t sequence, const void* data, std::size_t size)>
+            callback);
+
+    /// Append one record and flush it to the OS.  Returns its sequence number,
+    /// or 0 if the journal is not open.
+    std::uint64_t append(const void* data, std::size_t size);
+
+    /// Mark the records up to sequence number `covered` as persisted by a full
+    /// save and remove them from the journal.
+    void checkpoint(std::uint64_t covered);
+
+    /// Mark all appended records as persisted by a full save and truncate.
+    void checkpoint() {
+        checkpoint(sequence);
+    }
+
+    /// Sequence number of the last appended or replayed record.
+    std::uint64_t last_sequence() const {
+        return sequence;
+    }
+
+    /// Bytes appended since the last checkpoint.
+    std::uint64_t size() const {
+        return bytes;
+    }
+
+private:
+    std::string journal_path;
+    std::string checkpoint_path;
+
+    std::unique_ptr<llvm::raw_fd_ostream> out;
+
+    /// Sequence number of the last appended record.
+    std::uint64_t sequence = 0;
+
+    /// Sequence number of the last record covered by a full save.
+    std::uint64_t checkpointed = 0;
+
+    std::uint64_t bytes = 0;
+};
+
+}  // namespace clice
@@ -0,0 +1,119 @@
+#include "server/workspace/position_batch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace clice {
+
+namespace {
+
+/// Gaps between offsets longer than this are skipped with the line table.
+constexpr std::uint32_t seek_distance = 4096;
+
+bool is_ascii(llvm::StringRef text) {
+    return std::ranges::all_of(text, [](char c) { return static_cast<unsigned char>(c) < 0x80; });
+}
+
+/// Number of UTF-16 code units of the UTF-8 `text`.  Every byte which is not a
+/// continuation byte starts a code point, and 4-byte sequences (lead bytes
+/// from 0xF0) need a surrogate pair.
+std::uint32_t utf16_length(llvm::StringRef text) {
+    std::uint32_t length = 0;
+    for(auto c: text) {
+        auto byte = static_cast<unsigned char>(c);
+        length += (byte & 0xC0) != 0x80;
+        length += byte >= 0xF0;
+    }
+    return length;
+}
+
+}  // namespace
+
+std::vector<std::optional<protocol::Position>>
+    to_positions(llvm::StringRef content,
+                 llvm::ArrayRef<std::uint32_t> offsets,
+                 const kota::ipc::lsp::PositionMapper* lines) {
+    std::vector<std::optional<protocol::Position>> positions(offsets.size());
+    if(offsets.empty())
+        return positions;
+
+    // Visit the offsets in ascending order, most batches are nearly sorted.
+    std::vector<std::uint32_t> order(offsets.size());
+    std::iota(order.begin(), order.end(), 0u);
+    if(!std::ranges::is_sorted(offsets)) {
+        std::ranges::stable_sort(order, {}, [&](std::uint32_t i) { return offsets[i]; });
+    }
+
+    auto size = static_cast<std::uint32_t>(content.size());
+    auto line_end_from = [&](std::uint32_t from) {
+        if(from >= size)
+            return size;
+        auto* found = std::memchr(content.data() + from, '\n', size - from);
+        return found ? static_cast<std::uint32_t>(static_cast<const char*>(found) - content.data())
+                     : size;
+    };
+
+    // The current line is [line_start, line_end), `line_end` is its newline or
+    // the end of content.  On a line with non-ASCII text, `column` is the UTF-16
+    // column of byte `cursor`.
+    std::uint32_t line = 0;
+    std::uint32_t line_start = 0;
+    std::uint32_t line_end = line_end_from(0);
+    std::optional<bool> ascii;
+    std::uint32_t cursor = 0;
+    std::uint32_t column = 0;
+
+    // Move to the line containing `offset` with a binary search of the line
+    // table.  Keeps the current line if the lookup fails.
+    auto seek = [&](std::uint32_t offset) {
+        auto position = lines->to_position(offset);
+        if(!position)
+            return;
+        auto start = lines->to_offset(protocol::Position{.line = position->line, .character = 0});
+        if(!start || *start <= line_end || *start > offset)
+            return;
+        line = position->line;
+        line_start = static_cast<std::uint32_t>(*start);
+        line_end = line_end_from(line_start);
+        ascii.reset();
+        cursor = line_start;
+        column = 0;
+    };
+
+    for(auto i: order) {
+        auto offset = offsets[i];
+        if(offset > size)
+            break;
+
+        if(lines && offset > line_end && offset - line_end > seek_distance) {
+            seek(offset);
+        }
+
+        while(offset > line_end) {
+            line += 1;
+            line_start = line_end + 1;
+            line_end = line_end_from(line_start);
+            ascii.reset();
+            cursor = line_start;
+            column = 0;
+        }
+
+        if(!ascii) {
+            ascii = is_ascii(content.slice(line_start, line_end));
+        }
+
+        if(*ascii) {
+            column = offset - line_start;
+        } else {
+            column += utf16_length(content.slice(cursor, offset));
+        }
+        cursor = offset;
+
+        positions[i] = protocol::Position{.line = line, .character = column};
+    }
+
+    return positions;
+}
+
+}  // namespace clice
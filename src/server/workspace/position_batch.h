@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "index/tu_index.h"
+
+#include "kota/ipc/lsp/position.h"
+#include "kota/ipc/lsp/protocol.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clice {
+
+namespace protocol = kota::ipc::protocol;
+
+/// Convert byte offsets of `content` to UTF-16 LSP positions.
+///
+/// Unlike a PositionMapper, which binary searches the line table and walks the
+/// line for every offset, the offsets are sorted and converted in one forward
+/// sweep over `content`.  The column of an offset on a pure-ASCII line is its
+/// distance from the line start, other lines are walked once for all offsets
+/// on them.  `positions[i]` is the position of `offsets[i]`, or nullopt if it
+/// is past the end of `content`.
+///
+/// If the line table of `content` is given, the sweep starts at the line of
+/// the first offset and jumps over long gaps between offsets by looking the
+/// line up, instead of scanning every byte before them.
+std::vector<std::optional<protocol::Position>>
+    to_positions(llvm::StringRef content,
+                 llvm::ArrayRef<std::uint32_t> offsets,
+                 const kota::ipc::lsp::PositionMapper* lines = nullptr);
+
+/// Convert the ranges of `relations` in one batch and call
+/// `fn(relation, range)` in order until it returns false.  Relations whose
+/// range does not fit in `content` are skipped.  `lines` is the optional line
+/// table of `content`, see to_positions().
+template <typename Fn>
+void for_each_relation_range(llvm::StringRef content,
+                             llvm::ArrayRef<index::Relation> relations,
+                             const kota::ipc::lsp::PositionMapper* lines,
+                             Fn&& fn) {
+    if(relations.empty())
+        return;
+
+    std::vector<std::uint32_t> offsets;
+    offsets.reserve(relations.size() * 2);
+    for(auto& r: relations) {
+        offsets.push_back(r.range.begin);
+        offsets.push_back(r.range.end);
+    }
+
+    auto positions = to_positions(content, offsets, lines);
+    for(std::size_t i = 0; i < relations.size(); i++) {
+        auto& start = positions[i * 2];
+        auto& end = positions[i * 2 + 1];
+        if(start && end) {
+            if(!fn(relations[i], protocol::Range{*start, *end}))
+                return;
+        }
+    }
+}
+
+}  // namespace clice
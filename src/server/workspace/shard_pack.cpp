@@ -0,0 +1,285 @@
+#include "server/workspace/shard_pack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+#include "support/filesystem.h"
+#include "support/logging.h"
+
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+namespace clice {
+
+namespace {
+
+constexpr char pack_magic[8] = {'C', 'L', 'I', 'C', 'E', 'P', 'K', '1'};
+
+struct Slot {
+    std::uint64_t generation = 0;
+    std::uint64_t directory_offset = 0;
+    std::uint64_t count = 0;
+    std::uint64_t hash = 0;
+};
+
+struct DirectoryEntry {
+    std::uint32_t path_id = 0;
+    std::uint32_t reserved = 0;
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+};
+
+static_assert(sizeof(Slot) == 32);
+static_assert(sizeof(DirectoryEntry) == 24);
+
+constexpr std::uint64_t header_size = sizeof(pack_magic) + 2 * sizeof(Slot);
+
+constexpr std::uint64_t padded(std::uint64_t size) {
+    return (size + 7) & ~std::uint64_t(7);
+}
+
+constexpr std::uint64_t slot_offset(std::uint64_t generation) {
+    return sizeof(pack_magic) + (generation % 2) * sizeof(Slot);
+}
+
+/// A shard of the pack, keeping the mapping of the whole file alive.
+class SliceBuffer : public llvm::MemoryBuffer {
+public:
+    SliceBuffer(std::shared_ptr<llvm::MemoryBuffer> whole, llvm::StringRef data) :
+        whole(std::move(whole)) {
+        init(data.begin(), data.end(), /*RequiresNullTerminator=*/false);
+    }
+
+    BufferKind getBufferKind() const override {
+        return whole->getBufferKind();
+    }
+
+    llvm::StringRef getBufferIdentifier() const override {
+        return whole->getBufferIdentifier();
+    }
+
+private:
+    std::shared_ptr<llvm::MemoryBuffer> whole;
+};
+
+/// Write `data` padded to 8 bytes at the stream position `offset`, and
+/// return the offset past it.
+std::uint64_t write_padded(llvm::raw_ostream& os, std::uint64_t offset, llvm::StringRef data) {
+    constexpr char padding[8] = {};
+    os.write(data.data(), data.size());
+    os.write(padding, padded(data.size()) - data.size());
+    return offset + padded(data.size());
+}
+
+/// Write the directory of `entries` at `offset` and the slot committing it.
+/// Returns the offset past the directory.
+std::uint64_t write_directory(llvm::raw_fd_ostream& os,
+                              std::uint64_t offset,
+                              std::uint64_t generation,
+                              std::vector<DirectoryEntry>& entries) {
+    std::ranges::sort(entries, {}, &DirectoryEntry::path_id);
+    llvm::StringRef bytes(reinterpret_cast<const char*>(entries.data()),
+                          entries.size() * sizeof(DirectoryEntry));
+    os.write(bytes.data(), bytes.size());
+
+    Slot slot{
+        .generation = generation,
+        .directory_offset = offset,
+        .count = entries.size(),
+        .hash = llvm::xxh3_64bits(bytes),
+    };
+    os.seek(slot_offset(generation));
+    os.write(reinterpret_cast<const char*>(&slot), sizeof(slot));
+    return offset + bytes.size();
+}
+
+bool close_stream(llvm::raw_fd_ostream& os, llvm::StringRef path) {
+    os.close();
+    if(os.has_error()) {
+        LOG_WARN("Failed to write {}: {}", std::string(path), os.error().message());
+        os.clear_error();
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+void ShardPack::open(llvm::StringRef path) {
+    pack_path = path.str();
+    mapping.reset();
+    directory.clear();
+    generation = 0;
+    end = header_size;
+    live = 0;
+
+    if(!llvm::sys::fs::exists(pack_path) || !remap())
+        return;
+
+    auto data = mapping->getBuffer();
+    if(data.size() < header_size || std::memcmp(data.data(), pack_magic, sizeof(pack_magic))) {
+        LOG_WARN("Ignoring malformed shard pack {}", pack_path);
+        return;
+    }
+
+    // Take the newest slot whose directory is intact.
+    std::optional<Slot> committed;
+    for(std::uint64_t i = 0; i < 2; i++) {
+        Slot slot;
+        std::memcpy(&slot, data.data() + slot_offset(i), sizeof(slot));
+        auto size = slot.count * sizeof(DirectoryEntry);
+        if(slot.generation == 0 || slot.directory_offset < header_size ||
+           slot.directory_offset + size > data.size())
+            continue;
+        if(llvm::xxh3_64bits(data.substr(slot.directory_offset, size)) != slot.hash)
+            continue;
+        if(!committed || slot.generation > committed->generation) {
+            committed = slot;
+        }
+    }
+    if(!committed)
+        return;
+
+    auto entries = data.data() + committed->directory_offset;
+    for(std::uint64_t i = 0; i < committed->count; i++) {
+        DirectoryEntry entry;
+        std::memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+        if(entry.offset + entry.size > committed->directory_offset)
+            continue;
+        directory[entry.path_id] = {entry.offset, entry.size};
+        live += padded(entry.size);
+    }
+    generation = committed->generation;
+    end = committed->directory_offset + committed->count * sizeof(DirectoryEntry);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ShardPack::get(std::uint32_t path_id) const {
+    auto it = directory.find(path_id);
+    if(it == directory.end() || !mapping)
+        return nullptr;
+    auto data = mapping->getBuffer().substr(it->second.offset, it->second.size);
+    return std::make_unique<SliceBuffer>(mapping, data);
+}
+
+bool ShardPack::append(llvm::ArrayRef<std::pair<std::uint32_t, llvm::StringRef>> shards) {
+    if(!is_open())
+        return false;
+
+    // Nothing committed yet, start a new file.
+    if(generation == 0) {
+        auto tmp_path = pack_path + ".tmp";
+        char header[header_size] = {};
+        std::memcpy(header, pack_magic, sizeof(pack_magic));
+        auto write_result = fs::write(tmp_path, llvm::StringRef(header, header_size));
+        if(!write_result) {
+            LOG_WARN("Failed to write {}: {}", tmp_path, write_result.error().message());
+            return false;
+        }
+        if(auto rename_result = fs::rename(tmp_path, pack_path); !rename_result) {
+            LOG_WARN("Failed to rename {}: {}", tmp_path, rename_result.error().message());
+            return false;
+        }
+        end = header_size;
+    }
+
+    std::error_code ec;
+    llvm::raw_fd_ostream os(pack_path, ec, llvm::sys::fs::CD_OpenExisting);
+    if(ec) {
+        LOG_WARN("Failed to open shard pack {}: {}", pack_path, ec.message());
+        return false;
+    }
+
+    // Bytes past `end` belong to a torn append and are overwritten.
+    auto updated = directory;
+    auto offset = end;
+    os.seek(offset);
+    for(auto& [path_id, data]: shards) {
+        updated[path_id] = {offset, data.size()};
+        offset = write_padded(os, offset, data);
+    }
+
+    std::vector<DirectoryEntry> entries;
+    entries.reserve(updated.size());
+    for(auto& [path_id, entry]: updated) {
+        entries.push_back({.path_id = path_id, .offset = entry.offset, .size = entry.size});
+    }
+    offset = write_directory(os, offset, generation + 1, entries);
+    if(!close_stream(os, pack_path))
+        return false;
+
+    directory = std::move(updated);
+    generation += 1;
+    end = offset;
+    live = 0;
+    for(auto& [_, entry]: directory) {
+        live += padded(entry.size);
+    }
+    return remap();
+}
+
+bool ShardPack::repack() {
+    if(!is_open() || !mapping)
+        return false;
+
+    auto tmp_path = pack_path + ".tmp";
+    std::error_code ec;
+    llvm::raw_fd_ostream os(tmp_path, ec);
+    if(ec) {
+        LOG_WARN("Failed to write {}: {}", tmp_path, ec.message());
+        return false;
+    }
+
+    char header[header_size] = {};
+    std::memcpy(header, pack_magic, sizeof(pack_magic));
+    os.write(header, header_size);
+
+    std::vector<DirectoryEntry> entries;
+    entries.reserve(directory.size());
+    for(auto& [path_id, entry]: directory) {
+        entries.push_back({.path_id = path_id, .offset = entry.offset, .size = entry.size});
+    }
+    // Keep the shards in path_id order, neighbouring files are often queried together.
+    std::ranges::sort(entries, {}, &DirectoryEntry::path_id);
+
+    auto data = mapping->getBuffer();
+    std::uint64_t offset = header_size;
+    for(auto& entry: entries) {
+        auto shard = data.substr(entry.offset, entry.size);
+        entry.offset = offset;
+        offset = write_padded(os, offset, shard);
+    }
+
+    auto repacked = write_directory(os, offset, generation + 1, entries);
+    if(!close_stream(os, tmp_path))
+        return false;
+    if(auto rename_result = fs::rename(tmp_path, pack_path); !rename_result) {
+        LOG_WARN("Failed to rename {}: {}", tmp_path, rename_result.error().message());
+        return false;
+    }
+
+    LOG_INFO("Repacked {} shards: {} -> {} bytes", entries.size(), end, repacked);
+    directory.clear();
+    for(auto& entry: entries) {
+        directory[entry.path_id] = {entry.offset, entry.size};
+    }
+    generation += 1;
+    end = repacked;
+    return remap();
+}
+
+bool ShardPack::remap() {
+    auto buffer = llvm::MemoryBuffer::getFile(pack_path,
+                                              /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if(!buffer) {
+        LOG_WARN("Failed to map shard pack {}: {}", pack_path, buffer.getError().message());
+        mapping.reset();
+        return false;
+    }
+    mapping = std::move(*buffer);
+    return true;
+}
+
+}  // namespace clice
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace clice {
+
+/// All MergedIndex shards of a project packed into one file, as an alternative
+/// to one `shards/<path_id>.idx` file per shard.
+///
+/// The file is mapped as a whole, so a shard is a slice of the mapping and
+/// loading the index is a single directory read instead of a directory scan
+/// and an open per shard.  Saving appends the new shard versions after the
+/// current end of the file and commits a new directory after them, old bytes
+/// are never overwritten, so slices handed out earlier stay valid.  Superseded
+/// versions and directories are dead bytes until repack() rewrites the file.
+///
+/// Layout, every offset aligned to 8 bytes so shards can be read in place:
+///   magic | slot | slot | shard data ... | directory | ... | directory
+/// A slot is `u64 generation | u64 directory offset | u64 count | u64 xxh3`.
+/// Commits alternate between the two slots, and the intact slot with the
+/// highest generation wins, so a torn commit falls back to the previous one.
+/// A directory entry is `u32 path_id | u32 reserved | u64 offset | u64 size`.
+class ShardPack {
+public:
+    /// Use the pack at `path`, reading its directory if the file exists.
+    void open(llvm::StringRef path);
+
+    bool is_open() const {
+        return !pack_path.empty();
+    }
+
+    /// Number of shards in the pack.
+    std::size_t size() const {
+        return directory.size();
+    }
+
+    bool contains(std::uint32_t path_id) const {
+        return directory.contains(path_id);
+    }
+
+    /// Call `fn(path_id)` for every shard in the pack.
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for(auto& [path_id, _]: directory) {
+            fn(path_id);
+        }
+    }
+
+    /// The data of the shard `path_id` as a buffer sharing the mapping of the
+    /// pack, or nullptr if the pack has no such shard.
+    std::unique_ptr<llvm::MemoryBuffer> get(std::uint32_t path_id) const;
+
+    /// Append the (path_id, data) shards and commit a directory in which they
+    /// replace their older versions.  The data may point into buffers from
+    /// get().  Returns false if nothing was committed.
+    bool append(llvm::ArrayRef<std::pair<std::uint32_t, llvm::StringRef>> shards);
+
+    /// Bytes taken by the shards in the directory.
+    std::uint64_t live_bytes() const {
+        return live;
+    }
+
+    /// Bytes of the file no longer referenced by the directory.
+    std::uint64_t dead_bytes() const {
+        return end - live;
+    }
+
+    /// Rewrite the pack with only the live shards.  Buffers from get() keep
+    /// the old file alive until they are released.
+    bool repack();
+
+private:
+    struct Entry {
+        std::uint64_t offset = 0;
+        std::uint64_t size = 0;
+    };
+
+    /// Map the file again after it changed.
+    bool remap();
+
+    std::string pack_path;
+
+    /// The mapping of the whole file as of the last commit.
+    std::shared_ptr<llvm::MemoryBuffer> mapping;
+
+    llvm::DenseMap<std::uint32_t, Entry> directory;
+
+    /// Generation of the last committed slot.
+    std::uint64_t generation = 0;
+
+    /// Offset past the last committed directory, where the next append starts.
+    std::uint64_t end = 0;
+
+    std::uint64_t live = 0;
+};
+
+}  // namespace clice
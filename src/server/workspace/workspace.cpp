@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <chrono>
 
+#include "index/interval_tree.h"
 #include "support/filesystem.h"
 #include "support/logging.h"
 #include "syntax/scan.h"
@@ -10,6 +11,8 @@
 #include "kota/codec/json/json.h"
 #include "kota/ipc/lsp/position.h"
 #include "kota/ipc/lsp/protocol.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/Chrono.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
@@ -20,19 +23,29 @@ namespace clice {
 
 namespace lsp = kota::ipc::lsp;
 
-/// Find the tightest (innermost) occurrence containing `offset` via binary search.
+/// Whether `occurrence` is tighter (innermost) than `best`, if any.
+static bool tighter(const index::Occurrence& occurrence, const index::Occurrence* best) {
+    return !best || occurrence.range.end - occurrence.range.begin <
+                        best->range.end - best->range.begin;
+}
+
+/// Find the tightest occurrence containing `offset` via the interval tree.
 const static index::Occurrence* lookup_occurrence(const std::vector<index::Occurrence>& occs,
+                                                  llvm::ArrayRef<std::uint32_t> max_ends,
                                                   std::uint32_t offset) {
-    auto it = std::ranges::lower_bound(occs, offset, {}, [](const index::Occurrence& o) {
-        return o.range.end;
-    });
     const index::Occurrence* best = nullptr;
-    while(it != occs.end() && it->range.contains(offset)) {
-        if(!best || (it->range.end - it->range.begin) < (best->range.end - best->range.begin)) {
-            best = &*it;
-        }
-        ++it;
-    }
+    index::query_interval_tree(
+        occs.size(),
+        offset,
+        [&](std::uint32_t i) { return occs[i].range.begin; },
+        [&](std::uint32_t i) { return occs[i].range.end; },
+        [&](std::uint32_t i) { return max_ends[i]; },
+        [&](std::uint32_t i) {
+            if(tighter(occs[i], best)) {
+                best = &occs[i];
+            }
+            return true;
+        });
     return best;
 }
 
@@ -40,7 +53,7 @@ std::optional<std::pair<index::SymbolHash, protocol::Range>>
     OpenFileIndex::find_occurrence(std::uint32_t offset) const {
     if(!mapper)
         return std::nullopt;
-    auto* occ = lookup_occurrence(file_index.occurrences, offset);
+    auto* occ = lookup_occurrence(file_index.occurrences, occurrence_max_ends, offset);
     if(!occ)
         return std::nullopt;
     auto start = mapper->to_position(occ->range.begin);
@@ -58,19 +71,23 @@ std::optional<std::pair<index::SymbolHash, protocol::Range>>
     auto* m = mapper();
     if(!m)
         return std::nullopt;
-    std::optional<std::pair<index::SymbolHash, protocol::Range>> result;
+    std::optional<index::Occurrence> best;
     index.lookup(offset, [&](const index::Occurrence& o) {
-        auto start = m->to_position(o.range.begin);
-        auto end = m->to_position(o.range.end);
-        if(start && end) {
-            result = {
-                o.target,
-                protocol::Range{*start, *end}
-            };
+        if(tighter(o, best ? &*best : nullptr)) {
+            best = o;
         }
-        return false;
+        return true;
     });
-    return result;
+    if(!best)
+        return std::nullopt;
+    auto start = m->to_position(best->range.begin);
+    auto end = m->to_position(best->range.end);
+    if(!start || !end)
+        return std::nullopt;
+    return std::pair{
+        best->target,
+        protocol::Range{*start, *end}
+    };
 }
 
 llvm::SmallVector<std::uint32_t> Workspace::on_file_saved(std::uint32_t path_id) {
@@ -102,7 +119,156 @@ void Workspace::on_file_closed(std::uint32_t path_id) {
     if(compile_graph && compile_graph->has_unit(path_id)) {
         compile_graph->update(path_id);
     }
-    pch_cache.erase(path_id);
+    pch_cache.release(path_id);
+}
+
+std::uint64_t PCHCache::key(llvm::StringRef preamble,
+                            llvm::StringRef directory,
+                            llvm::ArrayRef<std::string> arguments,
+                            std::uint64_t base) {
+    std::string input;
+    input.reserve(preamble.size() + 4096);
+    input.append(preamble);
+    input.push_back('\0');
+    input.append(directory);
+    auto flags = arguments.empty() ? arguments : arguments.drop_back();
+    for(std::size_t i = 0; i < flags.size(); ++i) {
+        if(flags[i] == "-main-file-name") {
+            i += 1;
+            continue;
+        }
+        input.push_back('\0');
+        input.append(flags[i]);
+    }
+    if(base != 0) {
+        input.push_back('\0');
+        input.append(reinterpret_cast<const char*>(&base), sizeof(base));
+    }
+    return llvm::xxh3_64bits(input);
+}
+
+PCHState* PCHCache::find(std::uint64_t key) {
+    auto it = entries.find(key);
+    if(it == entries.end())
+        return nullptr;
+    lru.splice(lru.begin(), lru, it->second.lru);
+    return &it->second.state;
+}
+
+PCHState& PCHCache::get(std::uint64_t key) {
+    if(auto* state = find(key))
+        return *state;
+    lru.push_front(key);
+    auto& entry = entries[key];
+    entry.state.hash = key;
+    entry.lru = lru.begin();
+    return entry.state;
+}
+
+void PCHCache::erase(std::uint64_t key) {
+    auto it = entries.find(key);
+    if(it == entries.end() || it->second.state.refs > 0)
+        return;
+    bytes -= it->second.state.size;
+    lru.erase(it->second.lru);
+    entries.erase(it);
+}
+
+void PCHCache::acquire(std::uint32_t path_id, std::uint64_t key) {
+    // The file uses its PCH now, one built ahead is no longer needed.
+    unreserve(path_id);
+
+    auto [it, inserted] = users.try_emplace(path_id, key);
+    if(!inserted) {
+        if(it->second == key)
+            return;
+        if(auto old = entries.find(it->second); old != entries.end()) {
+            old->second.state.refs -= 1;
+        }
+        it->second = key;
+    }
+    get(key).refs += 1;
+}
+
+void PCHCache::reserve(std::uint32_t path_id, std::uint64_t key) {
+    unreserve(path_id);
+    reserved[path_id] = key;
+    get(key).refs += 1;
+}
+
+void PCHCache::unreserve(std::uint32_t path_id) {
+    auto it = reserved.find(path_id);
+    if(it == reserved.end())
+        return;
+    if(auto entry = entries.find(it->second); entry != entries.end()) {
+        entry->second.state.refs -= 1;
+    }
+    reserved.erase(it);
+}
+
+void PCHCache::release(std::uint32_t path_id) {
+    unreserve(path_id);
+    auto it = users.find(path_id);
+    if(it == users.end())
+        return;
+    if(auto entry = entries.find(it->second); entry != entries.end()) {
+        entry->second.state.refs -= 1;
+    }
+    users.erase(it);
+}
+
+bool PCHCache::base_current(const PCHState& state) {
+    if(state.base == 0)
+        return true;
+    auto* base = find(state.base);
+    return base && base->generation == state.base_generation;
+}
+
+void PCHCache::set_size(std::uint64_t key, std::uint64_t size) {
+    auto& state = get(key);
+    bytes = bytes - state.size + size;
+    state.size = size;
+}
+
+std::size_t PCHCache::evict(std::uint64_t budget) {
+    // Number of PCHs chained on each entry.
+    llvm::DenseMap<std::uint64_t, std::uint32_t> chained;
+    for(auto& [key, entry]: entries) {
+        if(entry.state.base != 0) {
+            chained[entry.state.base] += 1;
+        }
+    }
+
+    std::size_t evicted = 0;
+    // Evicting the last link of a chain may free a first link already passed,
+    // so walk again until nothing more can go.
+    for(bool progress = true; progress && bytes > budget;) {
+        progress = false;
+        for(auto it = lru.end(); bytes > budget && it != lru.begin();) {
+            --it;
+            auto entry = entries.find(*it);
+            auto& state = entry->second.state;
+            if(state.refs > 0 || state.building || chained.lookup(*it) > 0)
+                continue;
+
+            if(!state.path.empty()) {
+                if(auto ec = llvm::sys::fs::remove(state.path)) {
+                    LOG_WARN("Failed to remove PCH {}: {}", state.path, ec.message());
+                } else {
+                    LOG_DEBUG("Evicted PCH {} ({} bytes)", state.path, state.size);
+                }
+            }
+            if(state.base != 0) {
+                chained[state.base] -= 1;
+            }
+            bytes -= state.size;
+            entries.erase(entry);
+            it = lru.erase(it);
+            evicted += 1;
+            progress = true;
+        }
+    }
+    return evicted;
 }
 
 std::uint64_t hash_file(llvm::StringRef path) {
@@ -162,6 +328,9 @@ struct CachePCHEntry {
     std::uint32_t source_file;  // index into CacheData::paths
     std::uint64_t hash;
     std::uint32_t bound;
+    std::uint64_t base;  // key of the PCH it is chained on, 0 if none
+    std::uint64_t generation;
+    std::uint64_t base_generation;
     std::int64_t build_at;
     std::vector<CacheDepEntry> deps;
 };
@@ -217,18 +386,25 @@ void Workspace::load_cache() {
         return deps;
     };
 
-    for(auto& entry: data.pch) {
+    // Entries were saved most recently used first.
+    for(auto& entry: llvm::reverse(data.pch)) {
         auto pch_path = path::join(config.project.cache_dir, "cache", "pch", entry.filename);
         auto source = resolve(entry.source_file);
         if(!llvm::sys::fs::exists(pch_path) || source.empty())
             continue;
 
-        auto path_id = path_pool.intern(source);
-        auto& st = pch_cache[path_id];
+        auto& st = pch_cache.get(entry.hash);
+        st.source = path_pool.intern(source);
         st.path = pch_path;
-        st.hash = entry.hash;
         st.bound = entry.bound;
+        st.base = entry.base;
+        st.generation = entry.generation;
+        st.base_generation = entry.base_generation;
+        pch_cache.restore_generation(entry.generation);
         st.deps = load_deps(entry.build_at, entry.deps);
+        std::uint64_t size = 0;
+        llvm::sys::fs::file_size(pch_path, size);
+        pch_cache.set_size(entry.hash, size);
 
         LOG_DEBUG("Loaded cached PCH: {} -> {}", source, pch_path);
     }
@@ -268,15 +444,23 @@ void Workspace::save_cache() {
         return it->second;
     };
 
-    for(auto& [path_id, st]: pch_cache) {
+    // Written most recently used first, load_cache() restores the LRU order
+    // from there.
+    std::vector<const PCHState*> pchs;
+    pch_cache.for_each([&](const PCHState& st) { pchs.push_back(&st); });
+    for(auto& pch: pchs) {
+        auto& st = *pch;
         if(st.path.empty())
             continue;
 
         CachePCHEntry entry;
         entry.filename = std::string(path::filename(st.path));
-        entry.source_file = intern(path_id);
+        entry.source_file = intern(st.source);
         entry.hash = st.hash;
         entry.bound = st.bound;
+        entry.base = st.base;
+        entry.generation = st.generation;
+        entry.base_generation = st.base_generation;
         entry.build_at = st.deps.build_at;
         for(std::size_t i = 0; i < st.deps.path_ids.size(); ++i) {
             entry.deps.push_back({intern(st.deps.path_ids[i]), st.deps.hashes[i]});
@@ -324,25 +508,42 @@ void Workspace::cleanup_cache(int max_age_days) {
     if(config.project.cache_dir.empty())
         return;
 
+    // PCHs are content-addressed, a file the cache does not know is left over
+    // from a failed build or an older key scheme and is never used again.
+    llvm::StringSet<> known;
+    pch_cache.for_each([&](const PCHState& st) { known.insert(path::filename(st.path)); });
+
+    auto pch_dir = path::join(config.project.cache_dir, "cache", "pch");
+    std::error_code ec;
+    for(auto it = llvm::sys::fs::directory_iterator(pch_dir, ec);
+        !ec && it != llvm::sys::fs::directory_iterator();
+        it.increment(ec)) {
+        if(!known.contains(path::filename(it->path()))) {
+            llvm::sys::fs::remove(it->path());
+            LOG_DEBUG("Cleaned up unknown PCH file: {}", it->path());
+        }
+    }
+
+    if(auto evicted = pch_cache.evict(config.project.pch_cache_limit)) {
+        LOG_INFO("Evicted {} PCHs, {} bytes left", evicted, pch_cache.disk_bytes());
+    }
+
     auto now = std::chrono::system_clock::now();
     auto max_age = std::chrono::hours(max_age_days * 24);
 
-    for(auto* subdir: {"cache/pch", "cache/pcm"}) {
-        auto dir = path::join(config.project.cache_dir, subdir);
-        std::error_code ec;
-        for(auto it = llvm::sys::fs::directory_iterator(dir, ec);
-            !ec && it != llvm::sys::fs::directory_iterator();
-            it.increment(ec)) {
-            llvm::sys::fs::file_status status;
-            if(auto stat_ec = llvm::sys::fs::status(it->path(), status))
-                continue;
+    auto pcm_dir = path::join(config.project.cache_dir, "cache", "pcm");
+    for(auto it = llvm::sys::fs::directory_iterator(pcm_dir, ec);
+        !ec && it != llvm::sys::fs::directory_iterator();
+        it.increment(ec)) {
+        llvm::sys::fs::file_status status;
+        if(auto stat_ec = llvm::sys::fs::status(it->path(), status))
+            continue;
 
-            auto mtime = status.getLastModificationTime();
-            auto age = now - mtime;
-            if(age > max_age) {
-                llvm::sys::fs::remove(it->path());
-                LOG_DEBUG("Cleaned up stale cache file: {}", it->path());
-            }
+        auto mtime = status.getLastModificationTime();
+        auto age = now - mtime;
+        if(age > max_age) {
+            llvm::sys::fs::remove(it->path());
+            LOG_DEBUG("Cleaned up stale cache file: {}", it->path());
         }
     }
 }
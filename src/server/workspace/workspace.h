@@ -1,11 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <list>
 #include <memory>
 #include <optional>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "command/command.h"
 #include "index/merged_index.h"
@@ -13,6 +17,8 @@
 #include "semantic/relation_kind.h"
 #include "server/compiler/compile_graph.h"
 #include "server/workspace/config.h"
+#include "server/workspace/content_store.h"
+#include "server/workspace/position_batch.h"
 #include "support/path_pool.h"
 #include "syntax/dependency_graph.h"
 
@@ -61,6 +67,10 @@ struct OpenFileIndex {
     /// offsets on every query.  Initialized by Indexer::set_open_file().
     std::optional<lsp::PositionMapper> mapper;
 
+    /// Subtree max ends of `file_index.occurrences` as an interval tree, see
+    /// index/interval_tree.h.  Built together with the index.
+    std::vector<std::uint32_t> occurrence_max_ends;
+
     /// Find the tightest occurrence containing `offset`.
     /// Returns (symbol_hash, LSP range) with positions already converted.
     std::optional<std::pair<index::SymbolHash, protocol::Range>>
@@ -68,33 +78,55 @@ struct OpenFileIndex {
 
     /// Iterate relations matching `kind`, calling back with pre-converted ranges.
     /// Callback: (const index::Relation&, protocol::Range) -> bool (true = continue).
+    /// The ranges are converted in one batch, see to_positions().
     template <typename Fn>
     void find_relations(index::SymbolHash hash, RelationKind kind, Fn&& fn) const {
-        if(!mapper)
-            return;
-        auto it = file_index.relations.find(hash);
-        if(it == file_index.relations.end())
-            return;
-        for(auto& r: it->second) {
-            if(r.kind & kind) {
-                auto start = mapper->to_position(r.range.begin);
-                auto end = mapper->to_position(r.range.end);
-                if(start && end) {
-                    if(!fn(r, protocol::Range{*start, *end}))
-                        return;
-                }
-            }
-        }
+        for_each_relation_range(content,
+                                file_index.relations_of(hash, kind),
+                                mapper ? &*mapper : nullptr,
+                                fn);
     }
 };
 
 /// Wraps index::MergedIndex with a lazily-cached PositionMapper.
 struct MergedIndexShard {
     index::MergedIndex index;
+
+    /// The store holding the source content `index` refers to.
+    ContentStore* contents = nullptr;
+
+    /// Line table of a shard which keeps its content inline.
     mutable std::optional<lsp::PositionMapper> cached_mapper;
 
-    /// Get or lazily build a PositionMapper from the index's stored content.
+    /// When the shard was last queried or merged, orders shards for eviction.
+    /// Every query entry point below updates it.
+    mutable std::chrono::steady_clock::time_point last_used{};
+
+    /// Heap bytes of `index` as last accounted by the Indexer.
+    std::size_t resident_bytes = 0;
+
+    /// The source content of the shard.
+    llvm::StringRef content() const {
+        auto hash = index.content_hash();
+        if(contents && hash != index::ContentHash{}) {
+            return contents->get(hash);
+        }
+        return index.content();
+    }
+
+    /// Mark the shard as just used.
+    void touch() const {
+        last_used = std::chrono::steady_clock::now();
+    }
+
+    /// Get the PositionMapper of the shard's source content.  It is shared with
+    /// every shard of the same content, or built lazily for inline content.
     const lsp::PositionMapper* mapper() const {
+        touch();
+        auto hash = index.content_hash();
+        if(contents && hash != index::ContentHash{}) {
+            return contents->mapper(hash);
+        }
         if(!cached_mapper) {
             auto c = index.content();
             if(!c.empty()) {
@@ -116,31 +148,152 @@ struct MergedIndexShard {
 
     /// Iterate relations matching `kind`, calling back with pre-converted ranges.
     /// Callback: (const index::Relation&, protocol::Range) -> bool (true = continue).
+    /// The ranges are converted in one batch, see to_positions().
     template <typename Fn>
     void find_relations(index::SymbolHash hash, RelationKind kind, Fn&& fn) const {
-        auto* m = mapper();
-        if(!m)
-            return;
-        index.lookup(hash, kind, [&](const index::Relation& r) {
-            auto start = m->to_position(r.range.begin);
-            auto end = m->to_position(r.range.end);
-            if(start && end) {
-                return fn(r, protocol::Range{*start, *end});
-            }
+        std::vector<index::Relation> relations;
+        lookup(hash, kind, [&](const index::Relation& r) {
+            relations.push_back(r);
             return true;
         });
+        for_each_relation_range(content(), relations, mapper(), fn);
+    }
+
+    /// Iterate relations matching `kind` without converting their ranges.
+    /// Callback: (const index::Relation&) -> bool (true = continue).
+    template <typename Fn>
+    void lookup(index::SymbolHash hash, RelationKind kind, Fn&& fn) const {
+        touch();
+        index.lookup(hash, kind, std::forward<Fn>(fn));
     }
 };
 
-/// Cached PCH state.  Content-addressed by preamble hash — shared across all
-/// files (open or on-disk) that have the same preamble content.
+/// Cached PCH state.  Content-addressed by PCHCache::key() — shared across all
+/// files (open or on-disk) that have the same preamble content and flags.
 struct PCHState {
     std::string path;
     std::uint32_t bound = 0;
-    std::uint64_t hash = 0;
+    std::uint64_t hash = 0;  ///< The PCHCache key.
     DepsSnapshot deps;
     std::string document_links_json;  ///< Pre-serialized DocumentLink[] from PCH build
     std::shared_ptr<kota::event> building;
+    std::uint32_t source = 0;  ///< path_id of the file the PCH was built for.
+    std::uint64_t size = 0;    ///< Bytes of the PCH file.
+    std::uint32_t refs = 0;    ///< Number of files using this PCH.
+    std::uint64_t base = 0;    ///< Key of the PCH this one is chained on, 0 if none.
+    std::uint64_t generation = 0;       ///< Build number, see PCHCache::next_generation().
+    std::uint64_t base_generation = 0;  ///< `generation` of `base` when this was built.
+};
+
+/// The PCHs of the workspace, keyed by the hash of the preamble text and the
+/// compile flags, so files with the same preamble and flags share one PCH and
+/// files with different flags never do.
+///
+/// A preamble may be built as a chain: a PCH of its leading system includes,
+/// shared by every file starting with them, and a PCH of the rest on top of
+/// it.  Every file using a PCH holds a reference to the last link, and so
+/// does a file a PCH was prebuilt for until it uses one.  Entries without
+/// references are kept for later reuse, and the least recently used
+/// of them are deleted with their file once the PCHs exceed the disk budget,
+/// the first link of a chain only after every PCH chained on it.
+class PCHCache {
+public:
+    /// The key of `preamble` compiled in `directory` with `arguments`.  The
+    /// source file, the last argument, and -main-file-name are left out so the
+    /// key does not depend on which file the preamble belongs to.  `base` is
+    /// the key of the PCH the preamble is chained on, if any.
+    static std::uint64_t key(llvm::StringRef preamble,
+                             llvm::StringRef directory,
+                             llvm::ArrayRef<std::string> arguments,
+                             std::uint64_t base = 0);
+
+    /// The entry of `key` or nullptr.  A hit becomes the most recently used.
+    PCHState* find(std::uint64_t key);
+
+    /// The entry of `key`, created empty if there is none.
+    PCHState& get(std::uint64_t key);
+
+    /// Remove the entry of `key` if no file uses it.  Its file is kept.
+    void erase(std::uint64_t key);
+
+    /// Make the file `path_id` use the entry of `key` instead of its previous
+    /// one, if any.
+    void acquire(std::uint32_t path_id, std::uint64_t key);
+
+    /// Keep the entry of `key`, built ahead for the file `path_id`, until the
+    /// file acquires a PCH, reserves another one, or is released.
+    void reserve(std::uint32_t path_id, std::uint64_t key);
+
+    /// Drop the references of the file `path_id`, if any.
+    void release(std::uint32_t path_id);
+
+    /// Delete the least recently used entries without references and their
+    /// files until the PCHs take at most `budget` bytes.  Entries being built
+    /// or with PCHs chained on them are kept.  Returns the number of entries
+    /// deleted.
+    std::size_t evict(std::uint64_t budget);
+
+    /// A build number newer than that of every PCH built or loaded so far.  A
+    /// chained PCH is stale once its base has another number than the one it
+    /// was built on, without comparing the base file itself.
+    std::uint64_t next_generation() {
+        return ++generation;
+    }
+
+    /// Keep next_generation() newer than `loaded`, the number of a PCH
+    /// restored from disk.
+    void restore_generation(std::uint64_t loaded) {
+        generation = std::max(generation, loaded);
+    }
+
+    /// Whether the PCH `state` is chained on is still the build it was
+    /// chained on.  Always true for a PCH without a base.
+    bool base_current(const PCHState& state);
+
+    /// Bytes of all PCH files in the cache.
+    std::uint64_t disk_bytes() const {
+        return bytes;
+    }
+
+    /// Update `disk_bytes()` after the file of an entry was (re)written.
+    void set_size(std::uint64_t key, std::uint64_t size);
+
+    std::size_t size() const {
+        return entries.size();
+    }
+
+    /// Call `fn(state)` for every entry, most recently used first.
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for(auto key: lru) {
+            fn(entries.find(key)->second.state);
+        }
+    }
+
+private:
+    struct Entry {
+        PCHState state;
+        std::list<std::uint64_t>::iterator lru;
+    };
+
+    /// Drop the reservation of the file `path_id`, if any.
+    void unreserve(std::uint32_t path_id);
+
+    llvm::DenseMap<std::uint64_t, Entry> entries;
+
+    /// Keys of `entries`, most recently used first.
+    std::list<std::uint64_t> lru;
+
+    /// The key of the entry each file uses.
+    llvm::DenseMap<std::uint32_t, std::uint64_t> users;
+
+    /// The key of the entry reserved for each file, see reserve().
+    llvm::DenseMap<std::uint32_t, std::uint64_t> reserved;
+
+    /// The last build number handed out, see next_generation().
+    std::uint64_t generation = 0;
+
+    std::uint64_t bytes = 0;
 };
 
 /// Cached PCM state for a single C++20 module.  Shared across all files that
@@ -188,10 +341,8 @@ struct Workspace {
     /// declarations change.
     llvm::DenseMap<std::uint32_t, std::string> path_to_module;
 
-    /// PCH cache, keyed by file path_id.
-    /// TODO: re-key by preamble content hash to enable cross-file sharing and
-    /// add LRU eviction.  Compile flags should also be part of the key.
-    llvm::DenseMap<std::uint32_t, PCHState> pch_cache;
+    /// PCH cache, shared by all files with the same preamble and flags.
+    PCHCache pch_cache;
 
     /// PCM cache, keyed by module source path_id.
     llvm::DenseMap<std::uint32_t, PCMState> pcm_cache;
@@ -204,10 +355,13 @@ struct Workspace {
     index::ProjectIndex project_index;
 
     /// Per-file index shards from background indexing, keyed by project-level
-    /// path_id.  Contains symbol occurrences, relations, and stored content
-    /// for position mapping.
+    /// path_id.  Contains symbol occurrences, relations, and the hash of the
+    /// source content (in `contents`) for position mapping.
     llvm::DenseMap<std::uint32_t, MergedIndexShard> merged_indices;
 
+    /// Source contents referenced by the shards, deduplicated by hash.
+    ContentStore contents;
+
     /// Called when a file is saved to disk.  Cascades invalidation through
     /// compile_graph and clears affected PCM caches.
     /// Returns path_ids of all files dirtied by the cascade.
@@ -221,7 +375,9 @@ struct Workspace {
     void load_cache();
     /// Save PCH/PCM cache to cache.json on disk.
     void save_cache();
-    /// Remove stale PCH/PCM files older than max_age_days.
+    /// Delete PCH files the cache does not know, then the least recently used
+    /// PCHs beyond `pch_cache_limit`, and PCM files older than max_age_days.
+    /// Called after load_cache().
     void cleanup_cache(int max_age_days = 7);
     /// Build path_to_module reverse mapping from dep_graph.
     void build_module_map();
@@ -0,0 +1,76 @@
+#include "support/bloom_filter.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace clice {
+
+namespace {
+
+/// The second hash of the double hashing, odd so that the probes of a key
+/// never collapse into one bit.
+std::uint64_t probe_step(std::uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key | 1;
+}
+
+}  // namespace
+
+BloomFilter::BloomFilter(std::size_t count, unsigned bits_per_key) {
+    auto bits = std::max<std::size_t>(count * bits_per_key, 64);
+    words.assign((bits + 63) / 64, 0);
+    // k = ln 2 * bits per key minimizes the false positive rate.
+    probes = std::clamp<std::uint32_t>(bits_per_key * 69 / 100, 1, 30);
+}
+
+void BloomFilter::insert(std::uint64_t key) {
+    if(words.empty())
+        return;
+    auto bits = words.size() * 64;
+    auto step = probe_step(key);
+    for(std::uint32_t i = 0; i < probes; ++i) {
+        auto bit = (key + i * step) % bits;
+        words[bit / 64] |= std::uint64_t(1) << (bit % 64);
+    }
+}
+
+bool BloomFilter::may_contain(std::uint64_t key) const {
+    if(words.empty())
+        return false;
+    auto bits = words.size() * 64;
+    auto step = probe_step(key);
+    for(std::uint32_t i = 0; i < probes; ++i) {
+        auto bit = (key + i * step) % bits;
+        if(!(words[bit / 64] & (std::uint64_t(1) << (bit % 64))))
+            return false;
+    }
+    return true;
+}
+
+std::string BloomFilter::serialize() const {
+    std::string data(sizeof(probes) + bytes(), '\0');
+    std::memcpy(data.data(), &probes, sizeof(probes));
+    std::memcpy(data.data() + sizeof(probes), words.data(), bytes());
+    return data;
+}
+
+BloomFilter BloomFilter::from(llvm::StringRef data) {
+    BloomFilter filter;
+    if(data.size() <= sizeof(std::uint32_t) ||
+       (data.size() - sizeof(std::uint32_t)) % sizeof(std::uint64_t))
+        return filter;
+
+    std::uint32_t count = 0;
+    std::memcpy(&count, data.data(), sizeof(count));
+    if(count == 0 || count > 30)
+        return filter;
+
+    filter.probes = count;
+    filter.words.resize((data.size() - sizeof(count)) / sizeof(std::uint64_t));
+    std::memcpy(filter.words.data(), data.data() + sizeof(count), filter.bytes());
+    return filter;
+}
+
+}  // namespace clice
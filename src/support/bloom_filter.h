@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace clice {
+
+/// A Bloom filter over 64-bit hashes, such as symbol hashes.  The keys are
+/// expected to be uniformly distributed already, the probes are derived from
+/// them by double hashing.
+///
+/// With the default 24 bits per key the false positive rate is about 1e-5.
+class BloomFilter {
+public:
+    BloomFilter() = default;
+
+    /// An empty filter sized for `count` keys with `bits_per_key` bits each.
+    explicit BloomFilter(std::size_t count, unsigned bits_per_key = 24);
+
+    void insert(std::uint64_t key);
+
+    /// False if `key` was certainly never inserted.  Always false for a
+    /// default constructed filter.
+    bool may_contain(std::uint64_t key) const;
+
+    bool empty() const {
+        return words.empty();
+    }
+
+    /// Size of the bit array in bytes.
+    std::size_t bytes() const {
+        return words.size() * sizeof(std::uint64_t);
+    }
+
+    /// The filter as bytes, to be sent to another process of the same build.
+    std::string serialize() const;
+
+    /// Read a filter written by serialize().  Returns an empty filter for
+    /// malformed data.
+    static BloomFilter from(llvm::StringRef data);
+
+private:
+    std::uint32_t probes = 0;
+    std::vector<std::uint64_t> words;
+};
+
+}  // namespace clice
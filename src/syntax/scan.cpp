@@ -476,6 +476,43 @@ std::vector<std::uint32_t> compute_preamble_bounds(llvm::StringRef content) {
     return result;
 }
 
+std::uint32_t compute_preamble_split(llvm::StringRef content, std::uint32_t bound) {
+    Lexer lexer(content, true, nullptr, false);
+
+    std::uint32_t candidate = 0;
+    std::uint32_t depth = 0;
+
+    while(true) {
+        auto token = lexer.advance();
+        if(token.is_eof() || !token.is_directive_hash() || token.range.begin >= bound) {
+            return 0;
+        }
+
+        auto keyword = lexer.advance();
+        if(keyword.is_eod()) {
+            continue;
+        }
+
+        auto name = keyword.is_identifier() ? keyword.text(content) : "";
+        auto header = lexer.next();
+        lexer.advance_until(clang::tok::eod);
+        auto end = lexer.last().range.end;
+
+        if(name == "if" || name == "ifdef" || name == "ifndef") {
+            depth += 1;
+        } else if(name == "endif" && depth > 0) {
+            depth -= 1;
+        } else if((name == "include" || name == "include_next") && header.is_header_name()) {
+            if(header.text(content).starts_with("\"")) {
+                return candidate;
+            }
+            if(depth == 0 && end < bound) {
+                candidate = end;
+            }
+        }
+    }
+}
+
 /// Check if a preprocessor #include/#import directive line is complete.
 static bool is_include_directive_complete(llvm::StringRef directive) {
     if(directive.contains('"')) {
@@ -100,6 +100,13 @@ std::uint32_t compute_preamble_bound(llvm::StringRef content);
 
 std::vector<std::uint32_t> compute_preamble_bounds(llvm::StringRef content);
 
+/// Find where the preamble ending at `bound` can be split into a prefix of
+/// system includes and a tail of project includes, so the prefix can be built
+/// as its own PCH and shared by every file starting with the same includes.
+/// Returns the end of the last `#include <...>` outside any conditional before
+/// the first `#include "..."`, or 0 if the preamble has no such point.
+std::uint32_t compute_preamble_split(llvm::StringRef content, std::uint32_t bound);
+
 /// Check if the preamble region contains only syntactically complete directives.
 /// Returns false if any #include/#import has an unclosed "" or <>, or any
 /// C++20 module statement (import/export) is missing a trailing ';',
@@ -55,6 +55,29 @@ async def test_find_references(client, workspace):
     client.close(uri)
 
 
+@pytest.mark.workspace("index_features")
+async def test_find_references_partial_results(client, workspace):
+    """Test FindReferences streams locations as $/progress with a partialResultToken."""
+    uri, _ = await client.open_and_wait(workspace / "main.cpp")
+    assert await wait_for_index(client, uri), "Index not ready after 30s"
+
+    token = "references-partial"
+    result = await client.references_at(
+        uri, 30, 4, include_declaration=True, partial_result_token=token
+    )
+    assert not result, f"Expected an empty final response, got {result}"
+
+    batches = [e["value"] for e in client.progress_events if e["token"] == token]
+    locations = [loc for batch in batches for loc in batch]
+    # global_var is declared on line 30 and used on lines 33 and 37
+    assert len(locations) >= 3, f"Expected >=3 streamed refs, got {locations}"
+    # main.cpp is open, it is reported from its session and not its shard too
+    keys = [str(loc) for loc in locations]
+    assert len(keys) == len(set(keys)), f"Expected no duplicate refs, got {locations}"
+
+    client.close(uri)
+
+
 @pytest.mark.workspace("index_features")
 async def test_call_hierarchy_prepare(client, workspace):
     """Test prepareCallHierarchy returns a CallHierarchyItem for 'add'."""
@@ -214,6 +237,25 @@ async def test_workspace_symbol(client, workspace):
     client.close(uri)
 
 
+@pytest.mark.workspace("index_features")
+async def test_workspace_symbol_ranked(client, workspace):
+    """Test workspace/symbol ranks the exact match first and matches fuzzily."""
+    uri, _ = await client.open_and_wait(workspace / "main.cpp")
+    assert await wait_for_index(client, uri), "Index not ready after 30s"
+
+    result = await client.workspace_symbol_async(WorkspaceSymbolParams(query="use_global"))
+    assert result is not None
+    names = [s.name for s in result]
+    assert names[:2] == ["use_global", "use_global_again"], names
+
+    result = await client.workspace_symbol_async(WorkspaceSymbolParams(query="uga"))
+    assert result is not None
+    names = [s.name for s in result]
+    assert "use_global_again" in names, names
+
+    client.close(uri)
+
+
 @pytest.mark.workspace("index_features")
 async def test_workspace_symbol_class(client, workspace):
     """Test workspace/symbol finds class symbols."""
@@ -206,15 +206,18 @@ class CliceClient(BaseLanguageClient):
         character: int,
         *,
         include_declaration: bool = True,
+        partial_result_token: str | None = None,
         timeout: float = 30.0,
     ):
-        """Send find-references request at given position."""
+        """Send find-references request at given position.  With a
+        partial_result_token, the locations arrive as progress events."""
         return await asyncio.wait_for(
             self.text_document_references_async(
                 ReferenceParams(
                     text_document=TextDocumentIdentifier(uri=uri),
                     position=Position(line=line, character=character),
                     context=ReferenceContext(include_declaration=include_declaration),
+                    partial_result_token=partial_result_token,
                 )
             ),
             timeout=timeout,
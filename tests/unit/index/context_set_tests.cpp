@@ -0,0 +1,66 @@
+#include <vector>
+
+#include "test/test.h"
+#include "index/context_set.h"
+
+namespace clice::testing {
+namespace {
+
+std::vector<std::uint32_t> ids_of(const index::ContextSet& set) {
+    std::vector<std::uint32_t> ids;
+    set.for_each([&](std::uint32_t id) { ids.push_back(id); });
+    return ids;
+}
+
+TEST_SUITE(ContextSet) {
+
+TEST_CASE(Inline) {
+    index::ContextSet set;
+    EXPECT_TRUE(set.empty());
+
+    set.add(7);
+    set.add(2);
+    set.add(7);
+    EXPECT_EQ(set.size(), 2U);
+    EXPECT_EQ(set.heap_bytes(), 0U);
+    EXPECT_TRUE(ids_of(set) == std::vector<std::uint32_t>{2, 7});
+    EXPECT_TRUE(set.contains(2));
+    EXPECT_FALSE(set.contains(3));
+
+    Bitmap removed;
+    removed.add(2);
+    EXPECT_FALSE(set.subset_of(removed));
+    removed.add(7);
+    EXPECT_TRUE(set.subset_of(removed));
+}
+
+TEST_CASE(Promote) {
+    index::ContextSet set;
+    for(std::uint32_t id = 0; id <= index::ContextSet::inline_capacity; id++) {
+        set.add(id * 3);
+    }
+    EXPECT_EQ(set.size(), index::ContextSet::inline_capacity + 1);
+    EXPECT_TRUE(set.heap_bytes() > 0);
+    EXPECT_TRUE(set.contains(3));
+    EXPECT_FALSE(set.contains(4));
+
+    // Copies own their bitmap.
+    auto copy = set;
+    copy.add(100);
+    EXPECT_FALSE(set.contains(100));
+    EXPECT_TRUE(copy.contains(100));
+
+    // Equal sets have the same form however they were built.
+    EXPECT_TRUE(index::ContextSet::from(ids_of(set)) == set);
+    EXPECT_TRUE(index::ContextSet::from(set.to_bitmap()) == set);
+
+    std::vector<std::uint32_t> few = {1, 5};
+    auto small = index::ContextSet::from(few);
+    EXPECT_EQ(small.heap_bytes(), 0U);
+    EXPECT_TRUE(index::ContextSet::from(small.to_bitmap()) == small);
+    EXPECT_FALSE(small == set);
+}
+
+};  // TEST_SUITE(ContextSet)
+}  // namespace
+}  // namespace clice::testing
@@ -1,3 +1,4 @@
+#include "test/temp_dir.h"
 #include "test/test.h"
 #include "test/tester.h"
 #include "index/merged_index.h"
@@ -357,6 +358,307 @@ TEST_CASE(CacheInvalidatedAfterMerge) {
     ASSERT_TRUE(found_second);
 }
 
+TEST_CASE(LazyLoadFromDisk) {
+    build_index(R"(
+            int $(target)foo() { return 42; }
+            int bar() { return foo(); }
+        )");
+
+    index::MergedIndex merged;
+    std::vector<index::IncludeLocation> locations;
+    merged.merge(0, tu_index.built_at, std::move(locations), tu_index.main_file_index, {});
+
+    TempDir tmp;
+    auto shard_path = tmp.path("0.idx");
+    {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(shard_path, ec);
+        ASSERT_FALSE(ec);
+        merged.serialize(os);
+    }
+
+    // Registering the shard must not read it.
+    auto lazy = index::MergedIndex::load(shard_path);
+    ASSERT_FALSE(lazy.is_loaded());
+    ASSERT_FALSE(lazy.need_rewrite());
+
+    // The first query maps the file and is served from the flatbuffer.
+    auto offset = point("target");
+    bool found = false;
+    lazy.lookup(offset, [&](const index::Occurrence& occ) {
+        found = occ.range.contains(offset);
+        return false;
+    });
+    ASSERT_TRUE(found);
+    ASSERT_TRUE(lazy.is_loaded());
+    ASSERT_FALSE(lazy.need_rewrite());
+
+    ASSERT_TRUE(merged == lazy);
+}
+
+TEST_CASE(ShrinkToBinary) {
+    build_index(R"(
+            int $(target)foo() { return 42; }
+            int bar() { return foo(); }
+        )");
+
+    index::MergedIndex merged;
+    index::MergedIndex expected;
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+    expected.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+
+    auto before = merged.memory_usage();
+    ASSERT_TRUE(merged.is_materialized());
+    ASSERT_TRUE(before > 0);
+
+    merged.shrink();
+    ASSERT_FALSE(merged.is_materialized());
+    ASSERT_TRUE(merged.memory_usage() < before);
+
+    // The shrunk form is not on disk yet.
+    ASSERT_TRUE(merged.need_rewrite());
+
+    auto offset = point("target");
+    bool found = false;
+    merged.lookup(offset, [&](const index::Occurrence& occ) {
+        found = occ.range.contains(offset);
+        return false;
+    });
+    ASSERT_TRUE(found);
+
+    ASSERT_TRUE(merged == expected);
+}
+
+TEST_CASE(ForkAndSnapshot) {
+    build_index(R"(
+            int $(target)foo() { return 42; }
+            int bar() { return foo(); }
+        )");
+
+    index::MergedIndex writer;
+    writer.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+
+    // The snapshot serves queries from its binary form and is not on disk yet.
+    auto published = writer.snapshot();
+    ASSERT_FALSE(published.is_materialized());
+    ASSERT_TRUE(published.need_rewrite());
+
+    auto offset = point("target");
+    bool found = false;
+    published.lookup(offset, [&](const index::Occurrence& occ) {
+        found = occ.range.contains(offset);
+        return false;
+    });
+    ASSERT_TRUE(found);
+
+    // A fork of the published index can be merged into while it keeps serving.
+    auto fork = published.fork();
+    auto include_id = tu_index.graph.include_location_id(unit->interested_file());
+    fork.merge(1, include_id, tu_index.main_file_index, {});
+    ASSERT_TRUE(fork.is_materialized());
+    ASSERT_FALSE(published.is_materialized());
+    ASSERT_TRUE(published == writer);
+}
+
+TEST_CASE(ForkOutlivesSource) {
+    build_index(R"(
+            int $(target)foo() { return 42; }
+        )");
+
+    index::MergedIndex writer;
+    writer.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+    auto published = writer.snapshot();
+
+    // The fork of a mapped index owns its bytes, the shard may be evicted or
+    // repacked before the fork is merged into.
+    auto fork = published.fork();
+    published = index::MergedIndex();
+    auto include_id = tu_index.graph.include_location_id(unit->interested_file());
+    fork.merge(1, include_id, tu_index.main_file_index, {});
+    ASSERT_TRUE(fork.is_materialized());
+
+    auto offset = point("target");
+    bool found = false;
+    fork.lookup(offset, [&](const index::Occurrence& occ) {
+        found = occ.range.contains(offset);
+        return false;
+    });
+    ASSERT_TRUE(found);
+}
+
+TEST_CASE(CompactRemovedContexts) {
+    build_index(R"(
+            int foo() { return 42; }
+        )");
+    auto first = tu_index.main_file_index;
+    auto first_include = tu_index.graph.include_location_id(unit->interested_file());
+
+    build_index(R"(
+            int bar() { return foo(); }
+            int foo() { return 1; }
+        )");
+    auto include_id = tu_index.graph.include_location_id(unit->interested_file());
+
+    // Rebuilding a file releases the context of its previous build.
+    index::MergedIndex merged;
+    merged.merge(0, tu_index.built_at, {}, first, {});
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+    ASSERT_EQ(merged.removed_contexts(), 1U);
+
+    ASSERT_TRUE(merged.compact() > 0);
+    ASSERT_EQ(merged.removed_contexts(), 0U);
+    ASSERT_EQ(merged.compact(), 0U);
+
+    index::MergedIndex expected;
+    expected.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+    ASSERT_TRUE(merged == expected);
+
+    // Header contexts are renumbered after the removed ones are dropped.
+    index::MergedIndex header;
+    header.merge(0, first_include, first, {});
+    header.merge(1, include_id, tu_index.main_file_index, {});
+    header.remove(0);
+    header.compact();
+
+    index::MergedIndex expected_header;
+    expected_header.merge(1, include_id, tu_index.main_file_index, {});
+    ASSERT_TRUE(header == expected_header);
+
+    // A compacted index round-trips and accepts the removed content again.
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    header.serialize(os);
+    index::MergedIndex view(buf);
+    ASSERT_TRUE(view == header);
+
+    header.merge(0, first_include, first, {});
+    ASSERT_EQ(header.removed_contexts(), 0U);
+    ASSERT_EQ(header.compact(), 0U);
+
+    // A header merged again through the same include replaces its context.
+    index::MergedIndex rebuilt;
+    rebuilt.merge(0, include_id, first, {});
+    rebuilt.merge(0, include_id, tu_index.main_file_index, {});
+    ASSERT_EQ(rebuilt.removed_contexts(), 1U);
+    ASSERT_TRUE(rebuilt.compact() > 0);
+
+    index::MergedIndex expected_rebuilt;
+    expected_rebuilt.merge(0, include_id, tu_index.main_file_index, {});
+    ASSERT_TRUE(rebuilt == expected_rebuilt);
+}
+
+TEST_CASE(ColumnarLookup) {
+    // Enough occurrences to span several blocks of the columnar encoding.
+    std::string code = "int foo(int x) { return x; }\nint bar() {\n    int sum = 0;\n";
+    for(int i = 0; i < 200; i++) {
+        code += "    sum += foo(sum);\n";
+    }
+    code += "    return sum;\n}\n";
+    build_index(code);
+
+    index::MergedIndex merged;
+    merged.merge(0, tu_index.built_at, {}, tu_index.main_file_index, {});
+
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    merged.serialize(os);
+    index::MergedIndex view(buf);
+
+    using OccurrenceKey = std::tuple<std::uint32_t, std::uint32_t, index::SymbolHash>;
+    auto occurrences_at = [](index::MergedIndex& index, std::uint32_t offset) {
+        std::vector<OccurrenceKey> result;
+        index.lookup(offset, [&](const index::Occurrence& occ) {
+            result.emplace_back(occ.range.begin, occ.range.end, occ.target);
+            return true;
+        });
+        std::ranges::sort(result);
+        return result;
+    };
+
+    using RelationKey = std::tuple<std::uint32_t, std::uint32_t, std::uint32_t, index::SymbolHash>;
+    auto relations_of = [](index::MergedIndex& index, index::SymbolHash symbol, RelationKind kind) {
+        std::vector<RelationKey> result;
+        index.lookup(symbol, kind, [&](const index::Relation& rel) {
+            result.emplace_back(rel.kind.value(),
+                                rel.range.begin,
+                                rel.range.end,
+                                rel.target_symbol);
+            return true;
+        });
+        std::ranges::sort(result);
+        return result;
+    };
+
+    ASSERT_TRUE(tu_index.main_file_index.occurrences.size() > 128);
+    for(auto& occurrence: tu_index.main_file_index.occurrences) {
+        auto offset = occurrence.range.begin;
+        auto expected = occurrences_at(merged, offset);
+        ASSERT_FALSE(expected.empty());
+        ASSERT_TRUE(expected == occurrences_at(view, offset));
+
+        for(auto kind: {RelationKind::Definition,
+                        RelationKind::Declaration,
+                        RelationKind::Reference}) {
+            ASSERT_TRUE(relations_of(merged, occurrence.target, kind) ==
+                        relations_of(view, occurrence.target, kind));
+        }
+    }
+
+    ASSERT_TRUE(merged == view);
+}
+
+TEST_CASE(NestedOccurrenceLookup) {
+    // Short tokens under a few long ranges (e.g. macro expansions) which span
+    // many blocks, so block spans overlap.
+    index::FileIndex file_index;
+    for(std::uint32_t i = 0; i < 1000; i++) {
+        file_index.occurrences.push_back({
+            .range = {i * 10, i * 10 + 4},
+            .target = i % 7 + 1,
+        });
+        if(i % 250 == 0) {
+            file_index.occurrences.push_back({
+                .range = {i * 10, i * 10 + 3000},
+                .target = 100,
+            });
+        }
+    }
+    std::ranges::sort(file_index.occurrences, {}, [](const index::Occurrence& o) {
+        return std::tuple(o.range.begin, o.range.end, o.target);
+    });
+    auto expected_occurrences = file_index.occurrences;
+
+    index::MergedIndex merged;
+    merged.merge(0, tu_index.built_at, {}, file_index, {});
+
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    merged.serialize(os);
+    index::MergedIndex view(buf);
+
+    using OccurrenceKey = std::tuple<std::uint32_t, std::uint32_t, index::SymbolHash>;
+    auto occurrences_at = [](index::MergedIndex& index, std::uint32_t offset) {
+        std::vector<OccurrenceKey> result;
+        index.lookup(offset, [&](const index::Occurrence& occ) {
+            result.emplace_back(occ.range.begin, occ.range.end, occ.target);
+            return true;
+        });
+        return result;
+    };
+
+    for(std::uint32_t offset = 0; offset < 10100; offset += 3) {
+        std::vector<OccurrenceKey> expected;
+        for(auto& o: expected_occurrences) {
+            if(o.range.contains(offset)) {
+                expected.emplace_back(o.range.begin, o.range.end, o.target);
+            }
+        }
+        // Both paths report every containing occurrence, in begin order.
+        ASSERT_TRUE(occurrences_at(merged, offset) == expected);
+        ASSERT_TRUE(occurrences_at(view, offset) == expected);
+    }
+}
+
 };  // TEST_SUITE(MergedIndex)
 }  // namespace
 }  // namespace clice::testing
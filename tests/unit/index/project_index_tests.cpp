@@ -200,6 +200,245 @@ TEST_CASE(NameSurvivesRoundTrip) {
     }
 }
 
+TEST_CASE(TrigramCandidates) {
+    index::TUIndex tu;
+    ASSERT_TRUE(build_and_index(R"(
+            int parse_header = 1;
+            void write_output() {}
+        )",
+                                tu));
+
+    index::ProjectIndex project;
+    project.merge(tu);
+
+    auto contains = [](llvm::ArrayRef<index::SymbolHash> hashes, index::SymbolHash hash) {
+        return llvm::is_contained(hashes, hash);
+    };
+
+    index::SymbolHash parse_hash = 0;
+    index::SymbolHash write_hash = 0;
+    for(auto& [hash, symbol]: project.symbols) {
+        if(symbol.name == "parse_header")
+            parse_hash = hash;
+        if(symbol.name == "write_output")
+            write_hash = hash;
+    }
+    ASSERT_NE(parse_hash, 0U);
+    ASSERT_NE(write_hash, 0U);
+
+    // Matching is case-insensitive.
+    llvm::SmallVector<index::SymbolHash> candidates;
+    ASSERT_TRUE(project.trigrams.candidates("HEADER", candidates));
+    ASSERT_TRUE(contains(candidates, parse_hash));
+    ASSERT_FALSE(contains(candidates, write_hash));
+
+    // A trigram that no name contains yields no candidates.
+    candidates.clear();
+    ASSERT_TRUE(project.trigrams.candidates("qqq", candidates));
+    ASSERT_TRUE(candidates.empty());
+
+    // Subsequences which skip ahead to segment starts are found too.
+    candidates.clear();
+    ASSERT_TRUE(project.trigrams.candidates("wrout", candidates));
+    ASSERT_TRUE(contains(candidates, write_hash));
+    ASSERT_FALSE(contains(candidates, parse_hash));
+
+    candidates.clear();
+    ASSERT_TRUE(project.trigrams.candidates("PaHead", candidates));
+    ASSERT_TRUE(contains(candidates, parse_hash));
+
+    // Too short to filter.
+    ASSERT_FALSE(project.trigrams.candidates("pa", candidates));
+
+    // The postings survive serialization.
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    project.serialize(os);
+    auto restored = index::ProjectIndex::from(buf.data());
+
+    candidates.clear();
+    ASSERT_TRUE(restored.trigrams.candidates("output", candidates));
+    ASSERT_TRUE(contains(candidates, write_hash));
+    ASSERT_FALSE(contains(candidates, parse_hash));
+}
+
+TEST_CASE(DefinitionRecorded) {
+    index::TUIndex tu;
+    ASSERT_TRUE(build_and_index(R"(
+            int declared_only();
+            int $(def)defined() { return declared_only(); }
+        )",
+                                tu));
+
+    index::ProjectIndex project;
+    auto file_ids_map = project.merge(tu);
+    auto main_id = file_ids_map[tu.graph.paths.size() - 1];
+
+    index::SymbolHash defined_hash = 0;
+    index::SymbolHash declared_hash = 0;
+    for(auto& [hash, symbol]: project.symbols) {
+        if(symbol.name == "defined")
+            defined_hash = hash;
+        if(symbol.name == "declared_only")
+            declared_hash = hash;
+    }
+    ASSERT_NE(defined_hash, 0U);
+    ASSERT_NE(declared_hash, 0U);
+
+    // Only symbols with a definition are recorded.
+    ASSERT_FALSE(project.definitions.contains(declared_hash));
+    ASSERT_TRUE(project.definitions.contains(defined_hash));
+
+    auto& definition = project.definitions[defined_hash];
+    ASSERT_EQ(definition.path_id, main_id);
+    ASSERT_EQ(definition.range.begin, point("def"));
+    ASSERT_TRUE(definition.extent.begin <= definition.range.begin);
+    ASSERT_TRUE(definition.extent.end > definition.range.end);
+
+    // Serialize and deserialize.
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    project.serialize(os);
+    auto restored = index::ProjectIndex::from(buf.data());
+
+    ASSERT_TRUE(restored.definitions.contains(defined_hash));
+    auto& restored_definition = restored.definitions[defined_hash];
+    ASSERT_EQ(restored_definition.path_id, definition.path_id);
+    ASSERT_TRUE(restored_definition.range == definition.range);
+    ASSERT_TRUE(restored_definition.extent == definition.extent);
+}
+
+TEST_CASE(DefinitionDropped) {
+    index::TUIndex defining;
+    ASSERT_TRUE(build_and_index(R"(
+            int moved() { return 0; }
+            int use() { return moved(); }
+        )",
+                                defining));
+
+    index::ProjectIndex project;
+    project.merge(defining);
+
+    index::SymbolHash moved_hash = 0;
+    for(auto& [hash, symbol]: project.symbols) {
+        if(symbol.name == "moved")
+            moved_hash = hash;
+    }
+    ASSERT_NE(moved_hash, 0U);
+    ASSERT_TRUE(project.definitions.contains(moved_hash));
+
+    // The file is indexed again without the definition.
+    index::TUIndex declaring;
+    ASSERT_TRUE(build_and_index(R"(
+            int moved();
+            int use() { return moved(); }
+        )",
+                                declaring));
+    project.merge(declaring);
+    ASSERT_FALSE(project.definitions.contains(moved_hash));
+}
+
+TEST_CASE(PartialDefinitions) {
+    index::TUIndex tu;
+    ASSERT_TRUE(build_and_index(R"(
+            int defined() { return 0; }
+        )",
+                                tu));
+
+    index::ProjectIndex project;
+    project.merge(tu);
+    ASSERT_FALSE(project.definitions.empty());
+
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    project.serialize(os);
+    ASSERT_FALSE(index::ProjectIndex::from(buf.data()).partial_definitions);
+
+    // An index loaded without the table saves none, so it is loaded as
+    // partial again instead of as a complete table.
+    project.partial_definitions = true;
+    buf.clear();
+    project.serialize(os);
+    auto restored = index::ProjectIndex::from(buf.data());
+    ASSERT_TRUE(restored.partial_definitions);
+    ASSERT_TRUE(restored.definitions.empty());
+    ASSERT_FALSE(restored.symbols.empty());
+}
+
+TEST_CASE(NamesReadFromBuffer) {
+    index::TUIndex tu;
+    ASSERT_TRUE(build_and_index(R"(
+            int buffered_name = 1;
+        )",
+                                tu));
+
+    index::ProjectIndex project;
+    project.merge(tu);
+
+    llvm::SmallString<4096> buf;
+    llvm::raw_svector_ostream os(buf);
+    project.serialize(os);
+
+    auto buffer = llvm::MemoryBuffer::getMemBufferCopy(buf.str());
+    auto start = buffer->getBufferStart();
+    auto end = buffer->getBufferEnd();
+    auto restored = index::ProjectIndex::from_buffer(std::move(buffer));
+
+    // Loaded names point into the buffer instead of being copied.
+    index::SymbolHash buffered_hash = 0;
+    for(auto& [hash, symbol]: restored.symbols) {
+        if(symbol.name == "buffered_name") {
+            buffered_hash = hash;
+            ASSERT_TRUE(symbol.name.data() >= start && symbol.name.data() < end);
+        }
+    }
+    ASSERT_NE(buffered_hash, 0U);
+
+    // So are the trigram postings, nothing is posted on the heap.
+    auto ordinals = restored.trigrams.ordinals;
+    ASSERT_FALSE(ordinals.empty());
+    ASSERT_TRUE(reinterpret_cast<const char*>(ordinals.data()) >= start &&
+                reinterpret_cast<const char*>(ordinals.data()) < end);
+    ASSERT_TRUE(restored.trigrams.added.empty());
+
+    // Symbols merged later are copied into the index and outlive the TU.
+    {
+        index::TUIndex other;
+        ASSERT_TRUE(build_and_index(R"(
+            int merged_later = 2;
+        )",
+                                    other));
+        restored.merge(other);
+    }
+
+    bool found = false;
+    for(auto& [hash, symbol]: restored.symbols) {
+        if(symbol.name == "merged_later")
+            found = true;
+    }
+    ASSERT_TRUE(found);
+    ASSERT_EQ(restored.symbols[buffered_hash].name, "buffered_name");
+
+    // Their postings are added on the heap, both are searched and saved.
+    ASSERT_FALSE(restored.trigrams.added.empty());
+    llvm::SmallVector<index::SymbolHash> candidates;
+    ASSERT_TRUE(restored.trigrams.candidates("buffered", candidates));
+    ASSERT_TRUE(llvm::is_contained(candidates, buffered_hash));
+
+    buf.clear();
+    restored.serialize(os);
+    auto reloaded =
+        index::ProjectIndex::from_buffer(llvm::MemoryBuffer::getMemBufferCopy(buf.str()));
+    ASSERT_TRUE(reloaded.trigrams.added.empty());
+    for(llvm::StringRef name: {"buffered_name", "merged_later"}) {
+        candidates.clear();
+        ASSERT_TRUE(reloaded.trigrams.candidates(name, candidates));
+        ASSERT_TRUE(llvm::any_of(candidates, [&](index::SymbolHash hash) {
+            return reloaded.symbols[hash].name == name;
+        }));
+    }
+}
+
 };  // TEST_SUITE(ProjectIndex)
 }  // namespace
 }  // namespace clice::testing
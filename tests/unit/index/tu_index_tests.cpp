@@ -273,6 +273,71 @@ TEST_CASE(Reference) {
     ASSERT_TRUE(ref != relations.end());
 }
 
+TEST_CASE(RelationsOfKind) {
+    build_index(R"(
+            int foo();
+            int foo() { return 42; }
+
+            int bar() {
+                return $(ref)foo() + foo();
+            }
+        )");
+
+    auto& index = tu_index.main_file_index;
+    auto occurrences = select("ref");
+    ASSERT_EQ(occurrences.size(), 1U);
+    auto symbol = occurrences.front().target;
+
+    auto references = index.relations_of(symbol, RelationKind::Reference);
+    EXPECT_TRUE(references.size() >= 2U);
+    for(auto& relation: references) {
+        EXPECT_EQ(relation.kind.value(), static_cast<std::uint32_t>(RelationKind::Reference));
+    }
+
+    auto definitions = index.relations_of(symbol, RelationKind::Definition);
+    ASSERT_EQ(definitions.size(), 1U);
+
+    // The runs are exactly what filtering all relations of the symbol gives.
+    auto& all = index.relations.find(symbol)->second;
+    auto expected = std::ranges::count_if(all, [](const index::Relation& r) {
+        return r.kind.value() == static_cast<std::uint32_t>(RelationKind::Reference);
+    });
+    EXPECT_EQ(references.size(), static_cast<std::size_t>(expected));
+
+    EXPECT_TRUE(index.relations_of(symbol, RelationKind::Base).empty());
+    EXPECT_TRUE(index.relations_of(0, RelationKind::Reference).empty());
+}
+
+TEST_CASE(KnownSymbolNamesOmitted) {
+    build_index(R"(
+            int $(known)known_symbol = 1;
+            int $(fresh)fresh_symbol = 2;
+        )");
+
+    auto known = select("known").front().target;
+    auto fresh = select("fresh").front().target;
+
+    BloomFilter filter(16);
+    filter.insert(known);
+
+    std::string data;
+    llvm::raw_string_ostream os(data);
+    tu_index.serialize(os, &filter);
+    os.flush();
+    auto restored = index::TUIndex::from(data.data());
+
+    // The known symbol keeps its kind and references but loses its name.
+    ASSERT_TRUE(restored.symbols.contains(known));
+    EXPECT_TRUE(restored.symbols[known].name.empty());
+    EXPECT_EQ(restored.symbols[known].kind.value(), tu_index.symbols[known].kind.value());
+    EXPECT_EQ(restored.symbols[known].reference_files.cardinality(),
+              tu_index.symbols[known].reference_files.cardinality());
+    EXPECT_TRUE(restored.unnamed.contains(known));
+
+    EXPECT_EQ(restored.symbols[fresh].name, "fresh_symbol");
+    EXPECT_FALSE(restored.unnamed.contains(fresh));
+}
+
 TEST_CASE(BaseAndDerived) {
     build_index(R"(
             struct Base {
@@ -562,6 +627,28 @@ TEST_CASE(snapshot) {
     });
 }
 
+TEST_CASE(FileIndexHash) {
+    build_index(R"(
+        int foo() { return 1; }
+        int bar() { return foo(); }
+    )");
+    auto first = tu_index.main_file_index.hash();
+    auto first_legacy = tu_index.main_file_index.legacy_hash();
+
+    build_index(R"(
+        int foo() { return 1; }
+        int bar() { return foo(); }
+    )");
+    EXPECT_TRUE(tu_index.main_file_index.hash() == first);
+    EXPECT_TRUE(tu_index.main_file_index.legacy_hash() == first_legacy);
+
+    build_index(R"(
+        int foo() { return 1; }
+        int baz() { return foo(); }
+    )");
+    EXPECT_FALSE(tu_index.main_file_index.hash() == first);
+}
+
 };  // TEST_SUITE(tu_index)
 
 }  // namespace
@@ -146,6 +146,7 @@ TEST_CASE(ApplyDefaults) {
     config.apply_defaults("/workspace");
     EXPECT_EQ(*config.project.enable_indexing, true);
     EXPECT_EQ(*config.project.idle_timeout_ms, 3000);
+    EXPECT_EQ(*config.project.pch_prebuild_delay_ms, 500);
     EXPECT_EQ(config.project.max_active_file.value, 8);
     EXPECT_EQ(config.project.stateful_worker_count.value, 2u);
     EXPECT_GE(config.project.stateless_worker_count.value, 2u);
@@ -0,0 +1,108 @@
+#include <string>
+
+#include "test/temp_dir.h"
+#include "test/test.h"
+#include "server/workspace/content_store.h"
+
+namespace clice::testing {
+namespace {
+
+std::size_t stored_files(llvm::StringRef dir) {
+    std::size_t count = 0;
+    std::error_code ec;
+    for(auto it = llvm::sys::fs::directory_iterator(dir, ec);
+        !ec && it != llvm::sys::fs::directory_iterator();
+        it.increment(ec)) {
+        count += llvm::StringRef(it->path()).ends_with(".src");
+    }
+    return count;
+}
+
+TEST_SUITE(ContentStore) {
+
+TEST_CASE(IdenticalContentStoredOnce) {
+    TempDir tmp;
+    ContentStore store;
+    store.open(tmp.root);
+
+    auto first = store.put("int x = 1;\n");
+    auto second = store.put("int x = 1;\n");
+    auto other = store.put("int y = 2;\n");
+
+    EXPECT_TRUE(first == second);
+    EXPECT_FALSE(first == other);
+    EXPECT_EQ(store.size(), 2U);
+    EXPECT_EQ(stored_files(tmp.root), 2U);
+    EXPECT_EQ(store.get(first), "int x = 1;\n");
+
+    // Shards of identical files share one line table.
+    ASSERT_TRUE(store.mapper(first) != nullptr);
+    EXPECT_TRUE(store.mapper(first) == store.mapper(second));
+}
+
+TEST_CASE(ReadAfterReopen) {
+    TempDir tmp;
+    index::ContentHash hash;
+    {
+        ContentStore store;
+        store.open(tmp.root);
+        hash = store.put("struct Foo {};\n");
+    }
+
+    ContentStore store;
+    store.open(tmp.root);
+    EXPECT_EQ(store.size(), 0U);
+    EXPECT_EQ(store.get(hash), "struct Foo {};\n");
+    EXPECT_TRUE(store.get(index::ContentHash{}).empty());
+}
+
+TEST_CASE(PutFile) {
+    TempDir tmp;
+    ContentStore store;
+    store.open(tmp.path("contents"));
+
+    tmp.touch("a.h", "#pragma once\n");
+    tmp.touch("vendor/a.h", "#pragma once\n");
+
+    auto hash = store.put_file(tmp.path("a.h"));
+    EXPECT_TRUE(hash == store.put_file(tmp.path("vendor/a.h")));
+    EXPECT_EQ(store.get(hash), "#pragma once\n");
+    EXPECT_EQ(stored_files(tmp.path("contents")), 1U);
+
+    EXPECT_TRUE(store.put_file(tmp.path("missing.h")) == index::ContentHash{});
+}
+
+TEST_CASE(CollectUnreferenced) {
+    TempDir tmp;
+    index::ContentHash stale;
+    {
+        ContentStore store;
+        store.open(tmp.path("contents"));
+        stale = store.put("int old_session;\n");
+    }
+
+    ContentStore store;
+    store.open(tmp.path("contents"));
+    tmp.touch("a.h", "int v1;\n");
+    auto v1 = store.put_file(tmp.path("a.h"));
+    tmp.touch("b.h", "int kept;\n");
+    auto kept = store.put_file(tmp.path("b.h"));
+    EXPECT_EQ(store.added(), 2U);
+    EXPECT_EQ(stored_files(tmp.path("contents")), 3U);
+
+    // Unreferenced contents go, whether added now or by the last session.
+    EXPECT_EQ(store.collect({kept}), 2U);
+    EXPECT_EQ(store.added(), 0U);
+    EXPECT_EQ(stored_files(tmp.path("contents")), 1U);
+    EXPECT_EQ(store.get(kept), "int kept;\n");
+    EXPECT_TRUE(store.get(v1).empty());
+    EXPECT_TRUE(store.get(stale).empty());
+
+    // A file whose content was released is stored again.
+    EXPECT_TRUE(store.put_file(tmp.path("a.h")) == v1);
+    EXPECT_EQ(store.get(v1), "int v1;\n");
+}
+
+};  // TEST_SUITE(ContentStore)
+}  // namespace
+}  // namespace clice::testing
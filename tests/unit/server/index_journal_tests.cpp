@@ -0,0 +1,136 @@
+#include <string>
+#include <vector>
+
+#include "test/temp_dir.h"
+#include "test/test.h"
+#include "server/workspace/index_journal.h"
+#include "support/filesystem.h"
+
+namespace clice::testing {
+namespace {
+
+std::vector<std::string> replay_all(IndexJournal& journal) {
+    std::vector<std::string> records;
+    journal.replay([&](std::uint64_t, const void* data, std::size_t size) {
+        records.emplace_back(static_cast<const char*>(data), size);
+    });
+    return records;
+}
+
+TEST_SUITE(IndexJournal) {
+
+TEST_CASE(ReplayAfterRestart) {
+    TempDir tmp;
+    {
+        IndexJournal journal;
+        journal.open(tmp.root);
+        ASSERT_TRUE(replay_all(journal).empty());
+        journal.append("first", 5);
+        journal.append("second record", 13);
+        EXPECT_TRUE(journal.size() > 0);
+    }
+
+    IndexJournal journal;
+    journal.open(tmp.root);
+    auto records = replay_all(journal);
+    ASSERT_EQ(records.size(), 2U);
+    EXPECT_EQ(records[0], "first");
+    EXPECT_EQ(records[1], "second record");
+
+    // New records go after the replayed ones.
+    journal.append("third", 5);
+    IndexJournal reopened;
+    reopened.open(tmp.root);
+    EXPECT_EQ(replay_all(reopened).size(), 3U);
+}
+
+TEST_CASE(CheckpointSkipsSavedRecords) {
+    TempDir tmp;
+    {
+        IndexJournal journal;
+        journal.open(tmp.root);
+        replay_all(journal);
+        journal.append("saved", 5);
+        journal.checkpoint();
+        EXPECT_EQ(journal.size(), 0U);
+        journal.append("unsaved", 7);
+    }
+
+    IndexJournal journal;
+    journal.open(tmp.root);
+    auto records = replay_all(journal);
+    ASSERT_EQ(records.size(), 1U);
+    EXPECT_EQ(records[0], "unsaved");
+}
+
+TEST_CASE(PartialCheckpointKeepsUnpublished) {
+    TempDir tmp;
+    {
+        // Merging stopped with the last two records still queued, the save
+        // only covers the first.
+        IndexJournal journal;
+        journal.open(tmp.root);
+        replay_all(journal);
+        auto first = journal.append("published", 9);
+        journal.append("queued", 6);
+        journal.append("queued too", 10);
+        journal.checkpoint(first);
+        EXPECT_TRUE(journal.size() > 0);
+    }
+
+    IndexJournal journal;
+    journal.open(tmp.root);
+    std::vector<std::uint64_t> sequences;
+    std::vector<std::string> records;
+    journal.replay([&](std::uint64_t sequence, const void* data, std::size_t size) {
+        sequences.push_back(sequence);
+        records.emplace_back(static_cast<const char*>(data), size);
+    });
+    ASSERT_EQ(records.size(), 2U);
+    EXPECT_EQ(records[0], "queued");
+    EXPECT_EQ(records[1], "queued too");
+    EXPECT_EQ(sequences[0], 2U);
+    EXPECT_EQ(journal.last_sequence(), 3U);
+
+    // Once they are published, a full checkpoint drops them.
+    journal.append("new", 3);
+    journal.checkpoint();
+    IndexJournal reopened;
+    reopened.open(tmp.root);
+    EXPECT_TRUE(replay_all(reopened).empty());
+}
+
+TEST_CASE(TornTailIsDropped) {
+    TempDir tmp;
+    {
+        IndexJournal journal;
+        journal.open(tmp.root);
+        replay_all(journal);
+        journal.append("intact", 6);
+        journal.append("torn record", 11);
+    }
+
+    // Simulate a crash in the middle of the last append.
+    auto path = tmp.path("journal.log");
+    auto content = fs::read(path);
+    ASSERT_TRUE(content.has_value());
+    ASSERT_TRUE(fs::write(path, llvm::StringRef(*content).drop_back(5)).has_value());
+
+    IndexJournal journal;
+    journal.open(tmp.root);
+    auto records = replay_all(journal);
+    ASSERT_EQ(records.size(), 1U);
+    EXPECT_EQ(records[0], "intact");
+
+    // The torn bytes are gone, so later appends stay readable.
+    journal.append("after", 5);
+    IndexJournal reopened;
+    reopened.open(tmp.root);
+    records = replay_all(reopened);
+    ASSERT_EQ(records.size(), 2U);
+    EXPECT_EQ(records[1], "after");
+}
+
+};  // TEST_SUITE(IndexJournal)
+}  // namespace
+}  // namespace clice::testing
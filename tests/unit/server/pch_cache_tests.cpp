@@ -0,0 +1,169 @@
+#include <string>
+#include <vector>
+
+#include "test/temp_dir.h"
+#include "test/test.h"
+#include "server/workspace/workspace.h"
+#include "support/filesystem.h"
+
+#include "llvm/Support/FileSystem.h"
+
+namespace clice::testing {
+namespace {
+
+/// Add a built entry of `size` bytes with its file under `tmp`.
+bool add_built(PCHCache& cache, TempDir& tmp, std::uint64_t key, std::uint64_t size) {
+    auto& st = cache.get(key);
+    st.path = tmp.path(std::to_string(key) + ".pch");
+    if(!fs::write(st.path, std::string(size, 'x')))
+        return false;
+    cache.set_size(key, size);
+    return true;
+}
+
+TEST_SUITE(PCHCache) {
+
+TEST_CASE(KeyIgnoresSourceFile) {
+    std::vector<std::string> a = {"clang++", "-main-file-name", "a.cpp", "/src/a.cpp"};
+    std::vector<std::string> b = {"clang++", "-main-file-name", "b.cpp", "/src/b.cpp"};
+    EXPECT_EQ(PCHCache::key("#include <vector>\n", "/build", a),
+              PCHCache::key("#include <vector>\n", "/build", b));
+
+    // Flags that change preprocessing change the key.
+    std::vector<std::string> defined = {"clang++", "-DNDEBUG", "/src/a.cpp"};
+    EXPECT_NE(PCHCache::key("#include <vector>\n", "/build", a),
+              PCHCache::key("#include <vector>\n", "/build", defined));
+    EXPECT_NE(PCHCache::key("#include <vector>\n", "/build", a),
+              PCHCache::key("#include <map>\n", "/build", a));
+}
+
+TEST_CASE(KeyCoversBase) {
+    std::vector<std::string> args = {"clang++", "/src/a.cpp"};
+    auto base = PCHCache::key("#include <vector>\n", "/build", args);
+    EXPECT_NE(PCHCache::key("#include <vector>\n#include \"a.h\"\n", "/build", args),
+              PCHCache::key("#include <vector>\n#include \"a.h\"\n", "/build", args, base));
+}
+
+TEST_CASE(ReferenceCounting) {
+    PCHCache cache;
+    cache.acquire(1, 10);
+    cache.acquire(2, 10);
+    EXPECT_EQ(cache.find(10)->refs, 2U);
+
+    // Switching to another PCH moves the reference.
+    cache.acquire(1, 20);
+    EXPECT_EQ(cache.find(10)->refs, 1U);
+    EXPECT_EQ(cache.find(20)->refs, 1U);
+
+    cache.release(2);
+    cache.release(2);
+    EXPECT_EQ(cache.find(10)->refs, 0U);
+
+    // Only entries without references can be erased.
+    cache.erase(20);
+    EXPECT_TRUE(cache.find(20) != nullptr);
+    cache.erase(10);
+    EXPECT_TRUE(cache.find(10) == nullptr);
+}
+
+TEST_CASE(ReservePrebuilt) {
+    TempDir tmp;
+    PCHCache cache;
+    ASSERT_TRUE(add_built(cache, tmp, 10, 100));
+    ASSERT_TRUE(add_built(cache, tmp, 20, 100));
+    cache.acquire(1, 10);
+
+    // A PCH prebuilt for the file is not evicted before the file uses it.
+    cache.reserve(1, 20);
+    EXPECT_EQ(cache.evict(0), 0U);
+    EXPECT_TRUE(llvm::sys::fs::exists(tmp.path("20.pch")));
+
+    // Using it moves the reference, the reservation is dropped.
+    cache.acquire(1, 20);
+    EXPECT_EQ(cache.find(10)->refs, 0U);
+    EXPECT_EQ(cache.find(20)->refs, 1U);
+
+    // A newer reservation replaces the older one, closing the file drops both.
+    cache.reserve(1, 10);
+    cache.reserve(1, 10);
+    EXPECT_EQ(cache.find(10)->refs, 1U);
+    cache.release(1);
+    EXPECT_EQ(cache.find(10)->refs, 0U);
+    EXPECT_EQ(cache.find(20)->refs, 0U);
+    EXPECT_EQ(cache.evict(0), 2U);
+}
+
+TEST_CASE(EvictLeastRecentlyUsed) {
+    TempDir tmp;
+    PCHCache cache;
+    ASSERT_TRUE(add_built(cache, tmp, 1, 100));
+    ASSERT_TRUE(add_built(cache, tmp, 2, 100));
+    ASSERT_TRUE(add_built(cache, tmp, 3, 100));
+    EXPECT_EQ(cache.disk_bytes(), 300U);
+
+    // 1 is used by a file, 2 was looked up last, so 3 goes first.
+    cache.acquire(7, 1);
+    cache.find(2);
+    EXPECT_EQ(cache.evict(200), 1U);
+    EXPECT_TRUE(cache.find(3) == nullptr);
+    EXPECT_FALSE(llvm::sys::fs::exists(tmp.path("3.pch")));
+    EXPECT_EQ(cache.disk_bytes(), 200U);
+
+    // A referenced entry survives even over budget.
+    EXPECT_EQ(cache.evict(0), 1U);
+    EXPECT_TRUE(cache.find(1) != nullptr);
+    EXPECT_TRUE(llvm::sys::fs::exists(tmp.path("1.pch")));
+    EXPECT_EQ(cache.disk_bytes(), 100U);
+
+    cache.release(7);
+    EXPECT_EQ(cache.evict(0), 1U);
+    EXPECT_EQ(cache.size(), 0U);
+}
+
+TEST_CASE(EvictChainBaseLast) {
+    TempDir tmp;
+    PCHCache cache;
+    ASSERT_TRUE(add_built(cache, tmp, 1, 100));
+    ASSERT_TRUE(add_built(cache, tmp, 2, 100));
+    ASSERT_TRUE(add_built(cache, tmp, 3, 100));
+    cache.get(2).base = 1;
+    cache.get(3).base = 1;
+
+    // 1 is the least recently used but 2 and 3 are chained on it.
+    EXPECT_EQ(cache.evict(200), 1U);
+    EXPECT_TRUE(cache.find(1) != nullptr);
+    EXPECT_TRUE(cache.find(2) == nullptr);
+
+    // Once nothing is chained on it, it goes in the same call.
+    EXPECT_EQ(cache.evict(0), 2U);
+    EXPECT_EQ(cache.size(), 0U);
+    EXPECT_FALSE(llvm::sys::fs::exists(tmp.path("1.pch")));
+}
+
+TEST_CASE(ChainedOnBaseBuild) {
+    PCHCache cache;
+    EXPECT_TRUE(cache.base_current(cache.get(1)));
+
+    cache.get(1).generation = cache.next_generation();
+    auto& chained = cache.get(2);
+    chained.base = 1;
+    chained.base_generation = cache.get(1).generation;
+    chained.generation = cache.next_generation();
+    EXPECT_TRUE(cache.base_current(cache.get(2)));
+
+    // Rebuilding the base makes the PCH chained on it stale.
+    cache.get(1).generation = cache.next_generation();
+    EXPECT_FALSE(cache.base_current(cache.get(2)));
+
+    // Numbers restored from disk are never handed out again.
+    PCHCache restored;
+    restored.restore_generation(7);
+    EXPECT_EQ(restored.next_generation(), 8U);
+
+    cache.erase(1);
+    EXPECT_FALSE(cache.base_current(cache.get(2)));
+}
+
+};  // TEST_SUITE(PCHCache)
+}  // namespace
+}  // namespace clice::testing
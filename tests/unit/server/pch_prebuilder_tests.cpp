@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include "test/test.h"
+#include "server/compiler/pch_prebuilder.h"
+
+namespace clice::testing {
+namespace {
+
+using Built = std::vector<std::pair<std::uint32_t, std::uint64_t>>;
+
+PCHPrebuilder::wait_fn no_wait() {
+    return [](std::uint32_t) -> kota::task<> {
+        co_return;
+    };
+}
+
+PCHPrebuilder::build_fn tracking_build(Built& built) {
+    return [&built](std::uint32_t path_id, std::uint64_t preamble) -> kota::task<> {
+        built.emplace_back(path_id, preamble);
+        co_return;
+    };
+}
+
+kota::task<> settle() {
+    co_await kota::sleep(std::chrono::milliseconds(100));
+}
+
+template <typename F>
+void execute(F&& fn) {
+    kota::event_loop loop;
+    auto t = fn(loop);
+    loop.schedule(t);
+    loop.run();
+}
+
+TEST_SUITE(PCHPrebuilder) {
+
+TEST_CASE(DebounceLatestPreamble) {
+    Built built;
+    execute([&](kota::event_loop& loop) -> kota::task<> {
+        PCHPrebuilder prebuilder(loop, no_wait(), tracking_build(built));
+
+        // Edits within the delay only build the preamble they settle on.
+        EXPECT_TRUE(prebuilder.schedule(1, 10, 20));
+        EXPECT_FALSE(prebuilder.schedule(1, 10, 20));
+        EXPECT_TRUE(prebuilder.schedule(1, 11, 20));
+        EXPECT_TRUE(prebuilder.schedule(2, 10, 20));
+        EXPECT_FALSE(prebuilder.current(1, 10));
+        EXPECT_TRUE(prebuilder.current(1, 11));
+
+        co_await settle();
+        EXPECT_EQ(built.size(), 2u);
+        EXPECT_TRUE(std::ranges::contains(built, std::pair<std::uint32_t, std::uint64_t>(1, 11)));
+        EXPECT_TRUE(std::ranges::contains(built, std::pair<std::uint32_t, std::uint64_t>(2, 10)));
+
+        // The same preamble is not built again.
+        EXPECT_FALSE(prebuilder.schedule(1, 11, 20));
+        co_await prebuilder.stop();
+    });
+    EXPECT_EQ(built.size(), 2u);
+}
+
+TEST_CASE(SupersededBeforeBuild) {
+    Built built;
+    execute([&](kota::event_loop& loop) -> kota::task<> {
+        PCHPrebuilder prebuilder(loop, no_wait(), tracking_build(built));
+
+        // An incomplete preamble and closing the file both supersede.
+        EXPECT_TRUE(prebuilder.schedule(1, 10, 20));
+        EXPECT_FALSE(prebuilder.schedule(1, 0, 20));
+        EXPECT_TRUE(prebuilder.schedule(2, 10, 20));
+        prebuilder.cancel(2);
+
+        co_await settle();
+        EXPECT_TRUE(built.empty());
+        co_await prebuilder.stop();
+    });
+}
+
+TEST_CASE(WaitForInteractiveWork) {
+    Built built;
+    kota::event compiled;
+    auto wait = [&](std::uint32_t) -> kota::task<> {
+        co_await compiled.wait();
+    };
+
+    execute([&](kota::event_loop& loop) -> kota::task<> {
+        PCHPrebuilder prebuilder(loop, wait, tracking_build(built));
+
+        // Nothing is built while a compile of the file is in flight, and a
+        // preamble superseded meanwhile is not built at all.
+        EXPECT_TRUE(prebuilder.schedule(1, 10, 0));
+        co_await settle();
+        EXPECT_TRUE(built.empty());
+
+        EXPECT_TRUE(prebuilder.schedule(1, 11, 0));
+        co_await settle();
+        EXPECT_TRUE(built.empty());
+
+        compiled.set();
+        co_await settle();
+        EXPECT_EQ(built.size(), 1u);
+        EXPECT_EQ(built[0].second, 11u);
+        co_await prebuilder.stop();
+    });
+}
+
+TEST_CASE(OneBuildPerFile) {
+    Built built;
+    kota::event finished;
+    auto build = [&](std::uint32_t path_id, std::uint64_t preamble) -> kota::task<> {
+        built.emplace_back(path_id, preamble);
+        co_await finished.wait();
+    };
+
+    execute([&](kota::event_loop& loop) -> kota::task<> {
+        PCHPrebuilder prebuilder(loop, no_wait(), build);
+
+        EXPECT_TRUE(prebuilder.schedule(1, 10, 0));
+        co_await settle();
+        EXPECT_EQ(built.size(), 1u);
+
+        // The running build sees it is superseded, the next one waits for it.
+        EXPECT_TRUE(prebuilder.schedule(1, 11, 0));
+        EXPECT_FALSE(prebuilder.current(1, 10));
+        co_await settle();
+        EXPECT_EQ(built.size(), 1u);
+
+        finished.set();
+        co_await settle();
+        EXPECT_EQ(built.size(), 2u);
+        EXPECT_EQ(built[1].second, 11u);
+        co_await prebuilder.stop();
+    });
+}
+
+};  // TEST_SUITE(PCHPrebuilder)
+}  // namespace
+}  // namespace clice::testing
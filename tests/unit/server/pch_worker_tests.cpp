@@ -104,6 +104,143 @@ TEST_CASE(BuildPCHThenCompile) {
     std::remove(pch_path.c_str());
 }
 
+TEST_CASE(BuildBackgroundPCH) {
+    TempDir tmp;
+
+    tmp.touch("common.h", R"cpp(struct Point { int x, y; };)cpp" "\n");
+    std::string main_text = "#include \"common.h\"\nPoint p{1,2};\n";
+    tmp.touch("main.cpp", main_text);
+    auto main_file = tmp.path("main.cpp");
+    auto dir = std::string(tmp.root);
+
+    WorkerHandle sl;
+    ASSERT_TRUE(sl.spawn("stateless-worker"));
+
+    // A prebuild runs at low priority but builds the same PCH.
+    std::string pch_path;
+    sl.run([&]() -> kota::task<> {
+        worker::BuildParams params;
+        params.kind = worker::BuildKind::BuildPCH;
+        params.file = main_file;
+        params.directory = dir;
+        params.arguments = {"clang++",
+                            "-resource-dir",
+                            std::string(resource_dir()),
+                            "-x",
+                            "c++-header",
+                            "-I",
+                            dir,
+                            main_file};
+        params.text = main_text;
+        params.output_path = tmp.path("preamble.pch");
+        params.background = true;
+
+        auto result = co_await sl.peer->send_request(params);
+        CO_ASSERT_TRUE(result.has_value());
+        CO_ASSERT_TRUE(result.value().success);
+        pch_path = result.value().output_path;
+        sl.peer->close_output();
+    });
+
+    ASSERT_FALSE(pch_path.empty());
+    ASSERT_TRUE(llvm::sys::fs::exists(pch_path));
+    std::remove(pch_path.c_str());
+}
+
+TEST_CASE(BuildChainedPCHThenCompile) {
+    TempDir tmp;
+
+    tmp.touch("system.h", R"cpp(struct Size { int w, h; };)cpp" "\n");
+    tmp.touch("common.h", R"cpp(struct Point { int x, y; };)cpp" "\n");
+
+    std::string main_text =
+        "#include <system.h>\n#include \"common.h\"\nPoint p{1,2};\nSize s{3,4};\n";
+    tmp.touch("main.cpp", main_text);
+    auto main_file = tmp.path("main.cpp");
+
+    auto dir = std::string(tmp.root);
+    auto bound = compute_preamble_bound(main_text);
+    auto split = compute_preamble_split(main_text, bound);
+    ASSERT_TRUE(split > 0u);
+    ASSERT_TRUE(split < bound);
+
+    WorkerHandle sl;
+    ASSERT_TRUE(sl.spawn("stateless-worker"));
+
+    std::string pch_path;
+    bool phase1_done = false;
+
+    sl.run([&]() -> kota::task<> {
+        worker::BuildParams params;
+        params.kind = worker::BuildKind::BuildPCH;
+        params.file = main_file;
+        params.directory = dir;
+        params.arguments = {"clang++",
+                            "-resource-dir",
+                            std::string(resource_dir()),
+                            "-x",
+                            "c++-header",
+                            "-I",
+                            dir,
+                            main_file};
+        params.text = main_text;
+
+        // The first link covers the system include.
+        params.preamble_bound = split;
+        params.output_path = tmp.path("base.pch");
+        auto base = co_await sl.peer->send_request(params);
+        CO_ASSERT_TRUE(base.has_value());
+        CO_ASSERT_TRUE(base.value().success);
+
+        // The second link is chained on it and covers the rest.
+        params.preamble_bound = bound;
+        params.pch = {base.value().output_path, split};
+        params.output_path = tmp.path("preamble.pch");
+        auto result = co_await sl.peer->send_request(params);
+        CO_ASSERT_TRUE(result.has_value());
+        CO_ASSERT_TRUE(result.value().success);
+        pch_path = result.value().output_path;
+
+        phase1_done = true;
+        sl.peer->close_output();
+    });
+
+    ASSERT_TRUE(phase1_done);
+    ASSERT_TRUE(llvm::sys::fs::exists(pch_path));
+
+    WorkerHandle sf;
+    ASSERT_TRUE(sf.spawn("stateful-worker"));
+
+    bool phase2_done = false;
+
+    sf.run([&]() -> kota::task<> {
+        worker::CompileParams params;
+        params.path = main_file;
+        params.version = 1;
+        params.text = main_text;
+        params.directory = dir;
+        params.arguments = {"clang++",
+                            "-resource-dir",
+                            std::string(resource_dir()),
+                            "-fsyntax-only",
+                            "-I",
+                            dir,
+                            main_file};
+        params.pch = {pch_path, bound};
+
+        auto result = co_await sf.peer->send_request(params);
+        CO_ASSERT_TRUE(result.has_value());
+        EXPECT_EQ(result.value().version, 1);
+        // Both links were loaded, Point and Size are declared.
+        EXPECT_EQ(result.value().diagnostics.data, std::string("[]"));
+
+        phase2_done = true;
+        sf.peer->close_output();
+    });
+
+    ASSERT_TRUE(phase2_done);
+}
+
 TEST_CASE(CompileWithoutPCHStillWorks) {
     TempDir tmp;
 
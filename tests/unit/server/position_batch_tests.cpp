@@ -0,0 +1,95 @@
+#include <string>
+#include <vector>
+
+#include "test/test.h"
+#include "server/workspace/position_batch.h"
+
+#include "kota/ipc/lsp/position.h"
+
+namespace clice::testing {
+namespace {
+
+namespace lsp = kota::ipc::lsp;
+
+TEST_SUITE(PositionBatch) {
+
+TEST_CASE(MatchesMapper) {
+    std::string content = "int x = 1;\n// café \U0001F600 x\n\n  auto y = \"中\";\nend";
+    lsp::PositionMapper mapper(content, lsp::PositionEncoding::UTF16);
+
+    // Unsorted, with duplicates, on ASCII and non-ASCII lines.
+    std::vector<std::uint32_t> offsets;
+    for(std::uint32_t i = 0; i <= content.size(); i++) {
+        offsets.push_back((i * 7) % (content.size() + 1));
+    }
+    offsets.push_back(0);
+    offsets.push_back(static_cast<std::uint32_t>(content.size()));
+
+    auto positions = to_positions(content, offsets);
+    ASSERT_EQ(positions.size(), offsets.size());
+    for(std::size_t i = 0; i < offsets.size(); i++) {
+        auto offset = offsets[i];
+        auto byte = static_cast<unsigned char>(content[offset < content.size() ? offset : 0]);
+        // Offsets inside a UTF-8 sequence have no exact position.
+        if(offset < content.size() && (byte & 0xC0) == 0x80)
+            continue;
+        auto expected = mapper.to_position(offset);
+        ASSERT_TRUE(expected.has_value());
+        ASSERT_TRUE(positions[i].has_value());
+        EXPECT_EQ(positions[i]->line, expected->line);
+        EXPECT_EQ(positions[i]->character, expected->character);
+    }
+}
+
+TEST_CASE(SeekWithLineTable) {
+    // Long gaps between offsets are skipped with the line table.
+    std::string content;
+    for(int i = 0; i < 2000; i++) {
+        content += i % 3 ? "int value = 42;\n" : "// caf\u00e9 \u4e2d x\n";
+    }
+    lsp::PositionMapper mapper(content, lsp::PositionEncoding::UTF16);
+
+    std::vector<std::uint32_t> offsets;
+    for(std::uint32_t offset = 9000; offset < content.size(); offset += 7919) {
+        auto byte = static_cast<unsigned char>(content[offset]);
+        if((byte & 0xC0) != 0x80)
+            offsets.push_back(offset);
+    }
+    offsets.push_back(3);
+    offsets.push_back(static_cast<std::uint32_t>(content.size()));
+
+    auto seeded = to_positions(content, offsets, &mapper);
+    auto swept = to_positions(content, offsets);
+    ASSERT_EQ(seeded.size(), offsets.size());
+    for(std::size_t i = 0; i < offsets.size(); i++) {
+        auto expected = mapper.to_position(offsets[i]);
+        ASSERT_TRUE(expected.has_value());
+        ASSERT_TRUE(seeded[i].has_value());
+        ASSERT_TRUE(swept[i].has_value());
+        EXPECT_EQ(seeded[i]->line, expected->line);
+        EXPECT_EQ(seeded[i]->character, expected->character);
+        EXPECT_EQ(swept[i]->line, expected->line);
+        EXPECT_EQ(swept[i]->character, expected->character);
+    }
+}
+
+TEST_CASE(PastEnd) {
+    std::vector<std::uint32_t> offsets = {4, 3, 100, 0};
+    auto positions = to_positions("ab\nc", offsets);
+    ASSERT_TRUE(positions[0].has_value());
+    EXPECT_EQ(positions[0]->line, 1U);
+    EXPECT_EQ(positions[0]->character, 1U);
+    ASSERT_TRUE(positions[1].has_value());
+    EXPECT_EQ(positions[1]->line, 1U);
+    EXPECT_EQ(positions[1]->character, 0U);
+    EXPECT_FALSE(positions[2].has_value());
+    ASSERT_TRUE(positions[3].has_value());
+    EXPECT_EQ(positions[3]->line, 0U);
+
+    EXPECT_TRUE(to_positions("", offsets)[3].has_value());
+    EXPECT_FALSE(to_positions("", offsets)[0].has_value());
+}
+
+};  // TEST_SUITE(PositionBatch)
+}  // namespace
+}  // namespace clice::testing
@@ -0,0 +1,90 @@
+#include "test/test.h"
+#include "server/compiler/query_cache.h"
+
+namespace clice::testing {
+namespace {
+
+CachedRelations make_relations(std::uint64_t epoch, std::uint64_t file_count) {
+    CachedRelations relations;
+    relations.epoch = epoch;
+    relations.file_count = file_count;
+    relations.files.push_back({.path_id = 1});
+    return relations;
+}
+
+TEST_SUITE(QueryCache) {
+
+TEST_CASE(EpochAndFiles) {
+    QueryCache cache;
+    cache.insert(42, RelationKind::Reference, make_relations(3, 2));
+
+    EXPECT_TRUE(cache.find(42, RelationKind::Reference, 3, 2) != nullptr);
+    EXPECT_TRUE(cache.find(42, RelationKind::Reference, 1, 2) != nullptr);
+    EXPECT_TRUE(cache.find(42, RelationKind::Definition, 0, 2) == nullptr);
+    EXPECT_TRUE(cache.find(7, RelationKind::Reference, 0, 2) == nullptr);
+    EXPECT_EQ(cache.hits(), 2U);
+    EXPECT_EQ(cache.misses(), 2U);
+
+    // A file started referencing the symbol.
+    EXPECT_TRUE(cache.find(42, RelationKind::Reference, 3, 3) == nullptr);
+    EXPECT_EQ(cache.size(), 0U);
+
+    // A shard referencing the symbol was merged after the entry was filled.
+    cache.insert(42, RelationKind::Reference, make_relations(3, 2));
+    EXPECT_TRUE(cache.find(42, RelationKind::Reference, 4, 2) == nullptr);
+    EXPECT_EQ(cache.size(), 0U);
+}
+
+TEST_CASE(LeastRecentlyUsed) {
+    QueryCache cache(2);
+    cache.insert(1, RelationKind::Reference, make_relations(0, 1));
+    cache.insert(2, RelationKind::Reference, make_relations(0, 1));
+
+    // Touch 1 so 2 is evicted first.
+    ASSERT_TRUE(cache.find(1, RelationKind::Reference, 0, 1) != nullptr);
+    cache.insert(3, RelationKind::Reference, make_relations(0, 1));
+    EXPECT_EQ(cache.size(), 2U);
+    EXPECT_TRUE(cache.find(2, RelationKind::Reference, 0, 1) == nullptr);
+    EXPECT_TRUE(cache.find(1, RelationKind::Reference, 0, 1) != nullptr);
+    EXPECT_TRUE(cache.find(3, RelationKind::Reference, 0, 1) != nullptr);
+
+    // Replacing an entry does not grow the cache.
+    auto& replaced = cache.insert(3, RelationKind::Reference, make_relations(5, 1));
+    EXPECT_EQ(replaced.epoch, 5U);
+    EXPECT_EQ(cache.size(), 2U);
+}
+
+TEST_CASE(ByteBudget) {
+    auto make_large = [](std::size_t ranges) {
+        auto relations = make_relations(0, 1);
+        relations.files[0].ranges.resize(ranges);
+        return relations;
+    };
+
+    auto entry_bytes = make_large(100).heap_bytes();
+    QueryCache cache(256, entry_bytes * 12);
+
+    // Entries are evicted by bytes long before the count is reached.
+    for(index::SymbolHash symbol = 1; symbol <= 20; symbol++) {
+        cache.insert(symbol, RelationKind::Reference, make_large(100));
+    }
+    EXPECT_TRUE(cache.size() < 20U);
+    EXPECT_TRUE(cache.bytes() <= entry_bytes * 12);
+    EXPECT_TRUE(cache.find(20, RelationKind::Reference, 0, 1) != nullptr);
+    EXPECT_TRUE(cache.find(1, RelationKind::Reference, 0, 1) == nullptr);
+
+    // A result over an eighth of the budget is returned but not cached, and
+    // drops the entry it replaces.
+    auto size = cache.size();
+    auto& large = cache.insert(20, RelationKind::Reference, make_large(400));
+    EXPECT_EQ(large.files[0].ranges.size(), 400U);
+    EXPECT_EQ(cache.size(), size - 1);
+    EXPECT_TRUE(cache.find(20, RelationKind::Reference, 0, 1) == nullptr);
+
+    cache.clear();
+    EXPECT_EQ(cache.bytes(), 0U);
+}
+
+};  // TEST_SUITE(QueryCache)
+}  // namespace
+}  // namespace clice::testing
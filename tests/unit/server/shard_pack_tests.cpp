@@ -0,0 +1,102 @@
+#include <string>
+
+#include "test/temp_dir.h"
+#include "test/test.h"
+#include "server/workspace/shard_pack.h"
+#include "support/filesystem.h"
+
+namespace clice::testing {
+namespace {
+
+std::string read_shard(const ShardPack& pack, std::uint32_t path_id) {
+    auto buffer = pack.get(path_id);
+    return buffer ? buffer->getBuffer().str() : std::string();
+}
+
+TEST_SUITE(ShardPack) {
+
+TEST_CASE(AppendAndReopen) {
+    TempDir tmp;
+    auto path = tmp.path("shards.pack");
+    {
+        ShardPack pack;
+        pack.open(path);
+        EXPECT_EQ(pack.size(), 0U);
+        ASSERT_TRUE(pack.append({{1, "first"}, {2, "second shard"}}));
+        EXPECT_EQ(pack.size(), 2U);
+        EXPECT_EQ(read_shard(pack, 1), "first");
+        EXPECT_EQ(read_shard(pack, 2), "second shard");
+        EXPECT_TRUE(pack.get(3) == nullptr);
+    }
+
+    ShardPack pack;
+    pack.open(path);
+    ASSERT_EQ(pack.size(), 2U);
+    EXPECT_TRUE(pack.contains(1));
+    EXPECT_EQ(read_shard(pack, 2), "second shard");
+}
+
+TEST_CASE(NewVersionKeepsOldBuffers) {
+    TempDir tmp;
+    ShardPack pack;
+    pack.open(tmp.path("shards.pack"));
+    ASSERT_TRUE(pack.append({{1, "old"}, {2, "other"}}));
+    EXPECT_EQ(pack.dead_bytes(), 0U);
+
+    auto old = pack.get(1);
+    ASSERT_TRUE(pack.append({{1, "new version"}}));
+    EXPECT_EQ(old->getBuffer(), "old");
+    EXPECT_EQ(read_shard(pack, 1), "new version");
+    EXPECT_EQ(read_shard(pack, 2), "other");
+    EXPECT_TRUE(pack.dead_bytes() > 0);
+}
+
+TEST_CASE(RepackDropsDeadBytes) {
+    TempDir tmp;
+    auto path = tmp.path("shards.pack");
+    ShardPack pack;
+    pack.open(path);
+    ASSERT_TRUE(pack.append({{1, "a"}, {2, "b"}}));
+    ASSERT_TRUE(pack.append({{1, "aa"}}));
+    ASSERT_TRUE(pack.append({{1, "aaa"}}));
+
+    auto live = pack.live_bytes();
+    auto old = pack.get(2);
+    ASSERT_TRUE(pack.repack());
+    EXPECT_EQ(pack.live_bytes(), live);
+    EXPECT_EQ(old->getBuffer(), "b");
+    EXPECT_EQ(read_shard(pack, 1), "aaa");
+    EXPECT_EQ(read_shard(pack, 2), "b");
+
+    ShardPack reopened;
+    reopened.open(path);
+    EXPECT_EQ(reopened.dead_bytes(), pack.dead_bytes());
+    EXPECT_EQ(read_shard(reopened, 1), "aaa");
+}
+
+TEST_CASE(TornCommitFallsBack) {
+    TempDir tmp;
+    auto path = tmp.path("shards.pack");
+    {
+        ShardPack pack;
+        pack.open(path);
+        ASSERT_TRUE(pack.append({{1, "committed"}}));
+        ASSERT_TRUE(pack.append({{1, "torn"}}));
+    }
+
+    // Cut the last directory short, its slot no longer matches.
+    auto content = fs::read(path);
+    ASSERT_TRUE(content.has_value());
+    ASSERT_TRUE(fs::write(path, llvm::StringRef(*content).drop_back(4)).has_value());
+
+    ShardPack pack;
+    pack.open(path);
+    EXPECT_EQ(read_shard(pack, 1), "committed");
+    ASSERT_TRUE(pack.append({{2, "after"}}));
+    EXPECT_EQ(read_shard(pack, 1), "committed");
+    EXPECT_EQ(read_shard(pack, 2), "after");
+}
+
+};  // TEST_SUITE(ShardPack)
+}  // namespace
+}  // namespace clice::testing
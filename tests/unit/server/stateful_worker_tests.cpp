@@ -45,6 +45,7 @@ TEST_CASE(CompileRequest) {
         auto result = co_await w.peer->send_request(params);
         CO_ASSERT_TRUE(result.has_value());
         EXPECT_EQ(result.value().version, 1);
+        EXPECT_TRUE(result.value().memory_usage > 0);
         test_done = true;
         w.peer->close_output();
     });
@@ -163,6 +164,69 @@ TEST_CASE(DocumentUpdate) {
     ASSERT_TRUE(test_done);
 }
 
+TEST_CASE(IncrementalUpdate) {
+    TempDir tmp;
+    tmp.touch("incremental_test.cpp", "int x = 1;\n");
+    auto src = tmp.path("incremental_test.cpp");
+
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn("stateful-worker"));
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        worker::CompileParams cp;
+        cp.path = src;
+        cp.version = 1;
+        cp.text = "int x = 1;\n";
+        cp.directory = "/tmp";
+        cp.arguments = make_args(src);
+
+        auto r1 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r1.has_value());
+        EXPECT_FALSE(r1.value().need_text);
+
+        // Rename `x` on the worker's copy and compile it without text.
+        worker::DocumentUpdateParams up;
+        up.path = src;
+        up.version = 2;
+        up.previous_version = 1;
+        up.edits = {{.begin = 4, .end = 5, .text = "renamed"}};
+        w.peer->send_notification(up);
+
+        cp.version = 2;
+        cp.text.clear();
+        cp.incremental = true;
+        auto r2 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r2.has_value());
+        EXPECT_FALSE(r2.value().need_text);
+        EXPECT_EQ(r2.value().version, 2);
+
+        worker::QueryParams hp;
+        hp.kind = worker::QueryKind::Hover;
+        hp.path = src;
+        hp.offset = 4;
+        auto hover = co_await w.peer->send_request(hp);
+        CO_ASSERT_TRUE(hover.has_value());
+        EXPECT_TRUE(hover.value().data.find("renamed") != std::string::npos);
+
+        // Edits from a version the worker does not hold drop its copy.
+        up.version = 4;
+        up.previous_version = 3;
+        w.peer->send_notification(up);
+
+        cp.version = 4;
+        auto r3 = co_await w.peer->send_request(cp);
+        CO_ASSERT_TRUE(r3.has_value());
+        EXPECT_TRUE(r3.value().need_text);
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+}
+
 TEST_CASE(CodeActionReturnsEmpty) {
     WorkerHandle w;
     ASSERT_TRUE(w.spawn("stateful-worker"));
@@ -462,6 +526,58 @@ TEST_CASE(EvictNotification) {
     ASSERT_TRUE(test_done);
 }
 
+TEST_CASE(EvictOverMemoryLimit) {
+    TempDir tmp;
+    std::vector<std::string> paths;
+    std::vector<std::string> texts;
+    for(int i = 0; i < 2; i++) {
+        auto name = "evict_" + std::to_string(i) + ".cpp";
+        auto text = "int var_" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+        tmp.touch(name, text);
+        paths.push_back(tmp.path(name));
+        texts.push_back(text);
+    }
+
+    // Any AST is over a 1 byte limit, so only the last compiled one is kept.
+    WorkerHandle w;
+    ASSERT_TRUE(w.spawn("stateful-worker", 1));
+
+    std::vector<std::string> evicted;
+    w.peer->on_notification(
+        [&](const worker::EvictedParams& params) { evicted.push_back(params.path); });
+
+    bool test_done = false;
+
+    w.run([&]() -> kota::task<> {
+        for(int i = 0; i < 2; i++) {
+            worker::CompileParams cp;
+            cp.path = paths[i];
+            cp.version = 1;
+            cp.text = texts[i];
+            cp.directory = "/tmp";
+            cp.arguments = make_args(paths[i]);
+            auto result = co_await w.peer->send_request(cp);
+            CO_ASSERT_TRUE(result.has_value());
+        }
+
+        // The first document was evicted.
+        worker::QueryParams hp;
+        hp.kind = worker::QueryKind::Hover;
+        hp.path = paths[0];
+        hp.offset = 4;
+        auto result = co_await w.peer->send_request(hp);
+        CO_ASSERT_TRUE(result.has_value());
+        EXPECT_EQ(result.value().data, std::string("null"));
+
+        test_done = true;
+        w.peer->close_output();
+    });
+
+    ASSERT_TRUE(test_done);
+    ASSERT_EQ(evicted.size(), 1U);
+    EXPECT_EQ(evicted[0], paths[0]);
+}
+
 TEST_CASE(SpawnWithMemoryLimit) {
     TempDir tmp;
     tmp.touch("memlimit_test.cpp", "int memlimit_var = 42;\n");
@@ -0,0 +1,69 @@
+#include <cstdint>
+#include <vector>
+
+#include "test/test.h"
+#include "support/bloom_filter.h"
+
+namespace clice::testing {
+
+namespace {
+
+/// Spread consecutive integers over 64 bits like real symbol hashes.
+std::uint64_t mix(std::uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+TEST_SUITE(BloomFilter) {
+
+TEST_CASE(NoFalseNegatives) {
+    BloomFilter filter(1000);
+    for(std::uint64_t i = 0; i < 1000; ++i) {
+        filter.insert(mix(i));
+    }
+    for(std::uint64_t i = 0; i < 1000; ++i) {
+        ASSERT_TRUE(filter.may_contain(mix(i)));
+    }
+
+    // About 1e-5 false positives are expected, allow a wide margin.
+    std::size_t false_positives = 0;
+    for(std::uint64_t i = 1000; i < 101000; ++i) {
+        false_positives += filter.may_contain(mix(i));
+    }
+    EXPECT_TRUE(false_positives < 20);
+}
+
+TEST_CASE(EmptyFilter) {
+    BloomFilter filter;
+    EXPECT_TRUE(filter.empty());
+    EXPECT_FALSE(filter.may_contain(mix(1)));
+}
+
+TEST_CASE(SerializeRoundTrip) {
+    BloomFilter filter(100);
+    for(std::uint64_t i = 0; i < 100; ++i) {
+        filter.insert(mix(i));
+    }
+
+    auto restored = BloomFilter::from(filter.serialize());
+    EXPECT_EQ(restored.bytes(), filter.bytes());
+    for(std::uint64_t i = 0; i < 100; ++i) {
+        ASSERT_TRUE(restored.may_contain(mix(i)));
+    }
+    for(std::uint64_t i = 100; i < 1100; ++i) {
+        ASSERT_EQ(restored.may_contain(mix(i)), filter.may_contain(mix(i)));
+    }
+
+    // Truncated data gives an empty filter.
+    auto data = filter.serialize();
+    data.pop_back();
+    EXPECT_TRUE(BloomFilter::from(data).empty());
+}
+
+};  // TEST_SUITE(BloomFilter)
+
+}  // namespace
+
+}  // namespace clice::testing
@@ -289,6 +289,63 @@ int x;
 
 };  // TEST_SUITE(PreambleBound)
 
+TEST_SUITE(PreambleSplit) {
+
+TEST_CASE(SystemThenProject) {
+    llvm::StringRef src = R"(
+#include <vector>
+#include <string>
+#include "a.h"
+#include <map>
+#include "b.h"
+int x;
+)";
+    auto split = compute_preamble_split(src, compute_preamble_bound(src));
+    EXPECT_EQ(split, src.find("<string>") + 8);
+}
+
+TEST_CASE(NoProjectIncludes) {
+    llvm::StringRef src = R"(
+#include <vector>
+#include <string>
+int x;
+)";
+    EXPECT_EQ(compute_preamble_split(src, compute_preamble_bound(src)), 0u);
+}
+
+TEST_CASE(ProjectFirst) {
+    llvm::StringRef src = R"(
+#include "a.h"
+#include <vector>
+int x;
+)";
+    EXPECT_EQ(compute_preamble_split(src, compute_preamble_bound(src)), 0u);
+}
+
+TEST_CASE(SkipsConditionals) {
+    llvm::StringRef src = R"(
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "a.h"
+int x;
+)";
+    auto split = compute_preamble_split(src, compute_preamble_bound(src));
+    EXPECT_EQ(split, src.find("<vector>") + 8);
+}
+
+TEST_CASE(OutsideBound) {
+    llvm::StringRef src = R"(
+#include <vector>
+#include "a.h"
+int x;
+)";
+    EXPECT_EQ(compute_preamble_split(src, src.find("#include \"")), 0u);
+}
+
+};  // TEST_SUITE(PreambleSplit)
+
 TEST_SUITE(PreambleComplete) {
 
 TEST_CASE(CompleteQuotedInclude) {